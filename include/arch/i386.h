@@ -161,6 +161,21 @@ typedef struct {
 #define i386_load_task_reg(sel) asm ("ltrw %%ax     \n\t"::"a"( sel ));
 
 extern uint i386_rdtsc(uint64_t *timestamp);
+
+/* divides *n by base in place, returns the remainder; there is no libgcc */
+static inline uint32_t i386_div64(uint64_t *n, uint32_t base) {
+    uint32_t high = (uint32_t)(*n >> 32);
+    uint32_t low = (uint32_t)*n;
+    uint32_t qhigh = 0, rem;
+    if (high >= base) {
+        qhigh = high / base;
+        high %= base;
+    }
+    asm ("divl %2" : "=a"(low), "=d"(rem) : "rm"(base), "0"(low), "1"(high));
+    *n = ((uint64_t)qhigh << 32) | low;
+    return rem;
+}
+
 extern void i386_snapshot(char *buf);
 
 #define i386_eflags(flags)          \
@@ -170,6 +185,7 @@ extern void i386_snapshot(char *buf);
         : "=r"(flags))
 
 #define eflags_iopl(pl)     ((pl & 3) << 12)
+#define EFLAGS_IF           0x00000200
 
 struct eflags {
     uint8_t cf:1;   // 0
@@ -246,8 +262,24 @@ int i386_sema_up(int semcounter, int release_callback(int, void *));
 /***
   *     Paging
  ***/
+/* loads %cr3, TLB entries of global pages are kept */
 extern void i386_switch_pagedir(void *new_pagedir);
 
+/* sets `cr4_flags` in %cr4, loads %cr3 and turns paging on */
+extern void i386_enable_paging(void *pagedir, uint cr4_flags);
+
+#define i386_invlpg(vaddr)  \
+    asm volatile ("invlpg (%0) \n" :: "r"(vaddr) : "memory")
+
+/***
+  *     Model-specific registers
+ ***/
+#define i386_rdmsr(msr, lo, hi)  \
+    asm volatile ("rdmsr \n" : "=a"(lo), "=d"(hi) : "c"(msr))
+
+#define i386_wrmsr(msr, lo, hi)  \
+    asm volatile ("wrmsr \n" :: "a"(lo), "d"(hi), "c"(msr))
+
 /***
   *     Interrupts
  ***/
@@ -301,6 +333,9 @@ ptr_t cpu_stack(void);
 
 static void __noreturn cpu_hang(void) { i386_hang(); }
 
+/* background work, then halt until an interrupt */
+void cpu_idle(void);
+
 #define inb(port, value)       i386_inb(port, value)
 #define outb(port, value)      i386_outb(port, value)
 #define inw(port, value)       i386_inw(port, value)
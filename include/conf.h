@@ -2,19 +2,22 @@
 #define __CONF_H__
 
 #define PAGE_SIZE       0x1000
+#define PAGE_SHIFT      12
 
-#define PAGING          (0)
+#define PAGING          (1)
 
 #define INTR_PROFILING  (0)
 #define MEM_DEBUG       (1)
+#define KHEAP_DEBUG     (1)
+#define MEM_PROFILING   (0)
 #define TASK_DEBUG      (0)
 #define INTR_DEBUG      (1)
 
-#if PAGING
-# define KERN_OFF       0xc0000000
-#else
-# define KERN_OFF       0x00000000
-#endif
+/* one-shot timer interrupts only when a tick is needed */
+#define TIMER_TICKLESS  (1)
+
+/* the kernel runs at its physical addresses, paging maps them 1:1 */
+#define KERN_OFF        0x00000000
 
 #define KERN_PA         0x00100000
 
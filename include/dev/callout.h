@@ -0,0 +1,47 @@
+#ifndef __CALLOUT_H__
+#define __CALLOUT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/***
+  *     Callouts: functions called from the timer interrupt after a delay
+  *   in timer ticks, once or periodically. A callout is embedded in its
+  *  owner's structure; inserting and cancelling it take constant time.
+ ***/
+
+typedef void (*callout_f)(void *arg);
+
+typedef struct callout {
+    struct callout *  next;
+    struct callout ** pprev;    /* null if not pending */
+    ulong       expires;        /* tick */
+    uint        period;         /* ticks, 0 for a one-shot */
+    callout_f   func;
+    void *      arg;
+} callout_t;
+
+void callout_init(callout_t *c, callout_f func, void *arg);
+
+/* (re)starts `c` to fire `ticks` ticks from now */
+void callout_reset(callout_t *c, uint ticks);
+
+/* (re)starts `c` to fire every `period` ticks */
+void callout_periodic(callout_t *c, uint period);
+
+/* returns true if `c` was pending */
+bool callout_stop(callout_t *c);
+
+static inline bool callout_pending(callout_t *c) {
+    return c->pprev != 0;
+}
+
+/* runs callouts which are due at `tick`, called by the timer interrupt */
+void callout_run(ulong tick);
+
+/* the tick of the earliest pending callout if there is one in `*tick` */
+bool callout_next(ulong *tick);
+
+void callout_info(void);
+
+#endif // __CALLOUT_H__
@@ -0,0 +1,27 @@
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+#include <stdint.h>
+#include <time.h>
+
+/***
+  *     Clocks: the TSC calibrated against the PIT at boot, or timer ticks
+  *   if there is no TSC. The realtime clock is the monotonic one plus the
+  *  CMOS time read once at boot.
+ ***/
+
+/* nanoseconds since boot */
+uint64_t clock_monotonic_ns(void);
+
+/* nanoseconds since the epoch */
+uint64_t clock_realtime_ns(void);
+
+/* TSC cycles to nanoseconds, e.g. for benchmarks */
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+
+int sys_clock_gettime(clockid_t clk, struct timespec *ts);
+
+void clock_info(void);
+void clock_setup(void);
+
+#endif // __CLOCK_H__
@@ -13,12 +13,22 @@ typedef uint useconds_t;
 int usleep(useconds_t usec);
 
 /*
- *  adds timer event handler
- *  returns timer ID, which has to be stored to delete i
+ *  adds a handler which is called at every tick, see callout.h for
+ *  delayed calls which do not keep a tickless timer ticking
+ *  returns timer ID, which has to be stored to delete it
  *    if N_TIMERS, event can't be enabled
  */
 timer_t timer_push_ontimer(timer_event_f ontimer);
 
+/*
+ *  adds a handler which is called at timer interrupts, these happen
+ *  only at ticks requested with timer_request() in tickless mode
+ */
+timer_t timer_push_onevent(timer_event_f onevent);
+
+/* asks for a timer interrupt at `tick` or earlier */
+void timer_request(ulong tick);
+
 /* gets how manu ticks are done */
 ulong timer_ticks(void);
 
@@ -31,6 +41,7 @@ void timer_pop_ontimer(timer_t id);
 void timer_set_frequency(uint hz);
 uint timer_frequency(void);
 
+void timer_info(void);
 void timer_setup(void);
 void timer_irq();
 
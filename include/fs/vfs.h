@@ -7,6 +7,7 @@
 #include <sys/dirent.h>
 #include <sys/types.h>
 
+#include <mem/pmem.h>
 #include <fs/devices.h>
 
 #define FS_SEP  '/'
@@ -145,6 +146,12 @@ struct filesystem_operations {
      */
     int (*trunc_inode)(mountnode *sb, inode_t ino, off_t length);
 
+    /**
+     * \brief  gets the pageframe holding data at `index * PAGE_SIZE` for mapping
+     * @param frame     is set to the pageframe number, the mapping takes a reference to it;
+     */
+    int (*inode_page)(mountnode *sb, inode_t ino, off_t index, pfn_t *frame);
+
     /**
      * \brief  iterates through directory and fills `dir`.
      * @param ino   the directory inode index;
@@ -212,6 +219,7 @@ int vfs_inode_read(mountnode *sb, inode_t ino, off_t pos,
 int vfs_inode_write(mountnode *sb, inode_t ino, off_t pos,
                     const char *buf, size_t buflen, size_t *written);
 int vfs_inode_trunc(mountnode *sb, inode_t ino, off_t length);
+int vfs_inode_page(mountnode *sb, inode_t ino, off_t index, pfn_t *frame);
 
 void print_ls(const char *path);
 void print_mount(void);
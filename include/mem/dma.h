@@ -0,0 +1,22 @@
+#ifndef __DMA_H__
+#define __DMA_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/***
+  *     DMA zone: physically contiguous memory taken from pmem at boot,
+  *   before it fragments, and handed out to device rings and buffers.
+  *   Allocations are whole pages; `align` is a power of two, alignments
+  *  up to PAGE_SIZE are always satisfied.
+ ***/
+
+/* returns the kernel address of `size` zeroed bytes, `*paddr` is their bus address */
+void * dma_alloc(size_t size, size_t align, ptr_t *paddr);
+
+void dma_free(void *vaddr, size_t size);
+
+void dma_info(void);
+void dma_setup(void);
+
+#endif // __DMA_H__
@@ -1,6 +1,8 @@
 #ifndef __FIRSTFIT_H__
 #define __FIRSTFIT_H__
 
+#include <stddef.h>
+
 /***
   *     Use a pointer to this structure as identifier of specific memory area 
   *    being managed, e.g. struct firstfit_allocator *heap1, *heap2;  (memory 
@@ -13,7 +15,7 @@ struct firstfit_allocator;
   *     'startmem' with size 'size'. Return 'null', if fails (e.g.size is not 
   *     sufficient for storing at least 1 byte). 
  ***/
-struct firstfit_allocator * firstfit_new(void *startmem, unsigned size);
+struct firstfit_allocator * firstfit_new(void *startmem, size_t size);
 
 /***
   *     Allocate 'length' byte area in 'this'
@@ -24,7 +26,7 @@ void *firstfit_malloc(struct firstfit_allocator *this, unsigned size);
 /***
   *     Shrink or grow pointer memory
  ***/
-void *firstfit_realloc(struct firstfit_allocator *this, void *p, unsigned size);
+void *firstfit_realloc(struct firstfit_allocator *this, void *p, size_t size);
 
 /***
   *     Free memory, keep consistency of the heap, check heap for corruption, 
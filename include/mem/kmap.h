@@ -0,0 +1,26 @@
+#ifndef __KMAP_H__
+#define __KMAP_H__
+
+#include <stdint.h>
+
+#include <mem/pmem.h>
+#include <mem/paging.h>
+
+/***
+  *     Temporary kernel mappings of pageframes which are not in the direct
+  *   map, in [KERN_KMAP_START, KERN_KMAP_END). A mapping is valid in every
+  *  address space until kunmap(), direct map pageframes are returned as
+  *  they are. Mappings are meant to be short: the window is small.
+ ***/
+
+#define KMAP_SLOTS      ((KERN_KMAP_END - KERN_KMAP_START) / PAGE_SIZE)
+
+/* returns the address of the pageframe or null if the window is full */
+void * kmap(pfn_t pfn);
+
+void kunmap(void *vaddr);
+
+void kmap_info(void);
+void kmap_setup(void);
+
+#endif // __KMAP_H__
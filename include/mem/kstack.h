@@ -0,0 +1,33 @@
+#ifndef __KSTACK_H__
+#define __KSTACK_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <mem/paging.h>
+
+/***
+  *     Kernel stacks of tasks: page-aligned stacks in
+  *   [KERN_KSTACKS_START, KERN_KSTACKS_END), each one above an unmapped
+  *  guard area, so an overflow faults instead of corrupting memory.
+  *     Released stacks are kept mapped in a pool and handed out again.
+ ***/
+
+#define KSTACK_PAGES        2
+#define KSTACK_SIZE         (KSTACK_PAGES * PAGE_SIZE)
+
+/* a stack and its guard area below */
+#define KSTACK_SLOT_SIZE    (2 * KSTACK_SIZE)
+
+/* returns the lowest address of a new stack or null */
+void * kstack_alloc(void);
+
+void kstack_free(void *stack);
+
+/* the stack whose guard area contains `addr`, or null */
+void * kstack_guard_hit(ptr_t addr);
+
+void kstack_info(void);
+void kstack_setup(void);
+
+#endif // __KSTACK_H__
@@ -0,0 +1,29 @@
+#ifndef __MEMPROF_H__
+#define __MEMPROF_H__
+
+#include <stdint.h>
+
+/***
+  *     Allocation profiler, enabled by MEM_PROFILING in conf.h.
+  *   Allocators report every allocation/release with its call site,
+  *  size and rdtsc cycles spent.
+ ***/
+
+enum memprof_kind {
+    MEMPROF_KMALLOC,
+    MEMPROF_PMEM,
+    MEMPROF_KINDS,
+};
+
+/* `caller` is the allocation site */
+void memprof_alloc(enum memprof_kind kind, ptr_t caller, size_t size, uint64_t cycles);
+
+/* `caller` is the site which allocated the memory, 0 if unknown */
+void memprof_free(enum memprof_kind kind, ptr_t caller, size_t size, uint64_t cycles);
+
+/* prints `top_n` sites with the most live memory, to the console and log */
+void memprof_report(size_t top_n);
+
+void memprof_reset(void);
+
+#endif // __MEMPROF_H__
@@ -16,38 +16,150 @@
 #define PG_GLOBL        0x00000100
 #define PG_PAT          0x00001000
 
-#define PG31_22_MASK    0xFFC00000
+/* page fault error code */
+#define PGF_PROT        0x00000001  /* the page is present */
+#define PGF_WRITE       0x00000002
+#define PGF_USER        0x00000004
+#define PGF_RSVD        0x00000008  /* a reserved bit is set in an entry */
+#define PGF_INSTR       0x00000010  /* an instruction fetch */
+
+#define PG31_21_MASK    0xFFE00000
 #define PG31_12_MASK    0xFFFFF000
 
-#define PDE_SHIFT       22
+/***
+  *     PAE paging: 64-bit entries, four page directories of 512 entries
+  *   are selected by a page directory pointer table (PDPT) of 4 entries.
+  *   The page directories of an address space are contiguous here,
+  *  so pde_index() addresses them as one table of N_PDE entries.
+ ***/
+#define PDPTE_SHIFT     30
+#define PDE_SHIFT       21
 #define PTE_SHIFT       12
 
-#define PDE_SIZE        4
-#define PTE_SIZE        4
+#define LARGE_PAGE_SIZE (1 << PDE_SHIFT)
 
-#define N_PDE           (PAGE_SIZE / PDE_SIZE)
+#define PDPTE_SIZE      8
+#define PDE_SIZE        8
+#define PTE_SIZE        8
+
+#define N_PDPTE         4
 #define PTE_PER_ENTRY   (PAGE_SIZE / PTE_SIZE)
+#define N_PDE           (N_PDPTE * PTE_PER_ENTRY)
 
 #define CR0_PG      0x80000000
 #define CR0_WP      0x00010000
 
+#define CR4_PSE     0x00000010
+#define CR4_PAE     0x00000020
+#define CR4_PGE     0x00000080
+
+/***
+  *     Virtual memory layout:
+  *  [0, KERN_DIRECTMAP_END)            physical memory, 1:1, 2M global pages,
+  *                                     only as far as there is memory
+  *  [USER_START, USER_END)             process address spaces, 4K pages
+  *  [KERN_KMAP_START, KERN_KMAP_END)   temporary mappings, see kmap()
+  *  [KERN_KSTACKS_START, KERN_KSTACKS_END)  kernel stacks, 4K pages
+  *  [KERN_MMIO_START, 4G)              device memory, 1:1, uncached
+  *   Physical memory above KERN_DIRECTMAP_END is high memory, pmem hands
+  *  out its pageframes by number only. User pages come from it first.
+  *   The direct map is exactly the first page directory, which is shared
+  *  by all address spaces.
+ ***/
+#define KERN_DIRECTMAP_END  0x40000000
+#define KERN_KMAP_START     0xEEE00000
+#define KERN_KMAP_END       0xEF000000
+#define KERN_KSTACKS_START  0xEF000000
+#define KERN_KSTACKS_END    0xF0000000
+#define KERN_MMIO_START     0xF0000000
+
+#define USER_START      KERN_DIRECTMAP_END
+#define USER_END        KERN_KMAP_START
+
+#if KERN_DIRECTMAP_END != (1 << PDPTE_SHIFT)
+# error "the direct map must be the first page directory"
+#endif
+#if (KERN_KMAP_END - KERN_KMAP_START) != LARGE_PAGE_SIZE
+# error "the kmap window must be one page table"
+#endif
+
 
 #ifndef NOT_CC
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
+
+#include <mem/pmem.h>
 
 #define __pa(vaddr) (void *)(((char *)vaddr) - KERN_OFF)
 #define __va(paddr) (void *)(((char *)paddr) + KERN_OFF)
 
-typedef  uint32_t  pde_t;
-typedef  uint32_t  pte_t;
+typedef  uint64_t  pdpte_t;
+typedef  uint64_t  pde_t;
+typedef  uint64_t  pte_t;
+
+/* execute-disable, only valid if paging_nx() is not zero */
+#define PG_NX           (1ull << 63)
+
+/* the flags part of a PAE entry */
+#define PG_FLAGS_MASK   (PG_NX | ~PG31_12_MASK)
 
+/* the address part of a PAE entry, bits 12..51 */
+#define PG_ADDR_MASK    0x000FFFFFFFFFF000ull
+
+#define pte_pfn(pte)    ((pfn_t)(((pte) & PG_ADDR_MASK) >> PAGE_SHIFT))
+
+#define pde_index(vaddr)    ((ptr_t)(vaddr) >> PDE_SHIFT)
+#define pte_index(vaddr)    (((ptr_t)(vaddr) >> PTE_SHIFT) & (PTE_PER_ENTRY - 1))
+
+/* the kernel address space, kernel parts of all page directories are its copies */
 extern pde_t thePageDirectory[N_PDE];
 
 void pg_fault(void);
 
+/* PG_NX if the CPU supports execute-disable, 0 otherwise */
+pte_t paging_nx(void);
+
+/* the end of the direct map: physical memory below it is mapped 1:1 */
+ptr_t paging_directmap_end(void);
+
 void paging_setup(void);
+void paging_info(void);
+
+/***
+  *     Address spaces
+ ***/
+
+/***
+  *     A new page directory with the kernel mappings and empty user space.
+  *   It takes 4 pages: the first one holds the PDPT, the direct map
+  *  page directory is the kernel one, so pagedir[pde_index(vaddr)] is
+  *  only valid for vaddr >= KERN_DIRECTMAP_END.
+ ***/
+pde_t * pagedir_new(void);
+
+/* frees the page directory and its page tables, not the mapped pages */
+void pagedir_free(pde_t *pagedir);
+
+/***
+  *     Returns the page table entry for `vaddr`.
+  *   A missing page table is allocated from pmem if `alloc` is set,
+  *  otherwise null is returned; null is returned for large pages.
+ ***/
+pte_t * pagedir_pte(pde_t *pagedir, ptr_t vaddr, bool alloc);
+
+/* maps a page at user address `vaddr` to pageframe `pfn`, `flags` are PG_* */
+err_t pagedir_map(pde_t *pagedir, ptr_t vaddr, pfn_t pfn, pte_t flags);
+
+/* returns the pageframe which was mapped at `vaddr` or 0 */
+pfn_t pagedir_unmap(pde_t *pagedir, ptr_t vaddr);
+
+void pagedir_switch(pde_t *pagedir);
+pde_t * pagedir_current(void);
+
+/* the physical address of the PDPT of `pagedir`, the %cr3 value */
+ptr_t pagedir_cr3(pde_t *pagedir);
 
 #endif // NOT_CC
 #endif //__PAGING_H__
@@ -0,0 +1,43 @@
+#ifndef __PCACHE_H__
+#define __PCACHE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <fs/vfs.h>
+
+/***
+  *     Page cache: PAGE_SIZE pieces of devices and files kept in memory.
+  *   A page is identified by its owner (a device or a superblock), an inode
+  *  (0 for raw devices) and the page index. Pages which are not in use
+  *  are evicted by CLOCK when the cache is full or memory is short.
+ ***/
+typedef struct pcache_page pcache_page_t;
+
+/* reads page `index` into `data` (PAGE_SIZE bytes) */
+typedef err_t (*pcache_fill_f)(void *owner, inode_t ino, off_t index, char *data);
+
+/***
+  *     Finds a page or reads it with `fill`, the page is in use
+  *   until pcache_put(). Returns null if no memory or `fill` failed.
+ ***/
+pcache_page_t * pcache_get(void *owner, inode_t ino, off_t index, pcache_fill_f fill);
+
+void pcache_put(pcache_page_t *page);
+
+/* the page data, mapped until the last pcache_put() */
+char * pcache_data(pcache_page_t *page);
+
+/* drops a page (e.g. after it has been written), if it is cached */
+void pcache_forget(void *owner, inode_t ino, off_t index);
+
+/* drops all pages of an inode */
+void pcache_forget_inode(void *owner, inode_t ino);
+
+/* evicts up to `n_pages` unused pages, returns the number of evicted */
+size_t pcache_shrink(size_t n_pages);
+
+void pcache_info(void);
+void pcache_setup(void);
+
+#endif // __PCACHE_H__
@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include <conf.h>
+
 #define VIRTUAL_ADDRESS 0xc0100000
 
 /** allocate a page **/
@@ -13,11 +15,18 @@ index_t pg_alloc(void);
 void pg_free(index_t);
 
 /*
- *  Allocate consequent pageframes
- *  returns index of first page
+ *  Allocate consequent pageframes (buddy allocator, O(log n))
+ *  returns address of the first page or null
  */
 void * pmem_alloc(size_t pages_count);
 
+/* the same, filled with zeroes; single pages come from the idle-time pool */
+void * pmem_alloc_zeroed(size_t pages_count);
+
+/* refills the pool of zeroed pages and reclaims memory below
+ * the low watermark, called when the cpu is idle */
+void pmem_idle(void);
+
 err_t pmem_reserve(void *startptr, void *endptr);
 
 /* returns 0 if all pages are available,
@@ -25,20 +34,86 @@ err_t pmem_reserve(void *startptr, void *endptr);
 index_t pmem_check_avail(void *startptr, void *endptr);
 
 /*
- *  Releases pages
+ *  Releases pages allocated by pmem_alloc()/pmem_reserve(),
+ *  merges them with their free buddies
  */
 
-err_t pmem_free(index_t start_page, size_t pages_count);
+err_t pmem_free(void *startptr, size_t pages_count);
 
-void pmem_setup(void);
-void pmem_info(void);
+/*
+ *  Pageframes by number. Pointers from pmem_alloc() are in the direct map,
+ *  memory above it (high memory) has no addresses and is only reached
+ *  through kmap(). Frame numbers are 64-bit, PAE addresses 64 Gb.
+ *  File blocks, cached pages and user pages live there when there is some.
+ *  0 is never a valid frame: the first page is reserved.
+ */
+typedef uint64_t pfn_t;
+
+#define page_pfn(page)      ((pfn_t)((ptr_t)(page) >> PAGE_SHIFT))
+#define pfn_paddr(pfn)      ((uint64_t)(pfn) << PAGE_SHIFT)
+
+/* a pageframe from high memory, from the direct map if there is none */
+pfn_t pmem_alloc_frame(void);
+pfn_t pmem_alloc_frame_zeroed(void);
+
+err_t pmem_free_frame(pfn_t pfn);
+
+/* the number of high memory pageframes */
+size_t pmem_highmem_frames(void);
+
+/*
+ *  Shared pageframes (copy-on-write): an allocated pageframe has one
+ *  reference, pmem_page_ref() adds more, pmem_page_unref() drops one
+ *  and frees the pageframe with the last reference.
+ */
+void pmem_page_ref(pfn_t pfn);
+err_t pmem_page_unref(pfn_t pfn);
+count_t pmem_page_refs(pfn_t pfn);
+
+/*
+ *  Page cache pageframes: kept on their own list, high memory first;
+ *  a page marked in use cannot be freed
+ */
+pfn_t pmem_cache_alloc(void);
+err_t pmem_cache_free(pfn_t pfn);
+void pmem_cache_use(pfn_t pfn, bool in_use);
+
+/*
+ *  Compaction: used pageframes marked movable may be moved by their owners.
+ *  pmem_compact() frees a block of pages_count pageframes (rounded up to
+ *  a power of 2) by calling the movers, which replace their pages inside
+ *  [start, end) with copies from pmem_migrate(). It runs when a multi-page
+ *  allocation fails and returns the number of moved pageframes.
+ */
+typedef void (*pmem_mover_f)(pfn_t start, pfn_t end);
+
+err_t pmem_register_mover(pmem_mover_f mover);
+void pmem_set_movable(pfn_t pfn, bool movable);
 
+/* a moved copy of the pageframe, or 0 if it is not being evacuated */
+pfn_t pmem_migrate(pfn_t pfn);
 
-#define VM_RW       (1 << 1)
-#define VM_USR      (1 << 2)
-#define VM_XD       (uint64_t)(1 << 63)
+size_t pmem_compact(size_t pages_count);
+
+/*
+ *  Reclaim: subsystems keeping pageframes they can give back (caches, pools)
+ *  register shrinkers. Shrinkers run from pmem_idle() when free pageframes
+ *  drop below the low watermark, right away below the minimal one and
+ *  before an allocation fails. The OOM handler is the last resort.
+ */
+
+/* frees up to `n_pages` pageframes, returns the number of freed */
+typedef size_t (*pmem_shrink_f)(size_t n_pages);
+
+/* frees memory somehow (e.g. kills a process), returns false if it cannot */
+typedef bool (*pmem_oom_f)(void);
+
+err_t pmem_register_shrinker(const char *name, pmem_shrink_f shrink);
+void pmem_set_oom_handler(pmem_oom_f oom);
+
+void pmem_setup(void);
+void pmem_info(void);
 
-typedef struct vm_area vm_area_t;
 
 void memory_setup(void);
 
@@ -0,0 +1,38 @@
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stdint.h>
+
+/***
+  *     Object caches for fixed-size kernel objects.
+  *   Each cache keeps its objects in single-page slabs taken from pmem,
+  *  allocation and freeing take constant time.
+ ***/
+typedef struct kmem_cache kmem_cache_t;
+
+/* called once for every object when its slab is created;
+ * objects must be freed back in the constructed state */
+typedef void (*kmem_ctor_f)(void *obj);
+
+/***
+  *     Create a cache of `objsize`-byte objects
+  *   return null if failed (objsize is too large or no caches left)
+ ***/
+kmem_cache_t * kmem_cache_create(const char *name, size_t objsize, kmem_ctor_f ctor);
+
+/***
+  *     Allocate an object, return null if no memory
+ ***/
+void * kmem_cache_alloc(kmem_cache_t *cache);
+
+/***
+  *     Return an object to its cache
+ ***/
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+/* frees up to `n_pages` empty slabs of all caches, returns the number of freed */
+size_t kmem_caches_shrink(size_t n_pages);
+
+void kmem_caches_info(void);
+
+#endif // __SLAB_H__
@@ -0,0 +1,117 @@
+#ifndef __VMEM_H__
+#define __VMEM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <misc/rbtree.h>
+#include <mem/paging.h>
+
+/***
+  *     Virtual memory areas: page-aligned [vm_start, vm_end) regions
+  *   of an address space with the same access rights. Areas never
+  *  overlap and are kept in a red-black tree ordered by address.
+  *     Pages are allocated on the first access: the first vm_datalen
+  *   bytes of an area are copied from vm_data, the rest is zeroed.
+  *   Pages of file areas are the file pages, copied on the first write.
+ ***/
+
+#define VM_RW       (1 << 1)    /* writable */
+#define VM_USR      (1 << 2)    /* user-accessible */
+#define VM_XD       (1 << 3)    /* not executable */
+#define VM_SHARED   (1 << 4)    /* a shared file mapping */
+
+struct superblock;
+
+typedef struct vm_area  vm_area_t;
+typedef struct vm_space vmspace_t;
+
+struct vm_area {
+    struct rb_node  vm_node;
+    ptr_t           vm_start;
+    ptr_t           vm_end;
+    uint            vm_flags;   /* VM_* */
+    const char *    vm_data;    /* contents of vm_start, or null */
+    size_t          vm_datalen;
+
+    struct superblock *vm_sb;   /* the mapped file, or null */
+    size_t          vm_ino;
+    off_t           vm_pgoff;   /* the file page at vm_start */
+};
+
+struct vm_space {
+    struct rb_tree  vs_areas;
+    vm_area_t *     vs_cache;   /* the last found area */
+    pde_t *         vs_pagedir;
+    count_t         vs_count;
+
+    /* statistics */
+    count_t         vs_lookups;
+    count_t         vs_hits;
+    count_t         vs_faults;
+    count_t         vs_cow;
+};
+
+void vmspace_init(vmspace_t *vs, pde_t *pagedir);
+
+/* unmaps everything, frees the page directory if it is not the kernel one */
+void vmspace_destroy(vmspace_t *vs);
+
+/* the area containing `addr` or null, O(log n) */
+vm_area_t * vmspace_find(vmspace_t *vs, ptr_t addr);
+
+/***
+  *     Adds an area for [start, end), merging it with adjacent areas
+  *   with the same flags. Returns EEXIST if the range is in use.
+ ***/
+err_t vmspace_map(vmspace_t *vs, ptr_t start, ptr_t end, uint flags);
+
+/* an area with its first `datalen` bytes backed by `data` (not merged) */
+err_t vmspace_map_data(vmspace_t *vs, ptr_t start, ptr_t end, uint flags,
+                       const void *data, size_t datalen);
+
+/***
+  *     Removes [start, end) from the address space, splitting areas
+  *   which are partially covered; mapped pages are released.
+ ***/
+err_t vmspace_unmap(vmspace_t *vs, ptr_t start, ptr_t end);
+
+/***
+  *     Changes flags of [start, end), which must be mapped entirely
+  *   (ENOMEM otherwise), splitting and merging areas as needed.
+ ***/
+err_t vmspace_protect(vmspace_t *vs, ptr_t start, ptr_t end, uint flags);
+
+/* an area with pages of a file starting from page `pgoff` (not merged) */
+err_t vmspace_map_file(vmspace_t *vs, ptr_t start, ptr_t end, uint flags,
+                       struct superblock *sb, size_t ino, off_t pgoff);
+
+/* the lowest free range of `size` bytes at `hint` or above, 0 if none */
+ptr_t vmspace_free_range(vmspace_t *vs, ptr_t hint, size_t size);
+
+/***
+  *     Copies the areas of `src` to the empty `dst`, present pages are
+  *   shared copy-on-write. `dst` must be destroyed on error.
+ ***/
+err_t vmspace_fork(vmspace_t *dst, vmspace_t *src);
+
+/***
+  *     Resolves a page fault at `addr` (PGF_* in `error`) by mapping
+  *   a new page if the address belongs to an area with enough rights.
+  *  Returns 0 if resolved.
+ ***/
+err_t vmspace_fault(vmspace_t *vs, ptr_t addr, uint error);
+
+/* the number of pages mapped in the address space */
+size_t vmspace_resident(vmspace_t *vs);
+
+void vmspace_info(vmspace_t *vs);
+
+struct mmap_arg_struct;
+
+int sys_mmap(struct mmap_arg_struct *args);
+int sys_munmap(void *addr, size_t len);
+
+void vmem_setup(void);
+
+#endif // __VMEM_H__
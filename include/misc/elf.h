@@ -7,4 +7,8 @@ Elf32_Shdr *elf_section_by_name(Elf32_Shdr *shdr, size_t snum, const char *sname
 void print_elf_syms(Elf32_Sym *syms, size_t n_syms, const char *strtab, const char *symname);
 void print_section_headers(Elf32_Shdr *shdr, size_t snum);
 
+/* returns the name of the function containing `addr` or null */
+const char *elf_symbol_by_addr(Elf32_Sym *syms, size_t n_syms, const char *strtab,
+                               ptr_t addr, ptr_t *offset);
+
 #endif //__COSEC_ELF_H__
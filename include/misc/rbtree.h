@@ -0,0 +1,46 @@
+#ifndef __RBTREE_H__
+#define __RBTREE_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/***
+  *     Intrusive red-black trees.
+  *   A node is embedded into the keyed structure; searching and linking
+  *  a new node is done by the user (the tree does not know the keys),
+  *  then rb_insert() rebalances the tree.
+ ***/
+
+struct rb_node {
+    struct rb_node *rb_parent;
+    struct rb_node *rb_left;
+    struct rb_node *rb_right;
+    bool rb_red;
+};
+
+struct rb_tree {
+    struct rb_node *rb_root;
+};
+
+#define RB_TREE_INIT    { .rb_root = NULL }
+
+#define rb_entry(node, type, member) \
+    ((type *)((char *)(node) - offsetof(type, member)))
+
+/***
+  *     Links `node` as a child of `parent` at `*link`, which is
+  *   the rb_left or rb_right of `parent` (or the root if no parent),
+  *   then rebalances the tree.
+ ***/
+void rb_insert(struct rb_tree *tree, struct rb_node *node,
+               struct rb_node *parent, struct rb_node **link);
+
+void rb_erase(struct rb_tree *tree, struct rb_node *node);
+
+/* in-order traversal, null at the ends */
+struct rb_node * rb_first(struct rb_tree *tree);
+struct rb_node * rb_last(struct rb_tree *tree);
+struct rb_node * rb_next(struct rb_node *node);
+struct rb_node * rb_prev(struct rb_node *node);
+
+#endif // __RBTREE_H__
@@ -7,6 +7,7 @@ void test_serial(const char *);
 void test_kbd(void);
 void test_tasks(void);
 void test_userspace(void);
+void test_switch(void);
 void test_usleep(void);
 void test_init(void);
 void test_acpi(void);
@@ -2,6 +2,7 @@
 #define __COSEC_PROCESS_H__
 
 #include <fs/vfs.h>
+#include <mem/vmem.h>
 #include <tasks.h>
 
 /* should be 65536 */
@@ -27,6 +28,7 @@ struct process {
     pid_t   ps_ppid;
 
     void *      ps_kernstack;
+    vmspace_t   ps_vm;          /* address space */
     task_struct ps_task;        /* context-switching info */
     mindev_t    ps_tty;         /* controlling tty */
     mode_t      ps_umask;       /* umask */
@@ -43,6 +45,7 @@ int alloc_fd_for_pid(pid_t pid);
 filedescr * get_filedescr_for_pid(pid_t pid, int fd);
 
 int sys_getpid();
+int sys_fork(void);
 
 void run_init(void);
 void proc_setup(void);
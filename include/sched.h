@@ -0,0 +1,88 @@
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+#include <tasks.h>
+
+/***
+  *     Scheduler: priority run queues with O(1) selection of the next task.
+  *   A lower number is a higher priority; a task runs until its time slice
+  *  is over, a higher priority task becomes ready or it sleeps or yields.
+  *   Tasks are switched at timer ticks only.
+ ***/
+
+#define SCHED_N_PRIO        32
+#define SCHED_PRIO_MAX      0
+#define SCHED_PRIO_MIN      (SCHED_N_PRIO - 1)
+#define SCHED_PRIO_DEFAULT  16
+
+/* time slices in timer ticks, higher priorities get longer ones */
+#define SCHED_SLICE_MIN     16
+#define SCHED_SLICE_STEP    4
+
+/* makes a stopped `task` ready to run with priority `prio` */
+void sched_add(task_struct *task, uint prio);
+
+/* stops `task`, it is not scheduled until added again */
+void sched_remove(task_struct *task);
+
+/* gives the rest of the time slice to other ready tasks */
+void sched_yield(void);
+
+/* the current task sleeps for `ticks` timer ticks or until sched_wakeup() */
+void sched_sleep(uint ticks);
+
+/* the current task sleeps until sched_wakeup() */
+void sched_block(void);
+
+/* makes a sleeping `task` ready, may be called from interrupts */
+void sched_wakeup(task_struct *task);
+
+/***
+  *     Wait queues: tasks sleep on a queue until its condition is true.
+  *   The task is queued and marked sleeping before the condition is
+  *  checked, so a wakeup in between is not lost:
+  *
+  *     wait_event(&dev->readq, dev_has_data(dev));
+  *
+  *  and an interrupt handler calls wait_wakeup(&dev->readq) after making
+  *  data available.
+ ***/
+
+typedef struct waitqueue {
+    task_struct *head;
+    task_struct *tail;
+} waitqueue_t;
+
+#define WAITQUEUE_INIT      { 0, 0 }
+
+static inline void waitqueue_init(waitqueue_t *wq) {
+    wq->head = wq->tail = 0;
+}
+
+/* queues the current task on `wq` as sleeping */
+void wait_prepare(waitqueue_t *wq);
+
+/* sleeps unless the current task has been woken up already */
+void wait_sleep(void);
+
+/* the current task is running and not queued any more */
+void wait_finish(void);
+
+/* makes all tasks on `wq` ready, may be called from interrupts */
+void wait_wakeup(waitqueue_t *wq);
+
+#define wait_event(wq, condition)           \
+    do {                                    \
+        while (1) {                         \
+            wait_prepare(wq);               \
+            if (condition)                  \
+                break;                      \
+            wait_sleep();                   \
+        }                                   \
+        wait_finish();                      \
+    } while (0)
+
+void sched_info(void);
+void sched_setup(void);
+
+#endif // __SCHED_H__
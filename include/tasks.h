@@ -2,20 +2,39 @@
 #define __TASKS_H__
 
 #include <arch/i386.h>
+#include <mem/kstack.h>
+#include <dev/callout.h>
 
-#define TASK_KERNSTACK_SIZE   0x800
+#define TASK_KERNSTACK_SIZE   KSTACK_SIZE
 
 enum taskstate {
     TS_RUNNING  = 0,
     TS_READY    = 1,
     TS_STOPPED  = 2,
+    TS_SLEEPING = 3,
 };
 
+/***
+  *     Tasks are switched in software: an interrupt saves the context on
+  *   the kernel stack of the task and the handler returns through the saved
+  *  context of the next one. There is a single TSS for the CPU, only its
+  *  esp0 changes on a switch.
+ ***/
 struct task {
-    tss_t           tss;
+    tss_t           tss;        /* the initial state, esp0 is the kernel stack top */
     enum taskstate  state;
-    uint32_t        ldt_index;
-    uint32_t        tss_index;
+    ptr_t           context;    /* the saved interrupt context */
+    pde_t *         pagedir;
+    uint32_t        pid;        /* of the owning process, 0 for kernel tasks */
+
+    /* scheduling, see sched.h */
+    uint8_t         priority;
+    uint8_t         timeslice;  /* ticks left */
+    uint8_t         rq_array;   /* the active or expired queues */
+    struct task *   rq_next;    /* in a run queue or a wait queue */
+    struct task *   rq_prev;
+    struct waitqueue *waitq;    /* the wait queue it sleeps on */
+    callout_t       sleep_timer; /* the timeout of sched_sleep() */
 };
 
 typedef  struct task  task_struct;
@@ -33,6 +52,15 @@ void task_kthread_init(task_struct *ktask, void *entry, void *k_esp);
 void task_init(task_struct *task, void *entry, 
         void *esp0, void *esp3, segment_selector cs, segment_selector ds);
 
+/* `task` resumes from the current interrupt with `retval` in %eax */
+void task_fork(task_struct *task, void *esp0, pde_t *pagedir, uint retval);
+
+/* the stack for interrupts from user mode of the current task */
+void task_set_kernel_stack(ptr_t esp0);
+
+/* cycles of `rounds` switches in software and through per-task TSSs */
+void task_switch_bench(count_t rounds, uint64_t *sw_cycles, uint64_t *hw_cycles);
+
 void tasks_setup(void);
 
 #endif // __TASKS_H__
@@ -1,4 +1,6 @@
 #include <stdarg.h>
+#include <sys/mman.h>
+#include <time.h>
 #include <cosec/fs.h>
 
 int syscall(int num, ...) {
@@ -11,19 +13,46 @@ int syscall(int num, ...) {
 
     va_end(vl);
 
-    asm(
-    "movl %3, %%ebx         \n"
-    "movl %2, %%edx         \n"
-    "movl %1, %%ecx         \n"
-    "movl %0, %%eax         \n"
+    int ret;
+    asm volatile(
+    "movl %4, %%ebx         \n"
+    "movl %3, %%edx         \n"
+    "movl %2, %%ecx         \n"
+    "movl %1, %%eax         \n"
     "int $0x80              \n"
-    ::"m"(num), "m"(arg1), "m"(arg2), "m"(arg3) );
+    :"=a"(ret)
+    :"m"(num), "m"(arg1), "m"(arg2), "m"(arg3)
+    :"ebx", "ecx", "edx", "memory" );
+    return ret;
 }
 
 int printf(const char *fmt, ...) {
     return syscall(SYS_PRINT, (void **)&fmt, 0, 0);
 }
 
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset) {
+    struct mmap_arg_struct args = {
+        .addr = addr, .len = len, .prot = prot,
+        .flags = flags, .fd = fd, .offset = offset,
+    };
+    int ret = syscall(SYS_MMAP, &args, 0, 0);
+    if ((-4096 < ret) && (ret < 0))
+        return MAP_FAILED;
+    return (void *)ret;
+}
+
+int munmap(void *addr, size_t len) {
+    return syscall(SYS_MUNMAP, addr, len, 0);
+}
+
+int clock_gettime(clockid_t clk, struct timespec *ts) {
+    return syscall(SYS_CLOCK_GETTIME, clk, ts, 0);
+}
+
+int fork(void) {
+    return syscall(SYS_FORK, 0, 0, 0);
+}
+
 void exit(int status) {
     syscall(SYS_EXIT, status, 0, 0);
 }
@@ -40,6 +40,11 @@
 #define SYS_PWRITE      0x33
 #define SYS_TRUNC       0x35
 
+#define SYS_MMAP        0x5a
+#define SYS_MUNMAP      0x5b
+
+#define SYS_CLOCK_GETTIME   0x60
+
 #define SYS_PRINT       0xff
 
 struct mount_info_struct {
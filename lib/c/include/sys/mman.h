@@ -0,0 +1,31 @@
+#ifndef __COSEC_SYS_MMAN_H__
+#define __COSEC_SYS_MMAN_H__
+
+#include <sys/types.h>
+
+#define PROT_NONE       0x0
+#define PROT_READ       0x1
+#define PROT_WRITE      0x2
+#define PROT_EXEC       0x4
+
+#define MAP_SHARED      0x01    /* read-only for now */
+#define MAP_PRIVATE     0x02    /* copy-on-write */
+#define MAP_FIXED       0x10
+#define MAP_ANONYMOUS   0x20
+
+#define MAP_FAILED      ((void *)-1)
+
+/* SYS_MMAP takes its arguments in memory */
+struct mmap_arg_struct {
+    void *  addr;
+    size_t  len;
+    int     prot;
+    int     flags;
+    int     fd;
+    off_t   offset;
+};
+
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+int munmap(void *addr, size_t len);
+
+#endif //__COSEC_SYS_MMAN_H__
@@ -10,6 +10,7 @@ typedef unsigned short  uid_t, gid_t;
 
 typedef unsigned long       time_t;     /* seconds since the epoch */
 typedef unsigned long long  clock_t;    /* time in CLOCKS_PER_SEC ticks */
+typedef int                 clockid_t;
 
 
 #define NOERR       0
@@ -6,6 +6,9 @@
 
 #define CLOCKS_PER_SEC  1000000
 
+#define CLOCK_REALTIME  0
+#define CLOCK_MONOTONIC 1
+
 struct tm {
     int tm_sec;
     int tm_min;
@@ -22,11 +25,18 @@ struct tm {
 
 typedef  struct tm  ymd_hms;
 
+struct timespec {
+    time_t  tv_sec;
+    long    tv_nsec;
+};
+
 err_t time_ymd_from_rtc(ymd_hms *ymd);
+time_t unix_time(void);
 
 
 time_t time(time_t *t);
 clock_t clock(void);
+int clock_gettime(clockid_t clk, struct timespec *ts);
 
 struct tm *gmtime(const time_t *timep);
 struct tm *localtime(const time_t *timep);
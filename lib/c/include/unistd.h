@@ -5,6 +5,8 @@
 #define STDOUT_FILENO   1
 #define STDERR_FILENO   2
 
+int fork(void);
+
 int symlink(const char *path1, const char *path2);
 
 int link(const char *path1, const char *path2);
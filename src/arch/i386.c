@@ -2,6 +2,7 @@
 #include <arch/intr.h>
 
 #include <dev/intrs.h>
+#include <mem/pmem.h>
 
 #include <string.h>
 
@@ -25,6 +26,11 @@ extern void gdt_get(struct gdt_ptr *idt);
 /*****************************************************************************
         routines
 ******************************************************************************/
+void cpu_idle(void) {
+    pmem_idle();
+    cpu_halt();
+}
+
 ptr_t cpu_stack(void) {
     ptr_t esp;
     i386_esp(esp);
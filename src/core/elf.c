@@ -81,6 +81,27 @@ void print_elf_syms(Elf32_Sym *syms, size_t n_syms, const char *strtab, const ch
     }
 }
 
+const char *elf_symbol_by_addr(Elf32_Sym *syms, size_t n_syms, const char *strtab,
+                               ptr_t addr, ptr_t *offset)
+{
+    Elf32_Sym *best = null;
+    index_t i;
+    for (i = 0; i < n_syms; ++i) {
+        Elf32_Sym *sym = syms + i;
+        if (ELF32_ST_TYPE(sym->st_info) != STT_FUNC)
+            continue;
+        if ((sym->st_value > addr) || (best && (sym->st_value < best->st_value)))
+            continue;
+        best = sym;
+    }
+    if (!best) return null;
+    if (best->st_size && (addr >= best->st_value + best->st_size))
+        return null;
+
+    if (offset) *offset = addr - best->st_value;
+    return strtab + best->st_name;
+}
+
 void print_section_headers(Elf32_Shdr *shdr, size_t snum) {
     Elf32_Shdr *section;
     const char *shstrtab = null;
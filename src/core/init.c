@@ -3,6 +3,7 @@
 
 #include <dev/kbd.h>
 #include <dev/timer.h>
+#include <dev/clock.h>
 #include <dev/screen.h>
 #include <dev/pci.h>
 
@@ -42,6 +43,7 @@ void kinit(uint32_t magic, struct multiboot_info *mbi) {
 
     /* hardware setup */
     timer_setup();
+    clock_setup();
     kbd_setup();
 
     /* do something useful */
@@ -16,9 +16,20 @@
 #include <dev/tty.h>
 #include <dev/pci.h>
 #include <dev/acpi.h>
+#include <dev/timer.h>
+#include <dev/clock.h>
 
 #include <mem/pmem.h>
+#include <mem/paging.h>
+#include <mem/vmem.h>
+#include <mem/pcache.h>
+#include <mem/kstack.h>
+#include <mem/kmap.h>
+#include <mem/dma.h>
+#include <sched.h>
 #include <mem/kheap.h>
+#include <mem/slab.h>
+#include <mem/memprof.h>
 #include <misc/test.h>
 #include <misc/elf.h>
 
@@ -255,11 +266,11 @@ const struct kshell_command main_commands[] = {
     { .name = "test",
         .handler = kshell_test,
         .description = "test utility",
-        .options = "sprintf kbd timer serial tasks acpi ring3 usleep" },
+        .options = "sprintf kbd timer serial tasks switch acpi ring3 usleep" },
     { .name = "info",
         .handler = kshell_info,
         .description = "various info",
-        .options = "stack gdt pmem colors cpu pci irq mods mboot" },
+        .options = "stack gdt pmem paging vm [pid] pcache kstack kmap dma sched timer clock colors cpu pci irq mods mboot" },
     { .name = "cpuid",
         .handler = kshell_cpuid,
         .description = "x86 cpuid info; usage: cpuid [function, default 0]",
@@ -275,7 +286,7 @@ const struct kshell_command main_commands[] = {
     { .name = "heap",
         .handler = kshell_heap,
         .description = "heap utility",
-        .options = "info alloc free check" },
+        .options = "info alloc free check slabs prof [<top_n>|reset] compact [<pages>]" },
     { .name = "fs",
         .handler = kshell_vfs,
         .description = "vfs utility",
@@ -330,6 +341,7 @@ const struct kshell_subcmd  test_cmds[] = {
     { .name = "serial",  .handler = test_serial,    },
     { .name = "kbd",     .handler = test_kbd,       },
     { .name = "tasks",   .handler = test_tasks,     },
+    { .name = "switch",  .handler = test_switch,    },
     { .name = "ring3",   .handler = test_userspace, },
     { .name = "usleep",  .handler = test_usleep,    },
     { .name = "acpi",    .handler = test_acpi,      },
@@ -450,6 +462,26 @@ void kshell_heap(const struct kshell_command *this, const char *arg) {
     } else
     if (!strncmp(arg, "check", 5)) {
         k_printf("heap check = *0x%x\n", kheap_check());
+    } else
+    if (!strncmp(arg, "slabs", 5)) {
+        kmem_caches_info();
+    } else
+    if (!strncmp(arg, "compact", 7)) {
+        int n_pages = 2;
+        arg += 7;
+        get_int_opt(arg, &n_pages, 10);
+        k_printf("%d pageframes moved\n", pmem_compact(n_pages));
+    } else
+    if (!strncmp(arg, "prof", 4)) {
+        int top_n = 10;
+        arg += 4;
+        skip_gaps(arg);
+        if (!strncmp(arg, "reset", 5))
+            memprof_reset();
+        else {
+            get_int_opt(arg, &top_n, 10);
+            memprof_report(top_n);
+        }
     } else {
         k_printf("Options: %s\n\n", this->options);
     }
@@ -465,6 +497,40 @@ void kshell_info(const struct kshell_command *this, const char *arg) {
     if (!strcmp(arg, "pmem")) {
         pmem_info();
     } else
+    if (!strcmp(arg, "paging")) {
+        paging_info();
+    } else
+    if (!strncmp(arg, "vm", 2)) {
+        int pid = current_pid();
+        get_int_opt(arg + 2, &pid, 10);
+
+        process *p = proc_by_pid(pid);
+        if (p)
+            vmspace_info(&p->ps_vm);
+        else
+            k_printf("no process\n");
+    } else
+    if (!strcmp(arg, "pcache")) {
+        pcache_info();
+    } else
+    if (!strcmp(arg, "kstack")) {
+        kstack_info();
+    } else
+    if (!strcmp(arg, "kmap")) {
+        kmap_info();
+    } else
+    if (!strcmp(arg, "dma")) {
+        dma_info();
+    } else
+    if (!strcmp(arg, "sched")) {
+        sched_info();
+    } else
+    if (!strcmp(arg, "timer")) {
+        timer_info();
+    } else
+    if (!strcmp(arg, "clock")) {
+        clock_info();
+    } else
     if (!strcmp(arg, "colors")) {
         k_printf("Colors:\n");
         int i = 0;
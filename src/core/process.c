@@ -7,9 +7,13 @@
 #include <cosec/log.h>
 
 #include <process.h>
+#include <sched.h>
 #include <dev/tty.h>
 #include <fs/vfs.h>
 #include <mem/pmem.h>
+#include <mem/paging.h>
+#include <mem/kheap.h>
+#include <mem/kstack.h>
 
 #include <arch/mboot.h>
 
@@ -17,9 +21,10 @@
 /*
  *  Global state
  */
-pid_t theCurrPID;
 pid_t theAllocPID = 1;
 
+#define USER_STACK_SIZE     0x00100000  /* pages are allocated on demand */
+
 process theInitProc;
 process * theProcTable[NPROC_MAX] = { 0 };
 
@@ -47,16 +52,17 @@ alloc_pid(void) {
 }
 
 process * proc_by_pid(pid_t pid) {
-    if (pid > NPROC_MAX) return 0;
+    if ((uint)pid >= NPROC_MAX) return 0;
     return theProcTable[pid];
 }
 
+/* the owner of the running task, 0 for kernel tasks */
 pid_t current_pid(void) {
-    return theCurrPID;
+    return task_current()->pid;
 }
 
 process * current_proc(void) {
-    return theProcTable[theCurrPID];
+    return theProcTable[current_pid()];
 }
 
 int alloc_fd_for_pid(pid_t pid) {
@@ -85,7 +91,99 @@ filedescr * get_filedescr_for_pid(pid_t pid, int fd) {
 
 
 int sys_getpid() {
-    return theCurrPID;
+    return current_pid();
+}
+
+/*
+ *  The child gets a copy-on-write address space, copies of the descriptors
+ *  and returns 0 from the same syscall; the parent gets its pid.
+ */
+int sys_fork(void) {
+    const char *funcname = __FUNCTION__;
+    process *parent = current_proc();
+    err_t ret;
+
+    pid_t pid = alloc_pid();
+    return_dbg_if(!pid, -EAGAIN, "%s: no free pids\n", funcname);
+
+    process *child = kmalloc(sizeof(process));
+    if (!child) return -ENOMEM;
+
+    memcpy(child, parent, sizeof(process));
+    child->ps_pid = pid;
+    child->ps_ppid = parent->ps_pid;
+
+    child->ps_kernstack = kstack_alloc();
+    if (!child->ps_kernstack) {
+        kfree(child);
+        return -ENOMEM;
+    }
+
+    pde_t *pagedir = pagedir_new();
+    if (!pagedir) {
+        ret = ENOMEM;
+        goto fail_stack;
+    }
+
+    vmspace_init(&child->ps_vm, pagedir);
+    ret = vmspace_fork(&child->ps_vm, &parent->ps_vm);
+    if (ret) goto fail_vm;
+
+    task_fork(&child->ps_task, (char *)child->ps_kernstack + TASK_KERNSTACK_SIZE,
+              pagedir, 0);
+    child->ps_task.pid = pid;
+
+    theProcTable[pid] = child;
+    sched_add(&child->ps_task, task_current()->priority);
+    logmsgdf("%s: pid %d forked %d\n", funcname, parent->ps_pid, pid);
+    return pid;
+
+fail_vm:
+    vmspace_destroy(&child->ps_vm);
+fail_stack:
+    kstack_free(child->ps_kernstack);
+    kfree(child);
+    return -ret;
+}
+
+/*
+ *  Out of memory: the process with the most resident pages is killed.
+ *  Init and the current process are never chosen, they cannot be torn
+ *  down from the middle of an allocation.
+ */
+static void proc_free(process *proc) {
+    sched_remove(&proc->ps_task);
+    vmspace_destroy(&proc->ps_vm);
+    kstack_free(proc->ps_kernstack);
+    theProcTable[proc->ps_pid] = NULL;
+    kfree(proc);
+}
+
+static bool proc_oom_kill(void) {
+    process *victim = NULL;
+    size_t victim_pages = 0;
+    pid_t pid;
+
+    for (pid = 2; pid < NPROC_MAX; ++pid) {
+        process *proc = theProcTable[pid];
+        if (!proc || (pid == current_pid()))
+            continue;
+
+        size_t n_pages = vmspace_resident(&proc->ps_vm);
+        if (n_pages > victim_pages) {
+            victim = proc;
+            victim_pages = n_pages;
+        }
+    }
+
+    if (!victim) {
+        logmsgef("OOM: no process to kill");
+        return false;
+    }
+
+    logmsgef("OOM: killing pid %d (%d pages)", victim->ps_pid, victim_pages);
+    proc_free(victim);
+    return true;
 }
 
 /*
@@ -162,37 +260,33 @@ void run_init(void) {
     returnv_msg_if(!ok, "%s: parsing ELF failed", funcname);
     logmsgif("%s: ok, 'init' is a correct ELF binary", funcname);
 
-    /* determine if its memory does not conflict */
-    for (i = 0; i < elfhdr->e_shnum; ++i) {
-        Elf32_Shdr *section = (Elf32_Shdr *)(elfmem + elfhdr->e_shoff + i * elfhdr->e_shentsize);
-        if (!(section->sh_flags & SHF_ALLOC))
+    /* map its segments, pages are loaded on the first access */
+    vmspace_t *vs = &theInitProc.ps_vm;
+    for (i = 0; i < elfhdr->e_phnum; ++i) {
+        Elf32_Phdr *segment = (Elf32_Phdr *)(elfmem + elfhdr->e_phoff + i * elfhdr->e_phentsize);
+        if (segment->p_type != PT_LOAD)
             continue;
 
-        char *sect_start = (char *)section->sh_addr;
-        char *sect_end = sect_start + section->sh_size;
-
-        logmsgdf("%s: checking *%x-*%x\n", funcname, (uint)sect_start, (uint)sect_end);
-        uint ret = pmem_check_avail(sect_start, sect_end);
-        returnv_msg_if(ret,
-                "%s: section[%d] cannot be allocated\n", funcname, i);
-    }
-
-    /* copy ELF sections there */
-    for (i = 0; i < elfhdr->e_shnum; ++i) {
-        Elf32_Shdr *section = (Elf32_Shdr *)(elfmem + elfhdr->e_shoff + i * elfhdr->e_shentsize);
-        if (!(section->sh_flags & SHF_ALLOC))
-            continue;
+        ptr_t start = segment->p_vaddr & PG31_12_MASK;
+        ptr_t end = (segment->p_vaddr + segment->p_memsz + PAGE_SIZE - 1) & PG31_12_MASK;
+        size_t pad = segment->p_vaddr - start;
 
-        char *sect_start = (char *)section->sh_addr;
-        char *sect_end = sect_start + section->sh_size;
+        uint flags = VM_USR;
+        if (segment->p_flags & PF_W) flags |= VM_RW;
+        if (!(segment->p_flags & PF_X)) flags |= VM_XD;
 
-        logmsgdf("%s: init section[%d]: *%x-*%x, file offset 0x%x\n",
-                funcname, i, (uint)sect_start, (uint)sect_end, section->sh_offset);
-        pmem_reserve(sect_start, sect_end);
-        memcpy(sect_start, elfmem + section->sh_offset, section->sh_size);
+        logmsgdf("%s: init segment[%d]: *%x-*%x, file offset 0x%x\n",
+                funcname, i, start, end, segment->p_offset);
+        int ret = vmspace_map_data(vs, start, end, flags,
+                    elfmem + segment->p_offset - pad, segment->p_filesz + pad);
+        returnv_msg_if(ret, "%s: segment[%d] cannot be mapped: %s",
+                funcname, i, strerror(ret));
     }
 
-    /* TODO: allocate stack and heap regions */
+    int ret = vmspace_map(vs, USER_END - USER_STACK_SIZE, USER_END, VM_USR | VM_RW | VM_XD);
+    returnv_msg_if(ret, "%s: no stack: %s", funcname, strerror(ret));
+
+    /* TODO: allocate heap regions */
 
     logmsgif("%s: ready to rock!", funcname);
 
@@ -209,14 +303,17 @@ void proc_setup(void) {
     /* invalid */
     theProcTable[0] = NULL;
 
-    /* there is the init process at start up */
-    theCurrPID = 1;
-    theProcTable[theCurrPID] = &theInitProc;
+    /* there is the init process at start up, it owns the default task */
+    task_current()->pid = 1;
+    theProcTable[1] = &theInitProc;
 
-    theInitProc.ps_pid = theCurrPID;
+    theInitProc.ps_pid = 1;
     theInitProc.ps_ppid = 0;
     theInitProc.ps_tty = CONSOLE_TTY;
     theInitProc.ps_kernstack = &kern_stack;
+    vmspace_init(&theInitProc.ps_vm, thePageDirectory);
+
+    pmem_set_oom_handler(proc_oom_kill);
 
     /* temporary hack */
     /* init process should initialize its descriptors from userspace */
@@ -0,0 +1,234 @@
+/*
+ *      Red-black trees
+ *
+ *  Null children are black leaves. Rebalancing follows Cormen et al.,
+ *  with the parent of a removed leaf tracked explicitly instead of
+ *  a sentinel node.
+ */
+#include <misc/rbtree.h>
+
+static inline bool rb_is_red(struct rb_node *node) {
+    return node && node->rb_red;
+}
+
+/* replaces `node` with `child` in the parent's link */
+static inline void rb_replace_child(struct rb_tree *tree, struct rb_node *node,
+                                    struct rb_node *child) {
+    struct rb_node *parent = node->rb_parent;
+    if (!parent)
+        tree->rb_root = child;
+    else if (parent->rb_left == node)
+        parent->rb_left = child;
+    else
+        parent->rb_right = child;
+    if (child)
+        child->rb_parent = parent;
+}
+
+static void rb_rotate_left(struct rb_tree *tree, struct rb_node *node) {
+    struct rb_node *right = node->rb_right;
+
+    node->rb_right = right->rb_left;
+    if (right->rb_left)
+        right->rb_left->rb_parent = node;
+
+    rb_replace_child(tree, node, right);
+    right->rb_left = node;
+    node->rb_parent = right;
+}
+
+static void rb_rotate_right(struct rb_tree *tree, struct rb_node *node) {
+    struct rb_node *left = node->rb_left;
+
+    node->rb_left = left->rb_right;
+    if (left->rb_right)
+        left->rb_right->rb_parent = node;
+
+    rb_replace_child(tree, node, left);
+    left->rb_right = node;
+    node->rb_parent = left;
+}
+
+void rb_insert(struct rb_tree *tree, struct rb_node *node,
+               struct rb_node *parent, struct rb_node **link) {
+    node->rb_parent = parent;
+    node->rb_left = node->rb_right = NULL;
+    node->rb_red = true;
+    *link = node;
+
+    while (rb_is_red(node->rb_parent)) {
+        parent = node->rb_parent;
+        struct rb_node *gparent = parent->rb_parent;   /* the root is black */
+
+        if (parent == gparent->rb_left) {
+            struct rb_node *uncle = gparent->rb_right;
+            if (rb_is_red(uncle)) {
+                parent->rb_red = uncle->rb_red = false;
+                gparent->rb_red = true;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->rb_right) {
+                rb_rotate_left(tree, parent);
+                node = parent;
+                parent = node->rb_parent;
+            }
+            parent->rb_red = false;
+            gparent->rb_red = true;
+            rb_rotate_right(tree, gparent);
+        } else {
+            struct rb_node *uncle = gparent->rb_left;
+            if (rb_is_red(uncle)) {
+                parent->rb_red = uncle->rb_red = false;
+                gparent->rb_red = true;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->rb_left) {
+                rb_rotate_right(tree, parent);
+                node = parent;
+                parent = node->rb_parent;
+            }
+            parent->rb_red = false;
+            gparent->rb_red = true;
+            rb_rotate_left(tree, gparent);
+        }
+    }
+    tree->rb_root->rb_red = false;
+}
+
+/* restores black heights after a black node was removed above `node` */
+static void rb_erase_fixup(struct rb_tree *tree, struct rb_node *node,
+                           struct rb_node *parent) {
+    while ((node != tree->rb_root) && !rb_is_red(node)) {
+        if (node == parent->rb_left) {
+            struct rb_node *sibling = parent->rb_right;
+            if (rb_is_red(sibling)) {
+                sibling->rb_red = false;
+                parent->rb_red = true;
+                rb_rotate_left(tree, parent);
+                sibling = parent->rb_right;
+            }
+            if (!rb_is_red(sibling->rb_left) && !rb_is_red(sibling->rb_right)) {
+                sibling->rb_red = true;
+                node = parent;
+                parent = node->rb_parent;
+                continue;
+            }
+            if (!rb_is_red(sibling->rb_right)) {
+                sibling->rb_left->rb_red = false;
+                sibling->rb_red = true;
+                rb_rotate_right(tree, sibling);
+                sibling = parent->rb_right;
+            }
+            sibling->rb_red = parent->rb_red;
+            parent->rb_red = false;
+            sibling->rb_right->rb_red = false;
+            rb_rotate_left(tree, parent);
+        } else {
+            struct rb_node *sibling = parent->rb_left;
+            if (rb_is_red(sibling)) {
+                sibling->rb_red = false;
+                parent->rb_red = true;
+                rb_rotate_right(tree, parent);
+                sibling = parent->rb_left;
+            }
+            if (!rb_is_red(sibling->rb_left) && !rb_is_red(sibling->rb_right)) {
+                sibling->rb_red = true;
+                node = parent;
+                parent = node->rb_parent;
+                continue;
+            }
+            if (!rb_is_red(sibling->rb_left)) {
+                sibling->rb_right->rb_red = false;
+                sibling->rb_red = true;
+                rb_rotate_left(tree, sibling);
+                sibling = parent->rb_left;
+            }
+            sibling->rb_red = parent->rb_red;
+            parent->rb_red = false;
+            sibling->rb_left->rb_red = false;
+            rb_rotate_right(tree, parent);
+        }
+        node = tree->rb_root;
+    }
+    if (node)
+        node->rb_red = false;
+}
+
+void rb_erase(struct rb_tree *tree, struct rb_node *node) {
+    struct rb_node *child, *parent;
+    bool removed_red;
+
+    if (!node->rb_left || !node->rb_right) {
+        child = (node->rb_left ? node->rb_left : node->rb_right);
+        parent = node->rb_parent;
+        removed_red = node->rb_red;
+        rb_replace_child(tree, node, child);
+    } else {
+        /* the successor takes the place of `node` */
+        struct rb_node *next = node->rb_right;
+        while (next->rb_left)
+            next = next->rb_left;
+
+        child = next->rb_right;
+        removed_red = next->rb_red;
+        if (next->rb_parent == node) {
+            parent = next;
+        } else {
+            parent = next->rb_parent;
+            rb_replace_child(tree, next, child);
+            next->rb_right = node->rb_right;
+            next->rb_right->rb_parent = next;
+        }
+
+        rb_replace_child(tree, node, next);
+        next->rb_left = node->rb_left;
+        next->rb_left->rb_parent = next;
+        next->rb_red = node->rb_red;
+    }
+
+    if (!removed_red)
+        rb_erase_fixup(tree, child, parent);
+}
+
+
+struct rb_node * rb_first(struct rb_tree *tree) {
+    struct rb_node *node = tree->rb_root;
+    if (!node) return NULL;
+    while (node->rb_left)
+        node = node->rb_left;
+    return node;
+}
+
+struct rb_node * rb_last(struct rb_tree *tree) {
+    struct rb_node *node = tree->rb_root;
+    if (!node) return NULL;
+    while (node->rb_right)
+        node = node->rb_right;
+    return node;
+}
+
+struct rb_node * rb_next(struct rb_node *node) {
+    if (node->rb_right) {
+        node = node->rb_right;
+        while (node->rb_left)
+            node = node->rb_left;
+        return node;
+    }
+    while (node->rb_parent && (node == node->rb_parent->rb_right))
+        node = node->rb_parent;
+    return node->rb_parent;
+}
+
+struct rb_node * rb_prev(struct rb_node *node) {
+    if (node->rb_left) {
+        node = node->rb_left;
+        while (node->rb_right)
+            node = node->rb_right;
+        return node;
+    }
+    while (node->rb_parent && (node == node->rb_parent->rb_left))
+        node = node->rb_parent;
+    return node->rb_parent;
+}
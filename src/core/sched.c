@@ -0,0 +1,394 @@
+/*
+ *      Scheduler
+ *
+ *  Ready tasks wait in per-priority FIFO queues, a bitmap of non-empty
+ *  queues gives the highest priority one with a single bit scan. There
+ *  are two sets of queues: a task which used up its time slice goes to
+ *  the expired set, when the active set is empty the sets are swapped,
+ *  so lower priorities are not starved. The running task is not queued.
+ *  A timed sleep is a callout of the task which makes it ready again.
+ *  Tasks on a wait queue are linked through their run queue links, a
+ *  sleeping task is not in a run queue.
+ *  The timer may be tickless, so the scheduler asks it for the next tick
+ *  it has to look at: the end of the time slice if there are other ready
+ *  tasks; callouts request their ticks themselves.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <cosec/log.h>
+
+#include <sched.h>
+#include <tasks.h>
+#include <arch/i386.h>
+#include <dev/timer.h>
+#include <dev/callout.h>
+
+struct runqueue {
+    uint32_t bitmap;            /* bit `prio` is set if queue[prio] is not empty */
+    struct {
+        task_struct *head;
+        task_struct *tail;
+    } queue[SCHED_N_PRIO];
+};
+
+static struct {
+    struct runqueue arrays[2];
+    uint8_t active;             /* index in arrays, the other one is expired */
+
+    bool need_resched;
+    ulong last_tick;            /* of the last sched_next() */
+
+    count_t n_ready;
+    count_t n_sleeping;
+    count_t n_switches;
+    count_t n_swaps;
+} sched;
+
+
+static inline uint sched_lock(void) {
+    uint efl = x86_eflags();
+    intrs_disable();
+    return efl;
+}
+
+static inline void sched_unlock(uint efl) {
+    if (efl & EFLAGS_IF)
+        intrs_enable();
+}
+
+static inline uint8_t sched_slice(uint prio) {
+    return SCHED_SLICE_MIN + (SCHED_PRIO_MIN - prio) * SCHED_SLICE_STEP;
+}
+
+/***
+  *     Run queues
+ ***/
+
+static void rq_push(uint8_t array, task_struct *task) {
+    struct runqueue *rq = sched.arrays + array;
+    uint prio = task->priority;
+
+    task->rq_array = array;
+    task->rq_next = null;
+    task->rq_prev = rq->queue[prio].tail;
+    if (rq->queue[prio].tail)
+        rq->queue[prio].tail->rq_next = task;
+    else
+        rq->queue[prio].head = task;
+    rq->queue[prio].tail = task;
+
+    rq->bitmap |= (1u << prio);
+    task->state = TS_READY;
+    ++sched.n_ready;
+}
+
+static void rq_remove(task_struct *task) {
+    struct runqueue *rq = sched.arrays + task->rq_array;
+    uint prio = task->priority;
+
+    if (task->rq_prev) task->rq_prev->rq_next = task->rq_next;
+    else               rq->queue[prio].head = task->rq_next;
+    if (task->rq_next) task->rq_next->rq_prev = task->rq_prev;
+    else               rq->queue[prio].tail = task->rq_prev;
+
+    if (!rq->queue[prio].head)
+        rq->bitmap &= ~(1u << prio);
+    task->rq_next = task->rq_prev = null;
+    --sched.n_ready;
+}
+
+/* takes the first task of the highest priority, swaps the sets if needed */
+static task_struct * rq_pop(void) {
+    struct runqueue *rq = sched.arrays + sched.active;
+    if (!rq->bitmap) {
+        sched.active ^= 1;
+        rq = sched.arrays + sched.active;
+        if (!rq->bitmap)
+            return null;
+        ++sched.n_swaps;
+    }
+
+    task_struct *task = rq->queue[__builtin_ctz(rq->bitmap)].head;
+    rq_remove(task);
+    return task;
+}
+
+/* a ready task of a higher priority than `task` */
+static inline bool rq_preempts(task_struct *task) {
+    return sched.arrays[sched.active].bitmap & ((1u << task->priority) - 1);
+}
+
+/***
+  *     Sleeping tasks
+ ***/
+
+static void sched_sleep_start(task_struct *task) {
+    task->state = TS_SLEEPING;
+    ++sched.n_sleeping;
+}
+
+static void wq_push(waitqueue_t *wq, task_struct *task) {
+    task->waitq = wq;
+    task->rq_next = null;
+    task->rq_prev = wq->tail;
+    if (wq->tail) wq->tail->rq_next = task;
+    else          wq->head = task;
+    wq->tail = task;
+}
+
+static void wq_remove(task_struct *task) {
+    waitqueue_t *wq = task->waitq;
+    if (task->rq_prev) task->rq_prev->rq_next = task->rq_next;
+    else               wq->head = task->rq_next;
+    if (task->rq_next) task->rq_next->rq_prev = task->rq_prev;
+    else               wq->tail = task->rq_prev;
+    task->rq_next = task->rq_prev = null;
+    task->waitq = null;
+}
+
+static void sched_sleep_end(task_struct *task) {
+    callout_stop(&task->sleep_timer);
+    if (task->waitq)
+        wq_remove(task);
+    --sched.n_sleeping;
+}
+
+/* makes a sleeping task ready, the lock is held */
+static void sched_make_ready(task_struct *task) {
+    sched_sleep_end(task);
+    rq_push(sched.active, task);
+
+    /* an idle current task has nothing to wait for till its slice ends */
+    task_struct *current = task_current();
+    if ((current->state != TS_RUNNING) || (task->priority < current->priority))
+        sched.need_resched = true;
+}
+
+/* wakes up a sleeping task, the lock is held */
+static void sched_wake(task_struct *task) {
+    if (task == task_current()) {
+        /* it has not been switched out yet */
+        sched_sleep_end(task);
+        task->state = TS_RUNNING;
+    } else
+        sched_make_ready(task);
+}
+
+/* the sleep_timer callout, called from the timer interrupt */
+static void sched_timeout(void *arg) {
+    task_struct *task = arg;
+    if (task->state == TS_SLEEPING)
+        sched_wake(task);
+}
+
+/* requests the next tick the scheduler needs, the lock is held */
+static void sched_arm(ulong now, task_struct *running) {
+    if (sched.need_resched)
+        timer_request(now + 1);
+    else if ((running->state == TS_RUNNING) && sched.n_ready)
+        timer_request(now + (running->timeslice ? running->timeslice : 1));
+}
+
+/* waits until the current task is scheduled again */
+static void sched_wait(uint efl) {
+    task_struct *task = task_current();
+    sched.need_resched = true;
+    sched_arm(timer_ticks(), task_current());
+    sched_unlock(efl);
+
+    while (((volatile task_struct *)task)->state == TS_SLEEPING)
+        cpu_idle();
+}
+
+/***
+  *     Task selection, called by the timer handler
+ ***/
+
+static task_struct * sched_pick(ulong tick) {
+    /* ticks may be skipped */
+    ulong elapsed = tick - sched.last_tick;
+    sched.last_tick = tick;
+
+    task_struct *current = task_current();
+    if (current->state == TS_RUNNING) {
+        if (current->timeslice > elapsed)
+            current->timeslice -= elapsed;
+        else
+            current->timeslice = 0;
+
+        if (current->timeslice && !sched.need_resched && !rq_preempts(current))
+            return null;
+
+        if (current->timeslice) {
+            rq_push(sched.active, current);
+        } else {
+            current->timeslice = sched_slice(current->priority);
+            rq_push(sched.active ^ 1, current);
+        }
+    }
+    sched.need_resched = false;
+
+    task_struct *next = rq_pop();
+    if (!next)
+        return null;    /* the current task is not runnable, it halts */
+
+    next->state = TS_RUNNING;
+    if (next == current)
+        return null;
+
+    ++sched.n_switches;
+    return next;
+}
+
+static task_struct * sched_next(uint tick) {
+    task_struct *next = sched_pick(tick);
+    sched_arm(tick, (next ? next : task_current()));
+    return next;
+}
+
+/***
+  *     Interface
+ ***/
+
+void sched_add(task_struct *task, uint prio) {
+    const char *funcname = __FUNCTION__;
+    returnv_err_if(prio > SCHED_PRIO_MIN, "%s: invalid priority %d", funcname, prio);
+
+    uint efl = sched_lock();
+    if (task->state != TS_STOPPED) {
+        sched_unlock(efl);
+        logmsgef("%s: the task is scheduled already", funcname);
+        return;
+    }
+
+    task->priority = prio;
+    task->timeslice = sched_slice(prio);
+    callout_init(&task->sleep_timer, sched_timeout, task);
+    task->waitq = null;
+    rq_push(sched.active, task);
+
+    if (prio < task_current()->priority)
+        sched.need_resched = true;
+    sched_arm(timer_ticks(), task_current());
+    sched_unlock(efl);
+}
+
+void sched_remove(task_struct *task) {
+    uint efl = sched_lock();
+    switch (task->state) {
+      case TS_READY:
+        rq_remove(task);
+        break;
+      case TS_SLEEPING:
+        sched_sleep_end(task);
+        break;
+      case TS_RUNNING:
+        sched.need_resched = true;
+        sched_arm(timer_ticks(), task_current());
+        break;
+      default: break;
+    }
+    task->state = TS_STOPPED;
+    sched_unlock(efl);
+}
+
+void sched_yield(void) {
+    uint efl = sched_lock();
+    sched.need_resched = true;
+    sched_arm(timer_ticks(), task_current());
+    sched_unlock(efl);
+    cpu_halt();
+}
+
+void sched_sleep(uint ticks) {
+    if (!ticks) return;
+
+    uint efl = sched_lock();
+    task_struct *task = task_current();
+    sched_sleep_start(task);
+    callout_reset(&task->sleep_timer, ticks);
+
+    sched_wait(efl);
+}
+
+void sched_block(void) {
+    uint efl = sched_lock();
+    sched_sleep_start(task_current());
+
+    sched_wait(efl);
+}
+
+void sched_wakeup(task_struct *task) {
+    uint efl = sched_lock();
+    if (task->state == TS_SLEEPING) {
+        sched_wake(task);
+        sched_arm(timer_ticks(), task_current());
+    }
+    sched_unlock(efl);
+}
+
+void wait_prepare(waitqueue_t *wq) {
+    uint efl = sched_lock();
+    task_struct *task = task_current();
+    if (task->state == TS_RUNNING) {
+        sched_sleep_start(task);
+        wq_push(wq, task);
+    }
+    sched_unlock(efl);
+}
+
+void wait_sleep(void) {
+    uint efl = sched_lock();
+    if (task_current()->state == TS_SLEEPING)
+        sched_wait(efl);
+    else
+        sched_unlock(efl);
+}
+
+void wait_finish(void) {
+    uint efl = sched_lock();
+    task_struct *task = task_current();
+    if (task->state == TS_SLEEPING) {
+        sched_sleep_end(task);
+        task->state = TS_RUNNING;
+    }
+    sched_unlock(efl);
+}
+
+void wait_wakeup(waitqueue_t *wq) {
+    if (!wq->head)
+        return;
+
+    uint efl = sched_lock();
+    while (wq->head)
+        sched_wake(wq->head);
+    sched_arm(timer_ticks(), task_current());
+    sched_unlock(efl);
+}
+
+void sched_info(void) {
+    struct runqueue *active = sched.arrays + sched.active;
+    struct runqueue *expired = sched.arrays + (sched.active ^ 1);
+    task_struct *current = task_current();
+
+    logmsgif("sched: current at *%x, priority %d, %d ticks left",
+             (ptr_t)current, current->priority, current->timeslice);
+    logmsgif("sched: %d ready (active %x, expired %x), %d sleeping",
+             sched.n_ready, active->bitmap, expired->bitmap, sched.n_sleeping);
+    logmsgif("sched: %d switches, %d queue swaps", sched.n_switches, sched.n_swaps);
+}
+
+void sched_setup(void) {
+    memset(&sched, 0, sizeof(sched));
+
+    task_struct *current = task_current();
+    current->priority = SCHED_PRIO_DEFAULT;
+    current->timeslice = sched_slice(SCHED_PRIO_DEFAULT);
+    current->state = TS_RUNNING;
+    callout_init(&current->sleep_timer, sched_timeout, current);
+    current->waitq = null;
+    sched.last_tick = timer_ticks();
+
+    task_set_scheduler(sched_next);
+}
@@ -1,6 +1,7 @@
 #include <syscall.h>
 #include <arch/i386.h>
 #include <process.h>
+#include <dev/clock.h>
 
 #include <cosec/fs.h>
 #include <cosec/log.h>
@@ -10,6 +11,8 @@ int sys_print(const char **fmt);
 typedef int (*syscall_handler)();
 
 const syscall_handler syscalls[] = {
+    [SYS_FORK]      = sys_fork,
+
     [SYS_READ]      = sys_read,
     [SYS_WRITE]     = sys_write,
 
@@ -24,6 +27,9 @@ const syscall_handler syscalls[] = {
     [SYS_LSEEK]     = sys_lseek,
     [SYS_GETPID]    = sys_getpid,
     [SYS_MOUNT]     = sys_mount,
+    [SYS_MMAP]      = sys_mmap,
+    [SYS_MUNMAP]    = sys_munmap,
+    [SYS_CLOCK_GETTIME] = sys_clock_gettime,
     [SYS_PRINT]     = sys_print,
 };
 
@@ -44,7 +50,7 @@ void int_syscall() {
     assertv(callee, "#SYS: invalid handler for syscall[0x%x]\n", intr_num);
 
     logmsgdf("callee *%x will be called...\n", (uint)callee);
-    callee(arg1, arg2, arg3);
+    *(stack - 1) = callee(arg1, arg2, arg3);    /* eax : result */
 }
 
 int sys_print(const char **fmt) {
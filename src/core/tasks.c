@@ -20,15 +20,22 @@
 #include <cosec/log.h>
 
 #include <tasks.h>
+#include <sched.h>
 #include <arch/i386.h>
 #include <dev/intrs.h>
 #include <dev/timer.h>
+#include <mem/paging.h>
+#include <mem/kstack.h>
 
 volatile task_struct default_task;
 volatile task_struct *volatile current = &default_task;
 
 task_next_f         task_next           = null;
 
+/* the TSS of the CPU, it only provides esp0 for interrupts from user mode */
+static tss_t cpu_tss;
+static index_t cpu_tss_index;
+
 inline static int task_sysinfo_size(task_struct *task) {
     return (task->tss.cs == SEL_KERN_CS) ? 3 : 5;
 }
@@ -38,56 +45,26 @@ inline static int task_sysinfo_size(task_struct *task) {
  ***/
 
 /* this routine is normally called from within interrupt! */
-static void task_save_context(task_struct *task) {
-    if (task == null) return;
-
-    /* ss3:esp3, efl, cs:eip, general-purpose registers, DS and ES are saved */
-    uint context = intr_context_esp();
-    assertv(context, "task_save_context: intr_ret is cleared!");
-
-    task->tss.esp0 = context + CONTEXT_SIZE + task_sysinfo_size(task)*sizeof(uint);
-
-    logmsgdf("| save cntxt=%x (tss=%d) |", context, task->tss_index);
-}
-
-/* this routine is normally called from within interrupt! */
-static void task_push_context(task_struct *task) {
-    uint context = (task->tss.esp0 - CONTEXT_SIZE - task_sysinfo_size(task)*sizeof(uint));
-    intr_set_context_esp(context);
-
-    logmsgdf(" push cntxt=%x (tss=%d) |\n", context, task->tss_index);
-}
+static void task_switch(task_struct *next) {
+    task_struct *prev = (task_struct *)current;
 
-static inline void task_cpu_load(task_struct *task) {
-    /* unmark current task as busy */
-    segment_descriptor *tssd = i386_gdt() + task->tss_index;
-    segdescr_taskstate_busy(*tssd, 0);
+    /* the interrupted context stays on the stack of `prev` */
+    prev->context = intr_context_esp();
+    intr_set_context_esp(next->context);
 
-    /* load next task */
-    uint16_t pl = ((task->tss.cs == SEL_KERN_CS) ? PL_KERN : PL_USER);
-    uint16_t tss_sel = make_selector(task->tss_index, SEL_TI_GDT, pl);
+    cpu_tss.esp0 = next->tss.esp0;
+    if (next->pagedir)
+        pagedir_switch(next->pagedir);
 
-#if __DEBUG
-    test_eflags();
-    logmsgdf("tssd = %x %x\n", tssd->as.ints[0], tssd->as.ints[1]);
-    logmsgdf("tssd.base = %x\n", tssd->as.strct.base_l +
-            (tssd->as.strct.base_m << 16) + (tssd->as.strct.base_h << 24));
-    logmsgdf("tss_sel = 0x%x\n", (uint)tss_sel);
-#endif
-
-    i386_load_task_reg( tss_sel );
+    current = next;
+    logmsgdf("| switch cntxt=%x -> %x |\n", prev->context, next->context);
 }
 
 static void task_timer_handler(uint tick) {
     if (task_next) {    // is there a scheduler
         task_struct *next = task_next(tick);
-        if (next) {     // switch to the next task is needed
-            task_save_context((task_struct*)current);
-            task_push_context(next);
-
-            current = next;
-            task_cpu_load(next);
-        }
+        if (next)       // switch to the next task is needed
+            task_switch(next);
     }
 }
 
@@ -99,6 +76,11 @@ inline void task_set_scheduler(task_next_f next) {
     task_next = next;
 }
 
+void task_set_kernel_stack(ptr_t esp0) {
+    current->tss.esp0 = esp0;
+    cpu_tss.esp0 = esp0;
+}
+
 void task_init(task_struct *task, void *entry,
         void *esp0, void *esp3,
         segment_selector cs, segment_selector ds)
@@ -116,11 +98,9 @@ void task_init(task_struct *task, void *entry,
     tss->ds = tss->es = tss->fs = tss->gs = ds.as.word;
 
     tss->ldt = SEL_DEF_LDT;
+    tss->cr3 = pagedir_cr3(pagedir_current());
     tss->eflags = x86_eflags();
     tss->eip = (uint)entry;
-    tss->io_map_addr = 0x64;
-    tss->io_map1 = 0xffffffff;
-    tss->io_map2 = 0xffffffff;
 
     /* initialize stack as if the task was interrupted */
     uint *stack = (uint *)(tss->esp0 - task_sysinfo_size(task)*sizeof(uint));
@@ -138,16 +118,152 @@ void task_init(task_struct *task, void *entry,
     context[2] = tss->es;
     context[3] = tss->ds;
 
-    /* register task TSS in GDT */
-    segment_descriptor taskdescr;
-    segdescr_taskstate_init(taskdescr, (uint)tss, PL_USER);
+    task->context = (ptr_t)context;
+    task->pagedir = pagedir_current();
+    task->pid = 0;
+
+    /* init is done, sched_add() makes it runnable */
+    task->state = TS_STOPPED;
+}
+
+void task_fork(task_struct *task, void *esp0, pde_t *pagedir, uint retval) {
+    task_struct *parent = task_current();
+    tss_t *tss = &(task->tss);
+    memcpy(tss, &parent->tss, sizeof(tss_t));
 
-    task->tss_index = gdt_alloc_entry(taskdescr);
-    assertv( task->tss_index, "Error: can't allocate GDT entry for TSSD\n");
-    logmsgdf("new TSS <- GDT[%x]\n", task->tss_index);
+    tss->esp0 = (ptr_t)esp0;
+    tss->cr3 = pagedir_cr3(pagedir);
+
+    /* the interrupt frame of the parent is the initial context */
+    uint context = intr_context_esp();
+    uint *stack = (uint *)(context + CONTEXT_SIZE);
+    tss->cs = stack[1] & 0xffff;
+
+    size_t frame_size = CONTEXT_SIZE + task_sysinfo_size(task) * sizeof(uint);
+    uint *frame = (uint *)(tss->esp0 - frame_size);
+    memcpy(frame, (void *)context, frame_size);
 
-    /* init is done */
-    task->state = TS_READY;
+    /* %eax of the child */
+    frame[CONTEXT_SIZE/sizeof(uint) - 1] = retval;
+
+    task->context = (ptr_t)frame;
+    task->pagedir = pagedir;
+    task->pid = parent->pid;
+    task->state = TS_STOPPED;
+}
+
+/***
+  *     Switch cost: the software switch against what every switch did
+  *   before, reloading the task register with a TSS of the next task.
+ ***/
+static index_t bench_tss_index[2];
+static tss_t bench_tss[2];
+
+static inline void task_load_tss(index_t tss_index) {
+    segment_descriptor *tssd = i386_gdt() + tss_index;
+    segdescr_taskstate_busy(*tssd, 0);
+    i386_load_task_reg(make_selector(tss_index, SEL_TI_GDT, PL_KERN));
+}
+
+void task_switch_bench(count_t rounds, uint64_t *sw_cycles, uint64_t *hw_cycles) {
+    const char *funcname = __FUNCTION__;
+    index_t i;
+    for (i = 0; i < 2; ++i) {
+        if (bench_tss_index[i])
+            continue;
+        memcpy(&bench_tss[i], &cpu_tss, sizeof(tss_t));
+
+        segment_descriptor taskdescr;
+        segdescr_taskstate_init(taskdescr, (uint)&bench_tss[i], PL_KERN);
+        bench_tss_index[i] = gdt_alloc_entry(taskdescr);
+        returnv_err_if(!bench_tss_index[i], "%s: no GDT entries", funcname);
+    }
+
+    /* two tasks sharing the current context and address space */
+    task_struct *self = task_current();
+    static task_struct peer;
+    memcpy(&peer, self, sizeof(task_struct));
+
+    uint efl = x86_eflags();
+    intrs_disable();
+    ptr_t saved_context = intr_context_esp();
+    self->context = peer.context = saved_context;
+
+    uint64_t ts0, ts1;
+    count_t n;
+
+    i386_rdtsc(&ts0);
+    for (n = 0; n < rounds; ++n)
+        task_switch((n % 2) ? self : &peer);
+    i386_rdtsc(&ts1);
+    *sw_cycles = ts1 - ts0;
+    if (current != self)
+        task_switch(self);
+
+    i386_rdtsc(&ts0);
+    for (n = 0; n < rounds; ++n) {
+        task_struct *next = (n % 2) ? self : &peer;
+        ((task_struct *)current)->context = intr_context_esp();
+        intr_set_context_esp(next->context);
+        task_load_tss(bench_tss_index[n % 2]);
+        current = next;
+    }
+    i386_rdtsc(&ts1);
+    *hw_cycles = ts1 - ts0;
+
+    current = self;
+    intr_set_context_esp(saved_context);
+    task_load_tss(cpu_tss_index);
+    if (efl & EFLAGS_IF)
+        intrs_enable();
+}
+
+/***
+  *     Double faults
+  *   An overflowed kernel stack cannot take the #PF frame, so #DF goes
+  *  through a task gate to its own TSS and stack and looks at the state
+  *  saved in the TSS of the faulted task.
+ ***/
+
+#define DF_STACK_SIZE   0x1000
+
+static tss_t df_tss;
+static uint8_t df_stack[DF_STACK_SIZE] __attribute__((aligned (16)));
+
+static void task_double_fault(void) {
+    segment_descriptor *tssd = i386_gdt() + segsel_index(df_tss.prev_task_link & 0xFFFF);
+    tss_t *tss = (tss_t *)segdescr_base(tssd->as.strct);
+
+    ptr_t fault_addr;
+    asm volatile ("movl %%cr2, %0   \n" : "=r"(fault_addr) );
+
+    void *stack = kstack_guard_hit(tss->esp);
+    if (!stack)
+        stack = kstack_guard_hit(fault_addr);
+
+    logmsgef("\n#DF at %x:%x, esp=%x, cr2=%x", tss->cs, tss->eip, tss->esp, fault_addr);
+    if (stack)
+        logmsgef("Kernel stack overflow: stack [%x : %x)",
+                 (ptr_t)stack, (ptr_t)stack + KSTACK_SIZE);
+    panic("DOUBLE FAULT");
+}
+
+static void task_double_fault_setup(void) {
+    df_tss.ss0 = df_tss.ss = SEL_KERN_DS;
+    df_tss.esp0 = df_tss.esp = (ptr_t)df_stack + DF_STACK_SIZE;
+    df_tss.cs = SEL_KERN_CS;
+    df_tss.ds = df_tss.es = df_tss.fs = df_tss.gs = SEL_KERN_DS;
+    df_tss.cr3 = pagedir_cr3(thePageDirectory);
+    df_tss.eip = (ptr_t)task_double_fault;
+    df_tss.eflags = x86_eflags() & ~EFLAGS_IF;
+    df_tss.io_map_addr = 0x64;
+
+    segment_descriptor taskdescr;
+    segdescr_taskstate_init(taskdescr, (uint)&df_tss, PL_KERN);
+    index_t df_index = gdt_alloc_entry(taskdescr);
+    assertv(df_index, "Error: can't allocate GDT entry for #DF TSS\n");
+
+    segdescr_taskgate_init(i386_idt()[8], make_selector(df_index, SEL_TI_GDT, PL_KERN), PL_KERN);
 }
 
 inline void task_kthread_init(task_struct *ktask, void *entry, void *k_esp) {
@@ -162,17 +278,29 @@ void tasks_setup(void) {
         default_task.tss.fs = default_task.tss.gs = SEL_KERN_DS;
     default_task.tss.cs = SEL_KERN_CS;
     default_task.tss.ss = default_task.tss.ss0 = SEL_KERN_DS;
+    default_task.tss.cr3 = pagedir_cr3(thePageDirectory);
+    default_task.pagedir = thePageDirectory;
+
+    // the only TSS of the CPU
+    cpu_tss.ss0 = SEL_KERN_DS;
+    cpu_tss.cr3 = pagedir_cr3(thePageDirectory);
+    cpu_tss.ldt = SEL_DEF_LDT;
+    cpu_tss.io_map_addr = 0x64;
+    cpu_tss.io_map1 = 0xffffffff;
+    cpu_tss.io_map2 = 0xffffffff;
 
     segment_descriptor taskdescr;
-    segdescr_taskstate_init(taskdescr, (uint)&default_task.tss, PL_KERN);
-    default_task.tss_index = gdt_alloc_entry(taskdescr);
-    default_task.ldt_index = GDT_DEF_LDT;
-    logmsgdf("default task tss_index=%x\n", default_task.tss_index);
+    segdescr_taskstate_init(taskdescr, (uint)&cpu_tss, PL_KERN);
+    cpu_tss_index = gdt_alloc_entry(taskdescr);
+    assertv(cpu_tss_index, "Error: can't allocate GDT entry for the TSS\n");
+    logmsgdf("cpu_tss_index=%x\n", cpu_tss_index);
 
     segment_selector tasksel =
-            { .as.word = make_selector(default_task.tss_index, SEL_TI_GDT, PL_KERN) };
+            { .as.word = make_selector(cpu_tss_index, SEL_TI_GDT, PL_KERN) };
     i386_load_task_reg(tasksel);
 
-    timer_push_ontimer(task_timer_handler);
-}
+    task_double_fault_setup();
 
+    timer_push_onevent(task_timer_handler);
+    sched_setup();
+}
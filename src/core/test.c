@@ -12,10 +12,12 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <conf.h>
 #include <cosec/log.h>
 #include <cosec/fs.h>
 
 #include <dev/timer.h>
+#include <dev/clock.h>
 #include <dev/kbd.h>
 #include <dev/acpi.h>
 #include <arch/i386.h>
@@ -80,8 +82,11 @@ void test_eflags(void) {
 }
 
 void test_usleep(void) {
+    uint64_t ns0 = clock_monotonic_ns();
     usleep(2 * 1000000);
-    k_printf("Done\n\n");
+    uint64_t ns = clock_monotonic_ns() - ns0;
+    i386_div64(&ns, 1000);
+    k_printf("Done in %d us\n\n", (uint)ns);
 }
 
 void test_acpi(void) {
@@ -252,9 +257,11 @@ void test_kbd(void) {
   *     Example tasks
  ***/
 #include <tasks.h>
+#include <sched.h>
 
-uint8_t task0_stack[TASK_KERNSTACK_SIZE];
-uint8_t task1_stack[TASK_KERNSTACK_SIZE];
+/* kernel stacks are taken once, the tasks are never destroyed */
+uint8_t *task0_stack = null;
+uint8_t *task1_stack = null;
 
 #define R0_STACK_SIZE       0x400
 #define R3_STACK_SIZE       0x1000
@@ -293,29 +300,55 @@ void do_task1(void) {
     }
 }
 
-volatile bool quit;
+#if PAGING
+#include <mem/paging.h>
 
-void key_press(/*scancode_t scan*/) {
-    logmsgif("\nkey pressed...\n");
-    quit = true;
-}
+extern char _start, _end;
 
+/* the kernel PDEs as they were before test_expose_kernel() */
+static pde_t kernel_pdes[pde_index(KERN_DIRECTMAP_END)];
+
+/* the example tasks run kernel code and data at CPL 3 */
+static void test_expose_kernel(void) {
+    ptr_t addr;
+    for (addr = (ptr_t)&_start & PG31_21_MASK; addr < (ptr_t)&_end; addr += LARGE_PAGE_SIZE) {
+        kernel_pdes[pde_index(addr)] = thePageDirectory[pde_index(addr)];
+        thePageDirectory[pde_index(addr)] |= PG_USR_READ;
+        i386_invlpg(addr);
+    }
+}
 
-task_struct *next_task(/*uint tick*/) {
-    if (quit) return (task_struct *)def_task;
+/* the direct map is shared by all address spaces, it must not stay exposed */
+static void test_hide_kernel(void) {
+    ptr_t addr;
+    for (addr = (ptr_t)&_start & PG31_21_MASK; addr < (ptr_t)&_end; addr += LARGE_PAGE_SIZE) {
+        thePageDirectory[pde_index(addr)] = kernel_pdes[pde_index(addr)];
+        i386_invlpg(addr);
+    }
+}
+#else
+# define test_expose_kernel()
+# define test_hide_kernel()
+#endif
 
-    task_struct *current = task_current();
-    if (current == def_task) return &task0;
-    //if (tick % 1000) return NULL;
+void key_press(/*scancode_t scan*/) {
+    logmsgif("\nkey pressed...\n");
+    sched_wakeup(def_task);
+}
 
-    if (current == &task0) return &task1;
-    if (current == &task1) return &task0;
-    panic("Invalid task");
-    return null;
+static bool test_kstacks(void) {
+    if (!task0_stack) task0_stack = kstack_alloc();
+    if (!task1_stack) task1_stack = kstack_alloc();
+    return task0_stack && task1_stack;
 }
 
 void test_tasks(void) {
+    if (!test_kstacks()) {
+        logmsgef("test_tasks: no kernel stacks");
+        return;
+    }
     def_task = task_current();
+    test_expose_kernel();
 
 #if 0
     task_kthread_init(&task0, (void *)do_task0,
@@ -342,19 +375,35 @@ void test_tasks(void) {
     task0.tss.eflags |= eflags_iopl(PL_USER);
     task1.tss.eflags |= eflags_iopl(PL_USER);
 
-    quit = false;
     kbd_set_onpress((kbd_event_f)key_press);
-    task_set_scheduler(next_task);
+    sched_add((task_struct *)&task0, SCHED_PRIO_DEFAULT);
+    sched_add((task_struct *)&task1, SCHED_PRIO_DEFAULT);
 
-    /* wait for first timer tick, when execution will be transferred to do_task0 */
-    cpu_halt();
+    /* the tasks run until a key is pressed */
+    sched_block();
 
-    task_set_scheduler(null);
+    sched_remove((task_struct *)&task0);
+    sched_remove((task_struct *)&task1);
     kbd_set_onpress(null);
+    test_hide_kernel();
 
     k_printf("\nBye.\n");
 }
 
+#define SWITCH_BENCH_ROUNDS     10000
+
+void test_switch(void) {
+    uint64_t sw_cycles, hw_cycles;
+    task_switch_bench(SWITCH_BENCH_ROUNDS, &sw_cycles, &hw_cycles);
+    i386_div64(&sw_cycles, SWITCH_BENCH_ROUNDS);
+    i386_div64(&hw_cycles, SWITCH_BENCH_ROUNDS);
+
+    k_printf("%d switches: software %d cycles/switch, ltr %d cycles/switch\n",
+             SWITCH_BENCH_ROUNDS, (uint)sw_cycles, (uint)hw_cycles);
+    k_printf("software %d ns/switch, ltr %d ns/switch\n",
+             (uint)clock_cycles_to_ns(sw_cycles), (uint)clock_cycles_to_ns(hw_cycles));
+}
+
 /***********************************************************/
 void run_userspace(void) {
     char buf[100];
@@ -374,6 +423,12 @@ extern void start_userspace(uint eip3, uint cs3, uint eflags, uint esp3, uint ss
 task_struct task3;
 
 void test_userspace(void) {
+    if (!test_kstacks()) {
+        logmsgef("test_userspace: no kernel stacks");
+        return;
+    }
+    test_expose_kernel();
+
     /* init task */
     task3.tss.eflags = x86_eflags(); // | eflags_iopl(PL_USER);
     task3.tss.cs = SEL_USER_CS;
@@ -384,29 +439,14 @@ void test_userspace(void) {
     task3.tss.ss0 = SEL_KERN_DS;
     task3.tss.esp0 = (uint)task0_stack + R0_STACK_SIZE - CONTEXT_SIZE - 0x20;
 
-    /* make a GDT task descriptor */
-    segment_descriptor taskdescr;
-    segdescr_taskstate_init(taskdescr, (uint)&(task3.tss), PL_USER);
-    segdescr_taskstate_busy(taskdescr, 0);
-
-    index_t taskdescr_index = gdt_alloc_entry(taskdescr);
-
-    segment_selector tss_sel;
-    tss_sel.as.word = make_selector(taskdescr_index, 0, taskdescr.as.strct.dpl);
-
     kbd_set_onpress((kbd_event_f)key_press);
 
     uint efl = 0x00203202;
     test_eflags();
     logmsgf("efl = 0x%x\n", efl);
-    logmsgf("tss_sel = 0x%x\n", (uint)tss_sel.as.word);
-    logmsgf("tssd = %x %x\n", taskdescr.as.ints[0], taskdescr.as.ints[1]);
-    logmsgf("tssd.base = %x\n", taskdescr.as.strct.base_l +
-            (taskdescr.as.strct.base_m << 16) + (taskdescr.as.strct.base_h << 24));
-
-    /* load TR and LDT */
-    i386_load_task_reg(tss_sel);
-    //asm ("lldt %%ax     \n\t"::"a"( SEL_DEF_LDT ));
+
+    /* interrupts from ring 3 come to this stack */
+    task_set_kernel_stack(task3.tss.esp0);
 
     /* go userspace */
     start_userspace(
@@ -0,0 +1,232 @@
+/*
+ *      Callouts
+ *
+ *  A hierarchical timing wheel: the first level has a slot for each of
+ *  the next 256 ticks, every next level has 64 slots which are 64 times
+ *  longer. A callout goes to the slot of its expiry tick at the lowest
+ *  level which covers it. When the first level wraps around, the current
+ *  slot of the next level is cascaded, i.e. its callouts are distributed
+ *  over the lower levels again.
+ *  The timer may skip ticks, so callout_run() walks all of them; a bitmap
+ *  of non-empty first level slots gives the next expiry for the timer.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <cosec/log.h>
+
+#include <arch/i386.h>
+#include <dev/timer.h>
+#include <dev/callout.h>
+
+#define WHEEL_L0_BITS   8
+#define WHEEL_LN_BITS   6
+#define WHEEL_L0_SIZE   (1 << WHEEL_L0_BITS)
+#define WHEEL_LN_SIZE   (1 << WHEEL_LN_BITS)
+#define WHEEL_L0_MASK   (WHEEL_L0_SIZE - 1)
+#define WHEEL_LN_MASK   (WHEEL_LN_SIZE - 1)
+#define WHEEL_LEVELS    4       /* above the first one */
+
+/* the shift of the tick index at level `n` above the first one */
+#define WHEEL_LN_SHIFT(n)   (WHEEL_L0_BITS + (n) * WHEEL_LN_BITS)
+
+static struct {
+    callout_t *l0[WHEEL_L0_SIZE];
+    callout_t *ln[WHEEL_LEVELS][WHEEL_LN_SIZE];
+    uint32_t l0_used[WHEEL_L0_SIZE / 32];
+
+    ulong now;                  /* the next tick to run */
+
+    count_t n_pending;
+    count_t n_fired;
+    count_t n_cascaded;
+} wheel;
+
+
+static inline uint callout_lock(void) {
+    uint efl = x86_eflags();
+    intrs_disable();
+    return efl;
+}
+
+static inline void callout_unlock(uint efl) {
+    if (efl & EFLAGS_IF)
+        intrs_enable();
+}
+
+static void wheel_link(callout_t **slot, callout_t *c) {
+    c->next = *slot;
+    if (c->next)
+        c->next->pprev = &c->next;
+    c->pprev = slot;
+    *slot = c;
+}
+
+static void wheel_insert(callout_t *c) {
+    ulong expires = c->expires;
+    if ((int64_t)(expires - wheel.now) < 0)
+        expires = wheel.now;    /* overdue, it fires at the next run */
+
+    ulong delta = expires - wheel.now;
+    if (delta < WHEEL_L0_SIZE) {
+        index_t i = expires & WHEEL_L0_MASK;
+        wheel.l0_used[i / 32] |= (1u << (i % 32));
+        wheel_link(wheel.l0 + i, c);
+        return;
+    }
+
+    index_t n;
+    for (n = 0; n < WHEEL_LEVELS - 1; ++n)
+        if (delta < (1ull << WHEEL_LN_SHIFT(n + 1)))
+            break;
+    if (n == WHEEL_LEVELS - 1 && delta >= (1ull << WHEEL_LN_SHIFT(WHEEL_LEVELS)))
+        expires = wheel.now + (1ull << WHEEL_LN_SHIFT(WHEEL_LEVELS)) - 1;
+
+    index_t i = (expires >> WHEEL_LN_SHIFT(n)) & WHEEL_LN_MASK;
+    wheel_link(wheel.ln[n] + i, c);
+}
+
+static void wheel_remove(callout_t *c) {
+    *c->pprev = c->next;
+    if (c->next)
+        c->next->pprev = c->pprev;
+
+    /* `pprev` points into the slot array if it was the first one */
+    callout_t **slot = c->pprev;
+    if ((wheel.l0 <= slot) && (slot < wheel.l0 + WHEEL_L0_SIZE) && !*slot) {
+        index_t i = slot - wheel.l0;
+        wheel.l0_used[i / 32] &= ~(1u << (i % 32));
+    }
+
+    c->next = null;
+    c->pprev = null;
+}
+
+/* redistributes slot `i` of level `n`, returns its index */
+static index_t wheel_cascade(index_t n) {
+    index_t i = (wheel.now >> WHEEL_LN_SHIFT(n)) & WHEEL_LN_MASK;
+    callout_t *c = wheel.ln[n][i];
+    wheel.ln[n][i] = null;
+
+    while (c) {
+        callout_t *next = c->next;
+        wheel_insert(c);
+        ++wheel.n_cascaded;
+        c = next;
+    }
+    return i;
+}
+
+static void callout_start(callout_t *c, ulong expires) {
+    if (callout_pending(c))
+        wheel_remove(c);
+    else
+        ++wheel.n_pending;
+
+    c->expires = expires;
+    wheel_insert(c);
+}
+
+
+/***
+  *     Interface
+ ***/
+
+void callout_init(callout_t *c, callout_f func, void *arg) {
+    memset(c, 0, sizeof(callout_t));
+    c->func = func;
+    c->arg = arg;
+}
+
+void callout_reset(callout_t *c, uint ticks) {
+    if (!ticks) ticks = 1;
+
+    uint efl = callout_lock();
+    c->period = 0;
+    callout_start(c, timer_ticks() + ticks);
+    timer_request(c->expires);
+    callout_unlock(efl);
+}
+
+void callout_periodic(callout_t *c, uint period) {
+    if (!period) period = 1;
+
+    uint efl = callout_lock();
+    c->period = period;
+    callout_start(c, timer_ticks() + period);
+    timer_request(c->expires);
+    callout_unlock(efl);
+}
+
+bool callout_stop(callout_t *c) {
+    uint efl = callout_lock();
+    bool pending = callout_pending(c);
+    if (pending) {
+        wheel_remove(c);
+        --wheel.n_pending;
+    }
+    callout_unlock(efl);
+    return pending;
+}
+
+void callout_run(ulong tick) {
+    while ((int64_t)(tick - wheel.now) >= 0) {
+        index_t i = wheel.now & WHEEL_L0_MASK;
+
+        /* the first level wrapped around */
+        index_t n;
+        if (i == 0)
+            for (n = 0; n < WHEEL_LEVELS; ++n)
+                if (wheel_cascade(n) != 0)
+                    break;
+
+        while (wheel.l0[i]) {
+            callout_t *c = wheel.l0[i];
+            wheel_remove(c);
+
+            if (c->period) {
+                c->expires += c->period;
+                if ((int64_t)(c->expires - wheel.now) <= 0)
+                    c->expires = wheel.now + c->period;    /* ticks were missed */
+                wheel_insert(c);
+            } else
+                --wheel.n_pending;
+
+            ++wheel.n_fired;
+            c->func(c->arg);
+        }
+        ++wheel.now;
+    }
+}
+
+bool callout_next(ulong *tick) {
+    if (!wheel.n_pending)
+        return false;
+
+    /* upper levels may hold earlier callouts than the first level
+       beyond the next cascade */
+    index_t start = wheel.now & WHEEL_L0_MASK;
+    index_t cascade = (start ? WHEEL_L0_SIZE - start : 0);
+
+    /* the first used slot of the first level before the cascade */
+    index_t d;
+    for (d = 0; d < cascade; ) {
+        index_t i = (start + d) & WHEEL_L0_MASK;
+        uint32_t word = wheel.l0_used[i / 32] >> (i % 32);
+        if (word) {
+            d += __builtin_ctz(word);
+            break;
+        }
+        d += 32 - (i % 32);
+    }
+    if (d > cascade)
+        d = cascade;
+
+    *tick = wheel.now + d;
+    return true;
+}
+
+void callout_info(void) {
+    logmsgif("callout: %d pending, %d fired, %d cascaded, wheel at tick %d",
+             wheel.n_pending, wheel.n_fired, wheel.n_cascaded, (uint)wheel.now);
+}
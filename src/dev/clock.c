@@ -0,0 +1,179 @@
+/*
+ *      Clocks
+ *
+ *  The TSC is calibrated against PIT channel 2 at boot: its cycles over
+ *  a known number of PIT counts give the TSC frequency. Cycles are then
+ *  turned into nanoseconds with a multiply and a shift, there is no 64-bit
+ *  division on the way. Without a TSC the clocks advance by timer ticks.
+ *  The CMOS clock is read once, its time at boot is the realtime offset.
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sys/errno.h>
+
+#include <cosec/log.h>
+
+#include <arch/i386.h>
+#include <dev/timer.h>
+#include <dev/clock.h>
+
+#define NSEC_PER_SEC        1000000000u
+
+#define CPUID_TSC           (1 << 4)
+
+#define PIT_CH2_PORT        0x42
+#define PIT_CMD_PORT        0x43
+#define PIT_CH2_ONESHOT     0xB0    /* channel 2, lobyte/hibyte, mode 0 */
+
+#define PORTB               0x61
+#define PORTB_CH2_GATE      0x01
+#define PORTB_SPEAKER       0x02
+#define PORTB_CH2_OUT       0x20
+
+#define CALIBRATE_COUNTS    (PIT_MAX_FREQ / 20)     /* 50 ms */
+#define CALIBRATE_ROUNDS    3
+
+static struct {
+    bool        tsc;
+    uint        tsc_khz;
+    uint64_t    tsc_base;       /* at clock_setup() */
+
+    /* ns = cycles * mult >> shift */
+    uint32_t    mult;
+    uint        shift;
+
+    uint32_t    tick_ns;        /* without TSC */
+    uint64_t    realtime_offset;
+} clocksrc;
+
+
+/* TSC cycles during CALIBRATE_COUNTS of PIT channel 2 */
+static uint64_t tsc_calibrate_round(void) {
+    uint8_t portb;
+    inb(PORTB, portb);
+    outb(PORTB, (portb & ~PORTB_SPEAKER) | PORTB_CH2_GATE);
+
+    outb(PIT_CMD_PORT, PIT_CH2_ONESHOT);
+    outb(PIT_CH2_PORT, (uint8_t)(CALIBRATE_COUNTS & 0xFF));
+    outb(PIT_CH2_PORT, (uint8_t)(CALIBRATE_COUNTS >> 8));
+
+    uint64_t ts0, ts1;
+    i386_rdtsc(&ts0);
+    do inb(PORTB, portb);
+    while (!(portb & PORTB_CH2_OUT));
+    i386_rdtsc(&ts1);
+
+    outb(PORTB, portb & ~(PORTB_SPEAKER | PORTB_CH2_GATE));
+    return ts1 - ts0;
+}
+
+static void tsc_calibrate(void) {
+    /* SMIs and emulation only make a round longer */
+    uint64_t cycles = tsc_calibrate_round();
+    int i;
+    for (i = 1; i < CALIBRATE_ROUNDS; ++i) {
+        uint64_t c = tsc_calibrate_round();
+        if (c < cycles) cycles = c;
+    }
+
+    uint64_t khz = cycles * PIT_MAX_FREQ;
+    i386_div64(&khz, CALIBRATE_COUNTS * 1000);
+    clocksrc.tsc_khz = (uint)khz;
+
+    /* the largest shift which keeps `mult` in 32 bits */
+    clocksrc.shift = 32;
+    while (1) {
+        uint64_t mult = (uint64_t)(NSEC_PER_SEC / 1000) << clocksrc.shift;
+        i386_div64(&mult, clocksrc.tsc_khz);
+        if (mult <= 0xFFFFFFFFull) {
+            clocksrc.mult = (uint32_t)mult;
+            break;
+        }
+        --clocksrc.shift;
+    }
+}
+
+static inline uint64_t tsc_to_ns(uint64_t cycles) {
+    uint32_t lo = (uint32_t)cycles;
+    uint32_t hi = (uint32_t)(cycles >> 32);
+    return (((uint64_t)hi * clocksrc.mult) << (32 - clocksrc.shift))
+         + (((uint64_t)lo * clocksrc.mult) >> clocksrc.shift);
+}
+
+/***
+  *     Interface
+ ***/
+
+uint64_t clock_cycles_to_ns(uint64_t cycles) {
+    return clocksrc.tsc ? tsc_to_ns(cycles) : 0;
+}
+
+uint64_t clock_monotonic_ns(void) {
+    if (!clocksrc.tsc)
+        return timer_ticks() * clocksrc.tick_ns;
+
+    uint64_t ts;
+    i386_rdtsc(&ts);
+    return tsc_to_ns(ts - clocksrc.tsc_base);
+}
+
+uint64_t clock_realtime_ns(void) {
+    return clocksrc.realtime_offset + clock_monotonic_ns();
+}
+
+time_t time(time_t *t) {
+    uint64_t secs = clock_realtime_ns();
+    i386_div64(&secs, NSEC_PER_SEC);
+    if (t) *t = (time_t)secs;
+    return (time_t)secs;
+}
+
+int sys_clock_gettime(clockid_t clk, struct timespec *ts) {
+    uint64_t ns;
+    switch (clk) {
+      case CLOCK_REALTIME:  ns = clock_realtime_ns(); break;
+      case CLOCK_MONOTONIC: ns = clock_monotonic_ns(); break;
+      default: return -EINVAL;
+    }
+    if (!ts) return -EFAULT;
+
+    ts->tv_nsec = i386_div64(&ns, NSEC_PER_SEC);
+    ts->tv_sec = (time_t)ns;
+    return 0;
+}
+
+void clock_info(void) {
+    uint64_t uptime = clock_monotonic_ns();
+    i386_div64(&uptime, 1000000);
+
+    if (clocksrc.tsc)
+        logmsgif("clock: TSC at %d kHz, mult %x >> %d",
+                 clocksrc.tsc_khz, clocksrc.mult, clocksrc.shift);
+    else
+        logmsgif("clock: timer ticks of %d ns", clocksrc.tick_ns);
+    logmsgif("clock: up %d ms, time %d", (uint)uptime, (uint)time(null));
+}
+
+void clock_setup(void) {
+    uint32_t cpu_info[3];
+    i386_cpuid_info(cpu_info, 1);
+    clocksrc.tsc = ((cpu_info[1] & CPUID_TSC) != 0);   /* %edx */
+    clocksrc.tick_ns = NSEC_PER_SEC / timer_frequency();
+
+    uint efl = x86_eflags();
+    intrs_disable();
+    if (clocksrc.tsc) {
+        tsc_calibrate();
+        i386_rdtsc(&clocksrc.tsc_base);
+    }
+    if (efl & EFLAGS_IF)
+        intrs_enable();
+
+    uint64_t boot_time = unix_time();
+    clocksrc.realtime_offset = boot_time * NSEC_PER_SEC - clock_monotonic_ns();
+
+    if (clocksrc.tsc)
+        k_printf("clock: TSC at %d kHz\n", clocksrc.tsc_khz);
+}
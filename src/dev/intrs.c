@@ -14,6 +14,7 @@
 #include <dev/intrs.h>
 
 #include <mem/paging.h>
+#include <sched.h>
 
 #include <stdio.h>
 #include <sys/errno.h>
@@ -49,6 +50,7 @@
 intr_handler_f irq[16];
 
 volatile bool irq_happened[16] = { 0 };
+static waitqueue_t irq_waitq[16];
 
 // interrupt handlers
 void int_dummy();
@@ -130,6 +132,7 @@ void irq_handler(uint32_t irq_num) {
     intr_handler_f callee = irq[irq_num];
     callee((void *)cpu_stack());
     irq_eoi();
+    wait_wakeup(irq_waitq + irq_num);
 }
 
 inline void irq_set_handler(irqnum_t irq_num, intr_handler_f handler) {
@@ -242,7 +245,6 @@ int irq_wait(irqnum_t irqnum) {
     return_err_if(irqnum >= 16, -EINVAL, "Wrong IRQ number");
 
     irq_happened[irqnum] = false;
-    do cpu_halt();
-    while (irq_happened[irqnum]);
+    wait_event(irq_waitq + irqnum, irq_happened[irqnum]);
     return 0;
 }
@@ -6,6 +6,7 @@
 #include <arch/i386.h>
 
 #include <dev/kbd.h>
+#include <sched.h>
 
 #define KEY_COUNT       128
 
@@ -119,9 +120,11 @@ char translate_from_scan(const struct kbd_layout *layout, scancode_t scan_code)
 
 /*************** getscan   **********************/
 volatile scancode_t sc;
+static waitqueue_t scan_waitq = WAITQUEUE_INIT;
 
 static void on_scan(scancode_t b) {
     sc = b;
+    wait_wakeup(&scan_waitq);
 }
 
 scancode_t kbd_wait_scan(bool release_too) {
@@ -130,7 +133,7 @@ scancode_t kbd_wait_scan(bool release_too) {
         kbd_set_onrelease(on_scan);
     sc = 0;
 
-    while (sc == 0) cpu_halt();
+    wait_event(&scan_waitq, sc != 0);
 
     kbd_set_onpress(null);
     if (release_too)
@@ -3,6 +3,8 @@
 #include <sys/errno.h>
 
 #include <mem/pmem.h>
+#include <mem/dma.h>
+#include <mem/paging.h>
 #include <dev/pci.h>
 #include <dev/intrs.h>
 
@@ -219,23 +221,24 @@ int i8254x_rx_init(i8254x_nic *nic) {
     const char *funcname = __FUNCTION__;
     size_t i;
 
-    void *rxda = pmem_alloc(NUM_DESCR_PAGES); /* must be 16 bytes aligned */
-    assert(rxda, ENOMEM, "%s: pmem_alloc(rxdescrs) failed\n", funcname);
+    ptr_t rxda_pa, rxbufs_pa;
+    void *rxda = dma_alloc(NUM_DESCR_PAGES * PAGE_SIZE, 16, &rxda_pa);
+    assert(rxda, ENOMEM, "%s: dma_alloc(rxdescrs) failed\n", funcname);
     nic->rxda = (volatile i825xx_rx_desc_t *)rxda;
 
     size_t n_rxbuf_pages = NUM_RX_DESCRIPTORS * ETH_BUFSZ / PAGE_SIZE;
     if (NUM_RX_DESCRIPTORS * ETH_BUFSZ % PAGE_SIZE) ++n_rxbuf_pages;
-    uint8_t *rxbufs = pmem_alloc(n_rxbuf_pages);
-    assert(rxbufs, ENOMEM, "%s: pmem_alloc(rxbufs) failed\n", funcname);
+    uint8_t *rxbufs = dma_alloc(n_rxbuf_pages * PAGE_SIZE, PAGE_SIZE, &rxbufs_pa);
+    assert(rxbufs, ENOMEM, "%s: dma_alloc(rxbufs) failed\n", funcname);
     logmsgf("[%x]: rxbuf = *%x (%d pages)\n", nic->hwid, (uint)rxbufs, n_rxbuf_pages);
 
     for (i = 0; i < NUM_RX_DESCRIPTORS; ++i) {
-        nic->rxda[i].address = (uint64_t)(uint32_t)(rxbufs + i * ETH_BUFSZ);
+        nic->rxda[i].address = (uint64_t)(rxbufs_pa + i * ETH_BUFSZ);
         nic->rxda[i].sta.byte = 0;
     }
 
     /* rx array base address */
-    mmio_write(nic, I8254X_RDBAL, (uint32_t)rxda);
+    mmio_write(nic, I8254X_RDBAL, (uint32_t)rxda_pa);
     mmio_write(nic, I8254X_RDBAH, 0);
     logmsgf("[%x]: rxda = *%x[ %d rxdescr ]\n", nic->hwid, (uint)rxda, NUM_RX_DESCRIPTORS);
 
@@ -272,8 +275,9 @@ int i8254x_tx_init(i8254x_nic *nic) {
     const char *funcname = __FUNCTION__;
     size_t i;
 
-    void *txda = pmem_alloc(NUM_DESCR_PAGES);
-    assert(txda, ENOMEM, "%s: pmem_alloc(txda) failed\n", funcname);
+    ptr_t txda_pa;
+    void *txda = dma_alloc(NUM_DESCR_PAGES * PAGE_SIZE, 16, &txda_pa);
+    assert(txda, ENOMEM, "%s: dma_alloc(txda) failed\n", funcname);
     nic->txda = (volatile i825xx_tx_desc_t *)txda;
 
     for (i = 0; i < NUM_TX_DESCRIPTORS; ++i) {
@@ -283,7 +287,7 @@ int i8254x_tx_init(i8254x_nic *nic) {
     }
 
     /* setup TX descr. ring buffer */
-    mmio_write(nic, I8254X_TDBAL, (uint32_t)txda);
+    mmio_write(nic, I8254X_TDBAL, (uint32_t)txda_pa);
     mmio_write(nic, I8254X_TDBAH, 0);
     logmsgf("[%x]: txda = *%x[ %d txdescr ]\n", nic->hwid, (uint)txda, NUM_TX_DESCRIPTORS);
 
@@ -304,7 +308,7 @@ void i8254x_recv(i8254x_nic *nic) {
 
     i825xx_rx_desc_t *rxdescr = (i825xx_rx_desc_t *)(nic->rxda + nic->rx_tail);
     while (rxdescr->sta.DD) {
-        uint8_t *packet = (uint8_t *)(uint32_t)rxdescr->address;
+        uint8_t *packet = __va((uint32_t)rxdescr->address);
         uint16_t pktlen = rxdescr->length;
 
         bool dropflag = false;
@@ -332,7 +336,7 @@ void i8254x_recv(i8254x_nic *nic) {
 void i8254x_send(i8254x_nic *nic, uint8_t *pkt, uint16_t pktlen) {
     i825xx_tx_desc_t *txdescr = (i825xx_tx_desc_t *)nic->txda + nic->tx_tail;
 
-    txdescr->address = (volatile uint64_t)(uint32_t)pkt;
+    txdescr->address = (volatile uint64_t)(ptr_t)__pa(pkt);
     txdescr->length = pktlen;
     txdescr->cmd = 0x0e;
 
@@ -4,6 +4,7 @@
 #include <attrs.h>
 #include <mem/kheap.h>
 #include <mem/pmem.h>
+#include <mem/dma.h>
 #include <dev/intrs.h>
 #include <dev/pci.h>
 #include <arch/i386.h>
@@ -124,6 +125,7 @@ struct __packed vring_used {
 struct virtioq {
     uint16_t size;
     size_t npages;
+    ptr_t paddr;                /* of desc */
     struct vring_desc   *desc;
     struct vring_avail  *avail;
     struct vring_used   *used;
@@ -196,10 +198,9 @@ static int virtio_vring_alloc(struct virtioq *q, uint16_t qsz) {
     }
     npages = npages / PAGE_SIZE;
 
-    char *qmem = pmem_alloc(npages);
+    char *qmem = dma_alloc(npages * PAGE_SIZE, VIRTIO_PAD, &q->paddr);
     return_err_if(!qmem, -ENOMEM,
-                  "%s: pmem_alloc(%d) failed\n", funcname, npages);
-    memset(qmem, 0, npages * PAGE_SIZE);
+                  "%s: dma_alloc(%d pages) failed\n", funcname, npages);
     q->size = qsz;
     q->npages = npages;
     q->desc = (struct vring_desc *)qmem;
@@ -238,7 +239,8 @@ static int net_virtio_setup(struct virtio_net_device *nic) {
     /* fill rx queue */
     const uint16_t packetsz = 2048;
     const size_t netbufsz = 1 + (nic->rxq.size * packetsz) / PAGE_SIZE;
-    uint8_t *netbuf = pmem_alloc(netbufsz);
+    ptr_t netbuf_pa;
+    uint8_t *netbuf = dma_alloc(netbufsz * PAGE_SIZE, PAGE_SIZE, &netbuf_pa);
     return_err_if(!netbuf, -ENOMEM,
                   "%s: failed to allocate netbuf\n", funcname);
 
@@ -251,7 +253,7 @@ static int net_virtio_setup(struct virtio_net_device *nic) {
     rxavail->idx = 0;    // ?
     for (i = 0; i < nic->rxq.size; ++i) {
         struct vring_desc *vrd = nic->rxq.desc + i;
-        vrd->addr = (uint64_t)(uint32_t)(netbuf + packetsz * i);
+        vrd->addr = (uint64_t)(netbuf_pa + packetsz * i);
         vrd->len = packetsz;
         vrd->flags = VIRTQ_DESC_F_WRITE;
         vrd->next = 0;
@@ -259,7 +261,7 @@ static int net_virtio_setup(struct virtio_net_device *nic) {
         rxavail->ring[i] = (uint16_t)i;
     }
 
-    val = (uint32_t)nic->rxq.desc / VIRTIO_PAD;
+    val = (uint32_t)nic->rxq.paddr / VIRTIO_PAD;
     outl(nic->virtio.iobase + VIO_Q_ADDR, val);
 
     /* tx queue */
@@ -273,7 +275,7 @@ static int net_virtio_setup(struct virtio_net_device *nic) {
     logmsgdf("%s: tx_q[%d] at *%x (%d pages)\n", funcname,
              (int)hval, nic->txq.desc, nic->txq.npages);
 
-    val = (uint32_t)nic->txq.desc / VIRTIO_PAD;
+    val = (uint32_t)nic->txq.paddr / VIRTIO_PAD;
     outl(nic->virtio.iobase + VIO_Q_ADDR, val);
 
     /* negotiate features */
@@ -29,7 +29,10 @@ static inline void convert_from_cmos_fmt(ymd_hms *time) {
 
 err_t time_ymd_from_rtc(ymd_hms *ymd) {
     ymd_hms time;
+    memset(&time, 0, sizeof(ymd_hms));
+    memset(ymd, 0, sizeof(ymd_hms));
 
+    /* until two reads agree, an update may happen in between */
     do {
         logmsgd("RTC read: trying...");
         while (cmos_is_in_update());
@@ -47,19 +50,29 @@ err_t time_ymd_from_rtc(ymd_hms *ymd) {
         ymd->tm_mday = read_cmos(CMOS_REG_DAY_OF_MONTH);
         ymd->tm_mon = read_cmos(CMOS_REG_MONTH);
         ymd->tm_year = read_cmos(CMOS_REG_YEAR);
-    } while(!memcmp(&time, ymd, sizeof(ymd_hms)));
+    } while (memcmp(&time, ymd, sizeof(ymd_hms)));
 
     convert_from_cmos_fmt(ymd);
 
     return NOERR;
 }
 
-time_t unix_time(void) {
-    return -ETODO;
+/* days since 1970-01-01 of a proleptic Gregorian date, `mon` is 1..12 */
+static int days_from_civil(int year, int mon, int mday) {
+    year -= (mon <= 2);
+    int era = year / 400;
+    int yoe = year - era * 400;
+    int doy = (153 * (mon + (mon > 2 ? -3 : 9)) + 2) / 5 + mday - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
 }
 
-time_t time(time_t *t) {
-    time_t _t = unix_time();
-    if (t) *t = _t;
-    return _t;
+/* reads the CMOS clock, it is slow: see clock_realtime_ns() */
+time_t unix_time(void) {
+    ymd_hms tm;
+    if (time_ymd_from_rtc(&tm))
+        return 0;
+
+    time_t days = days_from_civil(tm.tm_year, tm.tm_mon, tm.tm_mday);
+    return ((days * 24 + tm.tm_hour) * 60 + tm.tm_min) * 60 + tm.tm_sec;
 }
@@ -1,4 +1,18 @@
+/*
+ *      PIT timer
+ *
+ *  Ticks are counted at PIT_MAX_FREQ / timer_freq_divisor. In tickless
+ *  mode channel 0 is programmed in one-shot mode for the earliest tick
+ *  requested with timer_request() or the earliest pending callout, and
+ *  the tick count is advanced by the elapsed PIT counts. A one-shot is
+ *  at most 0xFFFF counts (~55 ms), so an idle system still takes about
+ *  18 interrupts per second to keep the tick count.
+ *  Handlers of every tick (timer_push_ontimer()) are periodic callouts.
+ */
 #include <dev/timer.h>
+#include <dev/callout.h>
+#include <dev/clock.h>
+#include <sched.h>
 
 #include <dev/intrs.h>
 #include <arch/i386.h>
@@ -6,69 +20,257 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <cosec/log.h>
+
 #define PIT_CH0_PORT    0x40
 #define PIT_CH1_PORT    0x41
 #define PIT_CH3_PORT    0x42
 #define PIT_CMD_PORT    0x43
 
+#define PIT_CH0_PERIODIC    0x36    /* channel 0, lobyte/hibyte, mode 3 */
+#define PIT_CH0_ONESHOT     0x30    /* channel 0, lobyte/hibyte, mode 0 */
+#define PIT_CH0_READBACK    0xC2    /* latch status and count of channel 0 */
+
+#define PIT_STATUS_OUT      0x80    /* the one-shot has expired */
+#define PIT_STATUS_NULL     0x40    /* the count is not loaded yet */
+
+#define PIT_MAX_COUNT       0xFFFF
+
+#define TICK_NONE           0       /* no tick is requested */
+
+#define N_TIMER_EVENTS      4
+
 volatile uint timer_freq_divisor = 0x100;
 volatile ulong ticks = 0;
 
-timer_event_f timers[N_TIMERS] = { 0 };
+/* timer_push_ontimer() handlers */
+static struct {
+    callout_t       callout;
+    timer_event_f   handler;
+} ontimers[N_TIMERS];
+
+static timer_event_f onevents[N_TIMER_EVENTS];
+
+static struct {
+    bool    oneshot;        /* the PIT is in one-shot mode */
+    bool    in_irq;         /* timer_irq() will program the PIT */
+
+    uint    armed;          /* PIT counts of the current one-shot */
+    ulong   armed_tick;     /* the tick it expires at */
+    uint    residue;        /* counts of a tick which are already elapsed */
+    ulong   next_event;     /* the earliest requested tick or TICK_NONE */
+
+    count_t n_irqs;
+} timer;
+
+
+static inline uint timer_lock(void) {
+    uint efl = x86_eflags();
+    intrs_disable();
+    return efl;
+}
+
+static inline void timer_unlock(uint efl) {
+    if (efl & EFLAGS_IF)
+        intrs_enable();
+}
+
+static void pit_periodic(uint divisor) {
+    outb(PIT_CMD_PORT, PIT_CH0_PERIODIC);
+    outb(PIT_CH0_PORT, (uint8_t)(divisor & 0xFF));
+    outb(PIT_CH0_PORT, (uint8_t)(divisor >> 8));
+}
+
+static void pit_oneshot(uint counts) {
+    outb(PIT_CMD_PORT, PIT_CH0_ONESHOT);
+    outb(PIT_CH0_PORT, (uint8_t)(counts & 0xFF));
+    outb(PIT_CH0_PORT, (uint8_t)(counts >> 8));
+}
+
+/* PIT counts elapsed in the current one-shot, -1 if it has expired */
+static int pit_elapsed(void) {
+    uint8_t status, lo, hi;
+    outb(PIT_CMD_PORT, PIT_CH0_READBACK);
+    inb(PIT_CH0_PORT, status);
+    inb(PIT_CH0_PORT, lo);
+    inb(PIT_CH0_PORT, hi);
+
+    if (status & PIT_STATUS_OUT)
+        return -1;
+    if (status & PIT_STATUS_NULL)
+        return 0;
+
+    uint count = lo | ((uint)hi << 8);
+    return (count > timer.armed) ? 0 : (int)(timer.armed - count);
+}
+
+/* adds `counts` PIT counts to the tick count */
+static void timer_account(uint counts) {
+    timer.residue += counts;
+    ticks += timer.residue / timer_freq_divisor;
+    timer.residue %= timer_freq_divisor;
+}
+
+/* programs the PIT for the next tick which is needed */
+static void timer_arm(void) {
+    uint max_ticks = PIT_MAX_COUNT / timer_freq_divisor;
+    uint n_ticks = max_ticks;
+    if (timer.next_event != TICK_NONE) {
+        long delta = (long)(timer.next_event - ticks);
+        if (delta < 1) delta = 1;
+        if ((ulong)delta < n_ticks) n_ticks = delta;
+    }
+
+    uint counts = n_ticks * timer_freq_divisor - timer.residue;
+    timer.oneshot = true;
+    timer.armed = counts;
+    timer.armed_tick = ticks + n_ticks;
+    pit_oneshot(counts);
+}
+
+/***
+  *     Interface
+ ***/
+
+static void ontimer_fire(void *arg) {
+    timer_event_f handler = ontimers[(timer_t)arg].handler;
+    if (handler)
+        handler(ticks);
+}
 
 timer_t timer_push_ontimer(timer_event_f ontimer) {
-    int i = 0;
+    timer_t i;
+    uint efl = timer_lock();
     for (i = 0; i < N_TIMERS; ++i)
-        if (null == timers[i]) {
-            timers[i] = ontimer;
-            return i;
+        if (null == ontimers[i].handler) {
+            ontimers[i].handler = ontimer;
+            callout_init(&ontimers[i].callout, ontimer_fire, (void *)i);
+            callout_periodic(&ontimers[i].callout, 1);
+            break;
         }
+    timer_unlock(efl);
     return i;
 }
 
-ulong timer_ticks(void) {
-    return ticks;
+void timer_pop_ontimer(timer_t id) {
+    if (id >= N_TIMERS) return;
+
+    uint efl = timer_lock();
+    callout_stop(&ontimers[id].callout);
+    ontimers[id].handler = null;
+    timer_unlock(efl);
 }
 
-void timer_pop_ontimer(timer_t id) {
-    timers[id] = null;
+timer_t timer_push_onevent(timer_event_f onevent) {
+    timer_t i;
+    uint efl = timer_lock();
+    for (i = 0; i < N_TIMER_EVENTS; ++i)
+        if (null == onevents[i]) {
+            onevents[i] = onevent;
+            break;
+        }
+    timer_unlock(efl);
+    return i;
+}
+
+void timer_request(ulong tick) {
+    uint efl = timer_lock();
+    if ((timer.next_event == TICK_NONE) || ((long)(tick - timer.next_event) < 0))
+        timer.next_event = (tick == TICK_NONE ? 1 : tick);
+
+    /* a later one-shot is reprogrammed unless it is about to fire */
+    if (timer.oneshot && !timer.in_irq && ((long)(tick - timer.armed_tick) < 0)) {
+        int elapsed = pit_elapsed();
+        if (elapsed >= 0) {
+            timer_account(elapsed);
+            timer_arm();
+        }
+    }
+    timer_unlock(efl);
+}
+
+ulong timer_ticks(void) {
+    if (!timer.oneshot || timer.in_irq)
+        return ticks;
+
+    /* the counts of the current one-shot are not accounted yet */
+    uint efl = timer_lock();
+    int elapsed = pit_elapsed();
+    ulong now = (elapsed < 0) ? timer.armed_tick
+              : ticks + (timer.residue + elapsed) / timer_freq_divisor;
+    timer_unlock(efl);
+    return now;
 }
 
 void timer_set_frequency(uint hz) {
     uint divisor = PIT_MAX_FREQ / hz;
     timer_freq_divisor = divisor;
-    outb(PIT_CMD_PORT, 0x36);
-    outb(PIT_CH0_PORT, (uint8_t)(divisor & 0xFF));
-    outb(PIT_CH0_PORT, (uint8_t)(divisor >> 8));
+    timer.residue = 0;
+    timer.oneshot = false;
+    pit_periodic(divisor);
 }
 
 uint timer_frequency(void) {
     return PIT_MAX_FREQ / timer_freq_divisor;
 }
 
+void timer_info(void) {
+    k_printf("timer: %d Hz ticks, %s, tick %d, %d interrupts\n",
+             timer_frequency(), (timer.oneshot ? "one-shot" : "periodic"),
+             (uint)ticks, timer.n_irqs);
+    callout_info();
+}
+
 void timer_setup(void) {
     timer_set_frequency(timer_freq_divisor);
+    timer.next_event = TICK_NONE;
+#if TIMER_TICKLESS
+    timer_arm();
+#endif
 
     irq_set_handler(TIMER_IRQ, timer_irq);
     irq_mask(TIMER_IRQ, true);
 }
 
 void timer_irq() {
-    ++ ticks;
+    ++timer.n_irqs;
+    if (timer.oneshot)
+        timer_account(timer.armed);
+    else
+        ++ ticks;
+
+    timer.in_irq = true;
+    timer.next_event = TICK_NONE;
+
+    callout_run(ticks);
 
     int i;
-    for(i = 0; i < N_TIMERS; ++i)
-        if (timers[i])
-            timers[i](ticks);
+    for (i = 0; i < N_TIMER_EVENTS; ++i)
+        if (onevents[i])
+            onevents[i](ticks);
+
+    ulong next;
+    if (callout_next(&next))
+        timer_request(next);
+
+    timer.in_irq = false;
+    if (timer.oneshot)
+        timer_arm();
 }
 
 int usleep(useconds_t usec) {
-    ulong tick0 = timer_ticks();
-    uint dt = (1000000.0 * timer_freq_divisor) / (float)PIT_MAX_FREQ;
+    uint64_t deadline = clock_monotonic_ns() + (uint64_t)usec * 1000;
+    uint tick_ns = 1000000000u / timer_frequency();
     while (1) {
-        cpu_halt(); // yield()
-        ulong tick = timer_ticks();
-        if (dt * (tick - tick0) > usec) 
-           return 0; 
+        uint64_t now = clock_monotonic_ns();
+        if (now >= deadline)
+            return 0;
+
+        uint64_t left = deadline - now;
+        if (left < tick_ns)
+            continue;   /* the rest of a tick is spun */
+
+        i386_div64(&left, tick_ns);
+        sched_sleep(left);
     }
 }
@@ -13,6 +13,7 @@
 #include <fs/devices.h>
 #include <dev/tty.h>
 #include <arch/i386.h>
+#include <sched.h>
 
 typedef  struct tty_device       tty_device;
 typedef  struct tty_input_queue  tty_inpqueue;
@@ -31,6 +32,7 @@ struct tty_device {
 
     enum tty_kbdmode        tty_kbmode;
     volatile tty_inpqueue   tty_inpq;
+    waitqueue_t             tty_readq;  /* readers waiting for input */
     struct termios          tty_conf;
     struct winsize          tty_size;
 
@@ -448,14 +450,9 @@ static int dev_tty_read(
         /* canonical mode: serve a line */
         int eol_at;
 
-        while (true) {
-            eol_at = tty_inpq_strchr(&tty->tty_inpq, '\n');
-            if (eol_at >= 0)
-                break;
-
-            /* tty_inpq may change here */
-            cpu_halt();
-        }
+        /* tty_keyboard_handler() wakes it up at the end of a line */
+        wait_event(&tty->tty_readq,
+                   (eol_at = tty_inpq_strchr(&tty->tty_inpq, '\n')) >= 0);
 
         //logmsgdf(".");
         size_t to_pop = (size_t)eol_at + 1;
@@ -541,6 +538,7 @@ void tty_keyboard_handler(scancode_t sc) {
 
         tty_inpq_push(inpq, buf, 1);
         logmsgdf("%s: RAW mode, tty_inpq_push(0x%x)\n", funcname, (int)buf[0]);
+        wait_wakeup(&tty->tty_readq);
 
         break;
       case TTYKBD_ANSI:
@@ -558,6 +556,7 @@ void tty_keyboard_handler(scancode_t sc) {
               case '\n':
                 if (tty_inpq_push(inpq, buf, ret))
                     vcsa_newline(tty->tty_vcs);
+                wait_wakeup(&tty->tty_readq);
                 return;
               default:
                 if (tty_inpq_push(inpq, buf, ret)) {
@@ -597,6 +596,7 @@ static void init_tty_family(void) {
         tty->tty_size.wy = SCR_HEIGHT;
 
         tty->tty_inpq.start = tty->tty_inpq.end = 0;
+        waitqueue_init(&tty->tty_readq);
 
         theTTYlist[i] = tty;
     }
@@ -2,9 +2,11 @@
 #include <string.h>
 #include <sys/errno.h>
 
+#include <conf.h>
 #include <cosec/log.h>
 
 #include <mem/pmem.h>
+#include <mem/pcache.h>
 
 #include <dev/screen.h>
 #include <dev/tty.h>
@@ -82,10 +84,10 @@ devclass  blk1_device_family = {
  *  Generic device operations
  */
 
-int bdev_blocking_read(
+static int bdev_read_blocks(
         device *dev, off_t pos, char *buf, size_t buflen, size_t *written)
 {
-    const char *funcname = __FUNCTION__;
+    const char *funcname = "bdev_blocking_read";
 
     int ret = 0;
     size_t i;
@@ -156,6 +158,56 @@ error_exit:
     return ret;
 }
 
+/* block devices are read by pages through the page cache */
+static err_t bdev_fill_page(void *owner, inode_t ino, off_t index, char *data) {
+    UNUSED(ino);
+    device *dev = owner;
+    off_t devsize = dev->dev_ops->dev_size_in_blocks(dev) * dev->dev_ops->dev_size_of_block(dev);
+    off_t pos = index * PAGE_SIZE;
+
+    size_t len = PAGE_SIZE;
+    if (pos + PAGE_SIZE > devsize)
+        len = devsize - pos;
+
+    memset(data + len, 0, PAGE_SIZE - len);
+    return bdev_read_blocks(dev, pos, data, len, NULL);
+}
+
+int bdev_blocking_read(
+        device *dev, off_t pos, char *buf, size_t buflen, size_t *written)
+{
+    if ((dev->dev_type != DEV_BLK)
+        || !dev->dev_ops->dev_size_of_block || !dev->dev_ops->dev_size_in_blocks)
+        return bdev_read_blocks(dev, pos, buf, buflen, written);
+
+    int ret = 0;
+    size_t bytes_done = 0;
+    off_t devsize = dev->dev_ops->dev_size_in_blocks(dev) * dev->dev_ops->dev_size_of_block(dev);
+
+    while (bytes_done < buflen) {
+        if (pos >= devsize) { ret = ENXIO; break; }
+
+        size_t offset = pos % PAGE_SIZE;
+        size_t len = PAGE_SIZE - offset;
+        if (len > buflen - bytes_done)
+            len = buflen - bytes_done;
+        if (pos + (off_t)len > devsize)
+            len = devsize - pos;
+
+        pcache_page_t *page = pcache_get(dev, 0, pos / PAGE_SIZE, bdev_fill_page);
+        if (!page) { ret = EIO; break; }
+
+        memcpy(buf + bytes_done, pcache_data(page) + offset, len);
+        pcache_put(page);
+
+        bytes_done += len;
+        pos += len;
+    }
+
+    if (written) *written = bytes_done;
+    return ret;
+}
+
 
 int bdev_blocking_write(
         struct device *dev, off_t pos,
@@ -229,6 +281,13 @@ int bdev_blocking_write(
 error_exit:
     logmsgdf("%s: ret=%d, bytes_done=%d\n", ret, bytes_done);
     if (written) *written = bytes_done;
+
+    /* cached copies are stale now */
+    if (dev->dev_type == DEV_BLK) {
+        off_t index;
+        for (index = pos / PAGE_SIZE; index * PAGE_SIZE < pos + (off_t)bytes_done; ++index)
+            pcache_forget(dev, 0, index);
+    }
     return ret;
 }
 
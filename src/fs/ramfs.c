@@ -4,12 +4,29 @@
 #include <sys/errno.h>
 
 #include <mem/pmem.h>
+#include <mem/kmap.h>
+#include <mem/slab.h>
 #include <fs/ramfs.h>
 #include <conf.h>
 
 #include <cosec/log.h>
 
 typedef void (*btree_leaf_free_f)(void *);
+typedef void (*btree_leaf_f)(struct inode *, void *);
+
+/* object caches, see ramfs_caches_setup() */
+static kmem_cache_t *btree_node_cache = NULL;
+static kmem_cache_t *ramfs_directory_cache = NULL;
+static kmem_cache_t *ramfs_direntry_cache = NULL;
+static kmem_cache_t *ramfs_inode_cache = NULL;
+
+/* direntry names up to RAMFS_NAME_CACHED bytes long live in name caches */
+#define RAMFS_NAME_CACHES   3
+#define RAMFS_NAME_MIN      16
+#define RAMFS_NAME_CACHED   (RAMFS_NAME_MIN << (RAMFS_NAME_CACHES - 1))
+static kmem_cache_t *ramfs_name_cache[RAMFS_NAME_CACHES] = { NULL };
+
+#define BTREE_FANOUT        64
 
 /* this structure is a "hierarchical" lookup table from any large index to some pointer */
 struct btree_node {
@@ -25,6 +42,9 @@ static struct btree_node * btree_new(size_t fanout);
 /* frees a bnode and all its children */
 static void btree_free(struct btree_node *bnode, btree_leaf_free_f free_leaf);
 
+/* calls `fn` for every leaf of a bnode */
+static void btree_foreach_leaf(struct btree_node *bnode, btree_leaf_f fn, void *arg);
+
 /* look up a value by index */
 static void * btree_get_index(struct btree_node *bnode, size_t index);
 
@@ -34,7 +54,11 @@ static inode_t btree_set_leaf(struct btree_node *bnode, struct inode *idata);
 
 static struct btree_node * btree_new(size_t fanout) {
     size_t bchildren_len = sizeof(void *) * fanout;
-    struct btree_node *bnode = kmalloc(sizeof(struct btree_node) + bchildren_len);
+    struct btree_node *bnode;
+    if (fanout == BTREE_FANOUT)
+        bnode = kmem_cache_alloc(btree_node_cache);
+    else
+        bnode = kmalloc(sizeof(struct btree_node) + bchildren_len);
     if (!bnode) return NULL;
 
     bnode->bt_level = 0;
@@ -59,6 +83,26 @@ static void btree_free(struct btree_node *bnode, btree_leaf_free_f free_leaf) {
                 btree_free(bchild, free_leaf);
         }
     }
+
+    if (bnode->bt_fanout == BTREE_FANOUT)
+        kmem_cache_free(btree_node_cache, bnode);
+    else
+        kfree(bnode);
+}
+
+static void btree_foreach_leaf(struct btree_node *bnode, btree_leaf_f fn, void *arg) {
+    size_t i;
+    for (i = 0; i < bnode->bt_fanout; ++i) {
+        if (bnode->bt_level == 0) {
+            struct inode *idata = bnode->bt_children[i];
+            if (idata && (idata != &theInvalidInode))
+                fn(idata, arg);
+        } else {
+            struct btree_node *bchild = bnode->bt_children[i];
+            if (bchild)
+                btree_foreach_leaf(bchild, fn, arg);
+        }
+    }
 }
 
 /* get leaf or NULL for index */
@@ -218,9 +262,11 @@ static int ramfs_read_inode(mountnode *sb, inode_t ino, off_t pos,
 static int ramfs_write_inode(mountnode *sb, inode_t ino, off_t pos,
                              const char *buf, size_t buflen, size_t *written);
 static int ramfs_trunc_inode(/*mountnode *sb, inode_t ino, off_t length*/);
+static int ramfs_inode_page(mountnode *sb, inode_t ino, off_t index, pfn_t *frame);
 
 static void ramfs_inode_free(struct inode *idata);
 static void ramfs_free_inode_blocks(struct inode *idata);
+static void ramfs_evacuate(pfn_t start, pfn_t end);
 
 
 struct filesystem_operations  ramfs_fsops = {
@@ -236,6 +282,7 @@ struct filesystem_operations  ramfs_fsops = {
     .read_inode         = ramfs_read_inode,
     .write_inode        = ramfs_write_inode,
     .trunc_inode        = ramfs_trunc_inode,
+    .inode_page         = ramfs_inode_page,
 };
 
 struct filesystem_driver  ramfs_driver = {
@@ -272,7 +319,7 @@ struct ramfs_directory {
 static int ramfs_directory_new(struct ramfs_directory **dir) {
     const char *funcname = "ramfs_directory_new";
 
-    struct ramfs_directory *d = kmalloc(sizeof(struct ramfs_directory));
+    struct ramfs_directory *d = kmem_cache_alloc(ramfs_directory_cache);
     if (!d) goto enomem_exit;
 
     d->size = 0;
@@ -287,8 +334,8 @@ static int ramfs_directory_new(struct ramfs_directory **dir) {
     return 0;
 
 enomem_exit:
-    logmsgdf("%s: ENOMEM\n");
-    if (d) kfree(d);
+    logmsgdf("%s: ENOMEM\n", funcname);
+    if (d) kmem_cache_free(ramfs_directory_cache, d);
     return ENOMEM;
 }
 
@@ -322,9 +369,34 @@ static int ramfs_directory_insert(struct ramfs_directory *dir,
     return 0;
 }
 
+static char * ramfs_name_dup(const char *name) {
+    size_t len = strlen(name) + 1;
+    if (len > RAMFS_NAME_CACHED)
+        return strdup(name);
+
+    int i = 0;
+    while ((size_t)(RAMFS_NAME_MIN << i) < len) ++i;
+
+    char *s = kmem_cache_alloc(ramfs_name_cache[i]);
+    if (s) memcpy(s, name, len);
+    return s;
+}
+
+static void ramfs_name_free(char *name) {
+    size_t len = strlen(name) + 1;
+    if (len > RAMFS_NAME_CACHED) {
+        kfree(name);
+        return;
+    }
+
+    int i = 0;
+    while ((size_t)(RAMFS_NAME_MIN << i) < len) ++i;
+    kmem_cache_free(ramfs_name_cache[i], name);
+}
+
 static void ramfs_direntry_free(struct ramfs_direntry *de) {
-    kfree(de->de_name);
-    kfree(de);
+    ramfs_name_free(de->de_name);
+    kmem_cache_free(ramfs_direntry_cache, de);
 }
 
 static int ramfs_directory_new_entry(
@@ -334,11 +406,14 @@ static int ramfs_directory_new_entry(
     UNUSED(sb);
     logmsgdf("ramfs_directory_new_entry(%s)\n", name);
     int ret;
-    struct ramfs_direntry *de = kmalloc(sizeof(struct ramfs_direntry));
+    struct ramfs_direntry *de = kmem_cache_alloc(ramfs_direntry_cache);
     if (!de) return ENOMEM;
 
-    de->de_name = strdup(name);
-    if (!de->de_name) { kfree(de); return ENOMEM; }
+    de->de_name = ramfs_name_dup(name);
+    if (!de->de_name) {
+        kmem_cache_free(ramfs_direntry_cache, de);
+        return ENOMEM;
+    }
 
     de->de_hash = strhash(name, strlen(name));
     de->de_ino = idata->i_no;
@@ -433,28 +508,30 @@ static void ramfs_directory_free(struct ramfs_directory *dir) {
         struct ramfs_direntry *nextbucket = NULL;
         while (bucket) {
             nextbucket = bucket->htnext;
-            kfree(bucket->de_name);
-            kfree(bucket);
+            ramfs_direntry_free(bucket);
             bucket = nextbucket;
         }
     }
 
     kfree(dir->ht);
-    kfree(dir);
+    kmem_cache_free(ramfs_directory_cache, dir);
 }
 
 
 /* used by struct superblock as `data` pointer to store FS-specific state */
 struct ramfs_data {
     struct btree_node *inodes_btree;  /* map from inode_t to struct inode */
+    struct ramfs_data *next;          /* in the list of mounted ramfs */
 };
 
+static struct ramfs_data *ramfs_mounted = NULL;
+
 static int ramfs_data_new(mountnode *sb) {
     struct ramfs_data *data = kmalloc(sizeof(struct ramfs_data));
     if (!data) return ENOMEM;
 
     /* a B-tree that maps inode indexes to actual inodes */
-    struct btree_node *bnode = btree_new(64);
+    struct btree_node *bnode = btree_new(BTREE_FANOUT);
     if (!bnode) {
         kfree(data);
         return ENOMEM;
@@ -464,6 +541,8 @@ static int ramfs_data_new(mountnode *sb) {
     btree_set_leaf(bnode, &theInvalidInode);
 
     data->inodes_btree = bnode;
+    data->next = ramfs_mounted;
+    ramfs_mounted = data;
 
     sb->sb_data = data;
     return 0;
@@ -474,6 +553,11 @@ static void ramfs_data_free(mountnode *sb) {
 
     btree_free(data->inodes_btree, (btree_leaf_free_f)ramfs_inode_free);
 
+    struct ramfs_data **link = &ramfs_mounted;
+    while (*link != data)
+        link = &(*link)->next;
+    *link = data->next;
+
     kfree(sb->sb_data);
     sb->sb_data = NULL;
 }
@@ -483,7 +567,7 @@ static void ramfs_data_free(mountnode *sb) {
 static int ramfs_inode_new(mountnode *sb, struct inode **iref, mode_t mode) {
     int ret = 0;
     struct ramfs_data *data = sb->sb_data;
-    struct inode *idata = kmalloc(sizeof(struct inode));
+    struct inode *idata = kmem_cache_alloc(ramfs_inode_cache);
     if (!idata) {
         ret = ENOMEM;
         goto error_exit;
@@ -515,7 +599,7 @@ static void ramfs_inode_free(struct inode *idata) {
         ramfs_free_inode_blocks(idata);
         break;
     }
-    kfree(idata);
+    kmem_cache_free(ramfs_inode_cache, idata);
 }
 
 static inode * ramfs_idata_by_inode(mountnode *sb, inode_t ino) {
@@ -836,11 +920,45 @@ static int ramfs_free_inode(mountnode *sb, inode_t ino) {
 }
 
 
+static int ramfs_caches_setup(void) {
+    if (ramfs_inode_cache)
+        return 0;
+
+    btree_node_cache = kmem_cache_create("btree_node",
+            sizeof(struct btree_node) + BTREE_FANOUT * sizeof(void *), NULL);
+    ramfs_directory_cache = kmem_cache_create("ramfs_dir",
+            sizeof(struct ramfs_directory), NULL);
+    ramfs_direntry_cache = kmem_cache_create("ramfs_dirent",
+            sizeof(struct ramfs_direntry), NULL);
+
+    static const char *name_cache_names[RAMFS_NAME_CACHES] = {
+        "ramfs_name16", "ramfs_name32", "ramfs_name64"
+    };
+    int i;
+    for (i = 0; i < RAMFS_NAME_CACHES; ++i) {
+        ramfs_name_cache[i] = kmem_cache_create(name_cache_names[i],
+                RAMFS_NAME_MIN << i, NULL);
+        if (!ramfs_name_cache[i]) return ENOMEM;
+    }
+
+    ramfs_inode_cache = kmem_cache_create("ramfs_inode",
+            sizeof(struct inode), NULL);
+
+    if (!(btree_node_cache && ramfs_directory_cache
+          && ramfs_direntry_cache && ramfs_inode_cache))
+        return ENOMEM;
+
+    return pmem_register_mover(ramfs_evacuate);
+}
+
 static int ramfs_read_superblock(mountnode *sb) {
     const char *funcname = "ramfs_read_superblock";
     logmsgdf("%s()\n", funcname);
     int ret;
 
+    ret = ramfs_caches_setup();
+    if (ret) return ret;
+
     sb->sb_blksz = PAGE_SIZE;
     sb->sb_fs = &ramfs_driver;
 
@@ -944,94 +1062,148 @@ static int ramfs_get_direntry(mountnode *sb, inode_t dirnode, void **iter, struc
 
 /*
  *  ramfs block management
+ *
+ *  Block references are pageframe numbers: blocks come from high memory
+ *  if there is some and are reached through kmap()/kunmap().
  */
-inline static char * ramfs_new_block() {
-    return pmem_alloc(1);
+#define N_INDIRECT_REFS     (PAGE_SIZE / sizeof(off_t))
+
+/* blocks are movable by pmem compaction, see ramfs_evacuate() */
+inline static off_t ramfs_new_block(void) {
+    pfn_t blk = pmem_alloc_frame_zeroed();
+    if (blk)
+        pmem_set_movable(blk, true);
+    return (off_t)blk;
 }
 
-static char * ramfs_block_by_index(struct inode *idata, off_t index) {
+/* the reference `index` in the list of blocks `lst` */
+static off_t ramfs_list_ref(off_t lst, size_t index) {
+    const off_t *refs = kmap(lst);
+    if (!refs) return 0;
+
+    off_t blk = refs[index];
+    kunmap((void *)refs);
+    return blk;
+}
+
+static off_t ramfs_block_by_index(struct inode *idata, off_t index) {
     const char *funcname = __FUNCTION__;
 
     if (index < N_DIRECT_BLOCKS) {
-        return (char *)idata->as.reg.directblock[index];
+        return idata->as.reg.directblock[index];
     }
 
-    const char *ind1blk = (const char *)idata->as.reg.indir1st_block;
-    if (!ind1blk)
-        return NULL;
+    if (!idata->as.reg.indir1st_block)
+        return 0;
 
-    if ((size_t)(index - N_DIRECT_BLOCKS) < PAGE_SIZE/sizeof(off_t)) {
-        return (char *)(size_t)ind1blk[index - N_DIRECT_BLOCKS];
-    }
+    if ((size_t)(index - N_DIRECT_BLOCKS) < N_INDIRECT_REFS)
+        return ramfs_list_ref(idata->as.reg.indir1st_block, index - N_DIRECT_BLOCKS);
 
     logmsgef("%s: index > N_DIRECT_BLOCKS+PAGE_SIZE/sizeof(off_t)", funcname);
-    return NULL;
+    return 0;
 }
 
-static char * ramfs_block_by_index_or_new(struct inode *idata, off_t index) {
+static off_t ramfs_block_by_index_or_new(struct inode *idata, off_t index) {
     const char *funcname = __FUNCTION__;
-    char *blkdata;
-    off_t n_indblocks = PAGE_SIZE/sizeof(off_t);
+    off_t blk;
 
     if (index < N_DIRECT_BLOCKS) {
-        blkdata = (char *)idata->as.reg.directblock[index];
-        if (!blkdata) {
-            blkdata = ramfs_new_block();
-            idata->as.reg.directblock[index] = (off_t)blkdata;
+        blk = idata->as.reg.directblock[index];
+        if (!blk) {
+            blk = ramfs_new_block();
+            if (!blk) return 0;
+            idata->as.reg.directblock[index] = blk;
             ++idata->as.reg.block_count;
 
-            logmsgdf("%s: ino=%d, block %d set to *%x\n",
-                    funcname, idata->i_no, index, (uint)blkdata);
+            logmsgdf("%s: ino=%d, block %d set to #%x\n",
+                    funcname, idata->i_no, index, (uint)blk);
         }
-        return blkdata;
+        return blk;
     }
 
     index -= N_DIRECT_BLOCKS;
-    if (index < n_indblocks) {
-        off_t *ind1blk = (off_t *)idata->as.reg.indir1st_block;
-        if (!ind1blk) {
-            ind1blk = (off_t *)ramfs_new_block();
-            idata->as.reg.indir1st_block = (off_t)ind1blk;
-            logmsgdf("%s: ino=%d, ind1st block set to *%x\n",
-                    funcname, idata->i_no, (uint)ind1blk);
+    if ((size_t)index < N_INDIRECT_REFS) {
+        if (!idata->as.reg.indir1st_block) {
+            idata->as.reg.indir1st_block = ramfs_new_block();
+            if (!idata->as.reg.indir1st_block) return 0;
+            logmsgdf("%s: ino=%d, ind1st block set to #%x\n",
+                    funcname, idata->i_no, (uint)idata->as.reg.indir1st_block);
         }
 
-        blkdata = (char *)ind1blk[ index ];
-        if (!blkdata) {
-            blkdata = ramfs_new_block();
-            ind1blk[ index ] = (off_t)blkdata;
-
-            ++idata->as.reg.block_count;
-            logmsgdf("%s: ino=%d, block %d set to *%x\n", funcname,
-                    idata->i_no, N_DIRECT_BLOCKS + index, (uint)blkdata);
+        off_t *ind1blk = kmap(idata->as.reg.indir1st_block);
+        if (!ind1blk) return 0;
+
+        blk = ind1blk[ index ];
+        if (!blk) {
+            blk = ramfs_new_block();
+            ind1blk[ index ] = blk;
+            if (blk) {
+                ++idata->as.reg.block_count;
+                logmsgdf("%s: ino=%d, block %d set to #%x\n", funcname,
+                        idata->i_no, N_DIRECT_BLOCKS + index, (uint)blk);
+            }
         }
-        return blkdata;
+        kunmap(ind1blk);
+        return blk;
     }
 
     logmsgef("%s: ETODO: who on earth needs the second level of indirection?", funcname);
-    return NULL;
+    return 0;
 }
 
-static void ramfs_free_blocks_in_list(off_t *blklst) {
-    if (!blklst) return;
+/* copies `len` bytes at `offset` of a block, a missing block reads as zeroes */
+static int ramfs_block_read(off_t blk, size_t offset, char *buf, size_t len) {
+    if (!blk) {
+        memset(buf, 0, len);
+        return 0;
+    }
 
-    size_t i;
-    for (i = 0; i < PAGE_SIZE / sizeof(off_t); ++i) {
-        char *blkdata = (char *)(size_t)blklst[i];
-        if (!blkdata) continue;
+    char *blkdata = kmap(blk);
+    if (!blkdata) return EIO;
+
+    memcpy(buf, blkdata + offset, len);
+    kunmap(blkdata);
+    return 0;
+}
+
+static int ramfs_block_write(off_t blk, size_t offset, const char *buf, size_t len) {
+    if (!blk) return EIO;
+
+    char *blkdata = kmap(blk);
+    if (!blkdata) return EIO;
+
+    memcpy(blkdata + offset, buf, len);
+    kunmap(blkdata);
+    return 0;
+}
+
+static void ramfs_free_blocks_in_list(off_t lst) {
+    if (!lst) return;
 
-        pmem_free((uint)blkdata, 1);
+    const off_t *blklst = kmap(lst);
+    if (blklst) {
+        size_t i;
+        for (i = 0; i < N_INDIRECT_REFS; ++i) {
+            if (!blklst[i]) continue;
+
+            pmem_page_unref(blklst[i]);     /* it may be still mapped */
+        }
+        kunmap((void *)blklst);
     }
+    pmem_page_unref(lst);
 }
 
-static void ramfs_free_blocks_2ndlvl(off_t *ind2lst) {
+static void ramfs_free_blocks_2ndlvl(off_t ind2lst) {
     if (!ind2lst) return;
-    size_t i;
 
-    for (i = 0; i < PAGE_SIZE / sizeof(off_t); ++i) {
-        off_t *ind1lst = (off_t *)(size_t)ind2lst[i];
-        ramfs_free_blocks_in_list(ind1lst);
+    const off_t *ind1lsts = kmap(ind2lst);
+    if (ind1lsts) {
+        size_t i;
+        for (i = 0; i < N_INDIRECT_REFS; ++i)
+            ramfs_free_blocks_in_list(ind1lsts[i]);
+        kunmap((void *)ind1lsts);
     }
+    pmem_page_unref(ind2lst);
 }
 
 static void ramfs_free_inode_blocks(struct inode *idata) {
@@ -1039,18 +1211,85 @@ static void ramfs_free_inode_blocks(struct inode *idata) {
     int i;
 
     returnv_log_if(idata->as.reg.indir3rd_block, "%s: TODO: indir3rd_block\n");
-    ramfs_free_blocks_2ndlvl((off_t *)(size_t)idata->as.reg.indir2nd_block);
-    ramfs_free_blocks_in_list((off_t *)(size_t)idata->as.reg.indir1st_block);
+    ramfs_free_blocks_2ndlvl(idata->as.reg.indir2nd_block);
+    ramfs_free_blocks_in_list(idata->as.reg.indir1st_block);
 
     for (i = 0; i < N_DIRECT_BLOCKS; ++i) {
-        uint blkind = (uint)idata->as.reg.directblock[i];
-        if (!blkind) continue;
+        off_t blk = idata->as.reg.directblock[i];
+        if (!blk) continue;
 
-        pmem_free(blkind, 1);
+        pmem_page_unref(blk);   /* it may be still mapped */
     }
 }
 
 
+/*
+ *  Compaction moves the blocks (and indirect blocks) of regular files out
+ *  of [start, end); blocks which are mapped somewhere are not movable.
+ */
+struct ramfs_evacuation {
+    pfn_t start, end;
+};
+
+static void ramfs_evacuate_block(off_t *blkref, struct ramfs_evacuation *ev) {
+    pfn_t blk = (pfn_t)*blkref;
+    if (!blk || (blk < ev->start) || (ev->end <= blk))
+        return;
+
+    pfn_t moved = pmem_migrate(blk);
+    if (moved)
+        *blkref = (off_t)moved;
+}
+
+static void ramfs_evacuate_inode(struct inode *idata, void *arg) {
+    struct ramfs_evacuation *ev = arg;
+    if (!S_ISREG(idata->i_mode))
+        return;
+
+    size_t i;
+    for (i = 0; i < N_DIRECT_BLOCKS; ++i)
+        ramfs_evacuate_block(idata->as.reg.directblock + i, ev);
+
+    if (!idata->as.reg.indir1st_block)
+        return;
+
+    off_t *ind1blk = kmap(idata->as.reg.indir1st_block);
+    if (!ind1blk)
+        return;
+
+    for (i = 0; i < N_INDIRECT_REFS; ++i)
+        ramfs_evacuate_block(ind1blk + i, ev);
+    kunmap(ind1blk);
+    ramfs_evacuate_block(&idata->as.reg.indir1st_block, ev);
+}
+
+static void ramfs_evacuate(pfn_t start, pfn_t end) {
+    struct ramfs_evacuation ev = { .start = start, .end = end };
+    struct ramfs_data *data;
+    for (data = ramfs_mounted; data; data = data->next)
+        btree_foreach_leaf(data->inodes_btree, ramfs_evacuate_inode, &ev);
+}
+
+
+/* file data blocks are pageframes, so they are mapped as they are */
+static int ramfs_inode_page(mountnode *sb, inode_t ino, off_t index, pfn_t *frame) {
+    const char *funcname = __FUNCTION__;
+
+    struct inode *idata = ramfs_idata_by_inode(sb, ino);
+    return_dbg_if(!idata, ENOENT, "%s(ino = %d): ENOENT\n", funcname, ino);
+    return_dbg_if(!S_ISREG(idata->i_mode), ENODEV,
+            "%s(ino = %d): not a regular file\n", funcname, ino);
+
+    if (index * PAGE_SIZE >= idata->i_size)
+        return ENXIO;
+
+    off_t blk = ramfs_block_by_index_or_new(idata, index);
+    if (!blk) return ENOMEM;
+
+    *frame = blk;
+    return 0;
+}
+
 static int ramfs_read_inode(
         mountnode *sb, inode_t ino, off_t pos,
         char *buf, size_t buflen, size_t *written)
@@ -1076,12 +1315,8 @@ static int ramfs_read_inode(
         if ((int)nread > idata->i_size)
             nread = idata->i_size;
 
-        char *blkdata = ramfs_block_by_index(idata, blkindex);
-        if (blkdata) {
-            memcpy(buf, blkdata + offset, nread);
-        } else {
-            memset(buf, 0, nread);
-        }
+        ret = ramfs_block_read(ramfs_block_by_index(idata, blkindex), offset, buf, nread);
+        if (ret) { nread = 0; goto fun_exit; }
 
         ++blkindex;
     }
@@ -1090,12 +1325,9 @@ static int ramfs_read_inode(
            && ((int)(pos + nread + PAGE_SIZE) <= idata->i_size))
     {
         /* copy full blocks while possible */
-        char *blkdata = ramfs_block_by_index(idata, blkindex);
-        if (blkdata) {
-            memcpy(buf + nread, blkdata, PAGE_SIZE);
-        } else {
-            memset(buf + nread, 0, PAGE_SIZE);
-        }
+        ret = ramfs_block_read(ramfs_block_by_index(idata, blkindex), 0, buf + nread, PAGE_SIZE);
+        if (ret) goto fun_exit;
+
         nread += PAGE_SIZE;
         ++blkindex;
     }
@@ -1106,12 +1338,9 @@ static int ramfs_read_inode(
         if ((int)(pos + nread + tocopy) > idata->i_size)
             tocopy = idata->i_size - (pos + nread);
 
-        char *blkdata = ramfs_block_by_index(idata, blkindex);
-        if (blkdata) {
-            memcpy(buf + nread, blkdata, tocopy);
-        } else {
-            memset(buf + nread, 0, tocopy);
-        }
+        ret = ramfs_block_read(ramfs_block_by_index(idata, blkindex), 0, buf + nread, tocopy);
+        if (ret) goto fun_exit;
+
         nread += tocopy;
     }
 
@@ -1136,33 +1365,34 @@ static int ramfs_write_inode(
     size_t offset = pos % PAGE_SIZE;
     if (offset) {
         /* copy initial partial block */
-        char *blkdata = ramfs_block_by_index_or_new(idata, blkindex);
-        if (!blkdata) { ret = EIO; goto fun_exit; }
+        size_t len = PAGE_SIZE - offset;
+        if (len > buflen)
+            len = buflen;
 
-        nwrite = PAGE_SIZE - offset;
-        if (nwrite > buflen)
-            nwrite = buflen;
-        memcpy(blkdata + offset, buf, nwrite);
+        off_t blk = ramfs_block_by_index_or_new(idata, blkindex);
+        ret = ramfs_block_write(blk, offset, buf, len);
+        if (ret) goto fun_exit;
 
+        nwrite = len;
         ++blkindex;
     }
 
     while ((nwrite + PAGE_SIZE) <= buflen) {
         /* copy full blocks while possible */
-        char *blkdata = ramfs_block_by_index_or_new(idata, blkindex);
-        if (!blkdata) { ret = EIO; goto fun_exit; }
+        off_t blk = ramfs_block_by_index_or_new(idata, blkindex);
+        ret = ramfs_block_write(blk, 0, buf + nwrite, PAGE_SIZE);
+        if (ret) goto fun_exit;
 
-        memcpy(blkdata, buf + nwrite, PAGE_SIZE);
         nwrite += PAGE_SIZE;
         ++blkindex;
     }
 
     if (nwrite < buflen) {
         /* copy the partial tail */
-        char *blkdata = ramfs_block_by_index_or_new(idata, blkindex);
-        if (!blkdata) { ret = EIO; goto fun_exit; }
+        off_t blk = ramfs_block_by_index_or_new(idata, blkindex);
+        ret = ramfs_block_write(blk, 0, buf + nwrite, buflen - nwrite);
+        if (ret) goto fun_exit;
 
-        memcpy(blkdata, buf + nwrite, buflen - nwrite);
         nwrite = buflen;
     }
 
@@ -10,6 +10,7 @@
 #include <attrs.h>
 
 #include <dev/screen.h>
+#include <mem/slab.h>
 #include <fs/vfs.h>
 #include <fs/ramfs.h>
 #include <fs/devices.h>
@@ -28,6 +29,8 @@ fsdriver * theFileSystems = NULL;
 
 struct superblock *theRootMnt = NULL;
 
+kmem_cache_t *superblock_cache = NULL;
+
 /* should be inode #0 */
 struct inode theInvalidInode;
 
@@ -208,8 +211,8 @@ int vfs_mount(dev_t source, const char *target, const mount_opts_t *opts) {
         fsdriver *fs = vfs_filesystem_by_id(opts->fs_id);
         if (!fs) return -2;
 
-        struct superblock *sb = kmalloc(sizeof(struct superblock));
-        return_err_if(!sb, -3, "vfs_mount: kmalloc(superblock) failed");
+        struct superblock *sb = kmem_cache_alloc(superblock_cache);
+        return_err_if(!sb, -3, "vfs_mount: kmem_cache_alloc(superblock) failed");
 
         sb->sb_parent = NULL;
         sb->sb_brother = NULL;
@@ -456,6 +459,14 @@ int vfs_inode_trunc(mountnode *sb, inode_t ino, off_t length) {
     return sb->sb_fs->ops->trunc_inode(sb, ino, length);
 }
 
+int vfs_inode_page(mountnode *sb, inode_t ino, off_t index, pfn_t *frame) {
+    const char *funcname = __FUNCTION__;
+
+    return_dbg_if(!sb->sb_fs->ops->inode_page, ENODEV,
+            "%s: no %s.inode_page\n", funcname, sb->sb_fs->name);
+    return sb->sb_fs->ops->inode_page(sb, ino, index, frame);
+}
+
 int vfs_inode_stat(mountnode *sb, inode_t ino, struct stat *stat) {
     const char *funcname = __FUNCTION__;
     int ret;
@@ -629,6 +640,9 @@ static void build_info_file() {
 void vfs_setup(void) {
     int ret;
 
+    superblock_cache = kmem_cache_create("superblock", sizeof(struct superblock), NULL);
+    returnv_err_if(!superblock_cache, "vfs_setup: no superblock cache");
+
     /* register filesystems here */
     vfs_register_filesystem(ramfs_fs_driver());
 
@@ -0,0 +1,136 @@
+/*
+ *      DMA zone
+ *
+ *  The zone is one pmem block taken at boot, a bitmap tracks its pages.
+ *  Allocations are first-fit over aligned positions: rings and buffers are
+ *  few and long-lived, so the zone is scanned rarely.
+ */
+#include <string.h>
+#include <sys/errno.h>
+
+#include <conf.h>
+#include <cosec/log.h>
+
+#include <arch/i386.h>
+#include <mem/pmem.h>
+#include <mem/paging.h>
+#include <mem/dma.h>
+
+#define DMA_ZONE_PAGES      1024    /* 4M, the largest pmem block */
+#define DMA_ZONE_MIN_PAGES  64
+
+static struct {
+    char *  start;
+    size_t  n_pages;
+    size_t  n_used;
+    count_t n_failed;
+    uint32_t used[DMA_ZONE_PAGES / 32];
+} dma;
+
+
+static inline bool dma_page_used(index_t i) {
+    return dma.used[i / 32] & (1u << (i % 32));
+}
+
+static void dma_mark(index_t start, size_t n_pages, bool used) {
+    index_t i;
+    for (i = start; i < start + n_pages; ++i) {
+        if (used) dma.used[i / 32] |= (1u << (i % 32));
+        else      dma.used[i / 32] &= ~(1u << (i % 32));
+    }
+}
+
+/* the first aligned run of `n_pages` free pages or -1 */
+static index_t dma_find(size_t n_pages, size_t align_pages) {
+    /* the zone start is aligned to its size, see dma_setup() */
+    index_t start = 0;
+    while (start + n_pages <= dma.n_pages) {
+        index_t i;
+        for (i = start; i < start + n_pages; ++i)
+            if (dma_page_used(i))
+                break;
+
+        if (i == start + n_pages)
+            return start;
+
+        /* the next aligned position after the used page */
+        start = (i + align_pages) & ~(align_pages - 1);
+    }
+    return -1;
+}
+
+static inline uint dma_lock(void) {
+    uint efl = x86_eflags();
+    intrs_disable();
+    return efl;
+}
+
+static inline void dma_unlock(uint efl) {
+    if (efl & EFLAGS_IF)
+        intrs_enable();
+}
+
+
+/***
+  *     Interface
+ ***/
+
+void * dma_alloc(size_t size, size_t align, ptr_t *paddr) {
+    const char *funcname = __FUNCTION__;
+    size_t n_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    size_t align_pages = (align > PAGE_SIZE ? align / PAGE_SIZE : 1);
+    return_dbg_if(!n_pages || (align & (align - 1)) || (align_pages > dma.n_pages), null,
+                  "%s(%x, %x): invalid request\n", funcname, size, align);
+
+    uint efl = dma_lock();
+    index_t start = dma_find(n_pages, align_pages);
+    if (start == (index_t)-1) {
+        ++dma.n_failed;
+        dma_unlock(efl);
+        logmsgef("%s(%x, %x): the zone is exhausted", funcname, size, align);
+        return null;
+    }
+
+    dma_mark(start, n_pages, true);
+    dma.n_used += n_pages;
+    dma_unlock(efl);
+
+    char *vaddr = dma.start + start * PAGE_SIZE;
+    memset(vaddr, 0, n_pages * PAGE_SIZE);
+    if (paddr)
+        *paddr = (ptr_t)__pa(vaddr);
+    return vaddr;
+}
+
+void dma_free(void *vaddr, size_t size) {
+    const char *funcname = __FUNCTION__;
+    size_t n_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    char *addr = vaddr;
+    returnv_err_if(!((dma.start <= addr) && (addr + n_pages * PAGE_SIZE <= dma.start + dma.n_pages * PAGE_SIZE))
+                   || ((addr - dma.start) % PAGE_SIZE),
+                   "%s(*%x): not in the DMA zone", funcname, (ptr_t)vaddr);
+
+    uint efl = dma_lock();
+    dma_mark((addr - dma.start) / PAGE_SIZE, n_pages, false);
+    dma.n_used -= n_pages;
+    dma_unlock(efl);
+}
+
+void dma_info(void) {
+    logmsgif("dma: zone [%x : %x), %d/%d pages used, %d failed",
+             (ptr_t)__pa(dma.start), (ptr_t)__pa(dma.start + dma.n_pages * PAGE_SIZE),
+             dma.n_used, dma.n_pages, dma.n_failed);
+}
+
+void dma_setup(void) {
+    size_t n_pages = DMA_ZONE_PAGES;
+    while (!(dma.start = pmem_alloc(n_pages))) {
+        n_pages /= 2;
+        if (n_pages < DMA_ZONE_MIN_PAGES) {
+            logmsgef("dma_setup: no contiguous memory for the zone");
+            return;
+        }
+    }
+    dma.n_pages = n_pages;
+    k_printf("dma: %d pages at *%x\n", n_pages, (ptr_t)__pa(dma.start));
+}
@@ -191,7 +191,7 @@ void * firstfit_malloc(struct firstfit_allocator *this, uint size) {
                 memdebugf("ff_malloc: splitting");
 
                 set_chunk(new_chunk, next_chunk, chunk, false);
-                set_chunk(next_chunk, next(next_chunk), new_chunk, true);
+                set_prev(next_chunk, new_chunk);
                 set_chunk(chunk, new_chunk, prev(chunk), true);
             }
 
@@ -218,64 +218,77 @@ void * firstfit_malloc(struct firstfit_allocator *this, uint size) {
     return null;   // no memory
 }
 
+/* splits the free tail off a used chunk if it is large enough, as malloc does */
+static void split_tail(struct firstfit_allocator *this, chunk_t *chunk, size_t size) {
+    uint new_chunk_offset = aligned(size + CHUNK_SIZE) - CHUNK_SIZE;
+    chunk_t *new_chunk = (chunk_t *)((uint)chunk_data(chunk) + new_chunk_offset);
+    chunk_t *next_chunk = next(chunk);
+
+    if (((uint)chunk_data(new_chunk) + 4) > (uint)next_chunk)
+        return;     // no room for a new chunk
+
+    if (!is_used(next_chunk)) {
+        // merge the tail with the next free chunk
+        memdebugf("ff_realloc: merging *%x and next=*%x\n",
+                  (uint)new_chunk, (uint)next_chunk);
+        if (this->current == next_chunk)
+            this->current = new_chunk;
+        chunk_t *nextnext_chunk = next(next_chunk);
+        erase(next_chunk);
+        next_chunk = nextnext_chunk;
+    }
+
+    set_chunk(new_chunk, next_chunk, chunk, false);
+    set_prev(next_chunk, new_chunk);
+    set_next(chunk, new_chunk);
+}
+
 void *firstfit_realloc(struct firstfit_allocator *this, void *p, size_t size) {
     memdebugf("ff_realloc(*%x, 0x%x)\n", (uint)p, size);
     if (!p) return firstfit_malloc(this, size);
-
-    size_t aligned_size = aligned(size);
+    if (size > INT_MAX) return null;
 
     chunk_t *this_chunk = (chunk_t *)((uint)p - CHUNK_SIZE);
+    if (! check_sum(this_chunk)) {
+        try_to_repair(this, this_chunk);
+        return null;
+    }
     size_t this_size = get_size(this_chunk);
 
-    chunk_t *next_chunk = next(this_chunk);
-
-    if (aligned_size < this_size) {
-        memdebugf("ff_realloc: shrinking\n");
+    if (size <= this_size) {
         // shrink
-        if ((aligned_size + sizeof(chunk_t)) >= this_size)
-            return p; // no space for a new chunk
-
-        chunk_t *new_chunk = (chunk_t *)((uint)this_chunk + CHUNK_SIZE + aligned_size);
-        if (!is_used(next_chunk)) {
-            // merge new free space with the next free chunk
-            memdebugf("ff_realloc: merging this=*%x and next=%x\n",
-                      (uint)new_chunk, (uint)next_chunk);
-            if (this->current == next_chunk)
-                this->current = new_chunk;
-            next_chunk = next(next_chunk);
-        }
+        memdebugf("ff_realloc: shrinking\n");
+        split_tail(this, this_chunk, size);
+        debug_heap_info(this);
+        return p;
+    }
 
-        set_next(this_chunk, new_chunk);
-        set_prev(next_chunk, new_chunk);
-        set_chunk(new_chunk, next_chunk, this_chunk, false);
-    } else {
-        // grow
-        memdebugf("ff_realloc: grow\n");
-        if (!is_used(next_chunk)
-            && (get_size(next_chunk) >= (aligned_size - this_size)))
-        {
-            // use the next chunk
-            memdebugf("ff_realloc: use the next chunk, *%x\n", (uint)next_chunk);
-            if (this->current == next_chunk)
-                this->current = next(next_chunk);
-            next_chunk = next(next_chunk);
-            chunk_t *new_chunk = (chunk_t *)((uint)this_chunk + CHUNK_SIZE + aligned_size);
-            set_next(this_chunk, new_chunk);
-            set_prev(next_chunk, new_chunk);
-            set_chunk(new_chunk, next_chunk, this_chunk, false);
-        } else {
-            // relocate
-            memdebugf("ff_realloc: reallocating\n");
-            void *new_p = firstfit_malloc(this, size);
-            memcpy(new_p, p, this_size);
-            firstfit_free(this, p);
-            memdebugf("ff_realloc: reallocated to *%x\n", (uint)new_p);
-            return new_p;
-        }
+    chunk_t *next_chunk = next(this_chunk);
+    if (!is_used(next_chunk)
+        && (this_size + CHUNK_SIZE + get_size(next_chunk) >= size))
+    {
+        // grow into the next free chunk
+        memdebugf("ff_realloc: use the next chunk, *%x\n", (uint)next_chunk);
+        chunk_t *nextnext_chunk = next(next_chunk);
+        if (this->current == next_chunk)
+            this->current = nextnext_chunk;
+        erase(next_chunk);
+        set_next(this_chunk, nextnext_chunk);
+        set_prev(nextnext_chunk, this_chunk);
+
+        split_tail(this, this_chunk, size);
+        debug_heap_info(this);
+        return p;
     }
 
-    debug_heap_info(this);
-    return chunk_data(this_chunk);
+    // relocate
+    memdebugf("ff_realloc: reallocating\n");
+    void *new_p = firstfit_malloc(this, size);
+    if (!new_p) return null;
+    memcpy(new_p, p, this_size);
+    firstfit_free(this, p);
+    memdebugf("ff_realloc: reallocated to *%x\n", (uint)new_p);
+    return new_p;
 }
 
 void firstfit_free(struct firstfit_allocator *this, void *p) {
@@ -1,53 +1,613 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <conf.h>
 #include <cosec/log.h>
+#include <sys/errno.h>
 
 #include <mem/pmem.h>
 #include <mem/kheap.h>
-#include <mem/ff_alloc.h>
+#include <mem/memprof.h>
 
 #include <arch/i386.h>
 
+/***
+  *     Kernel heap: segregated fit allocator
+  *
+  *  Free chunks are kept in size class bins. The first level index is
+  *  the highest bit of the size, the second level splits every first
+  *  level class into KHEAP_SL_COUNT linear classes (sizes below
+  *  KHEAP_SMALL are split linearly). Non-empty bins are tracked by
+  *  bitmaps, so finding a fitting free chunk, inserting and removing one
+  *  are O(1) (TLSF, Masmano et al.).
+  *
+  *  Chunks of an arena know their physical neighbours: the previous one
+  *  by `prev_phys`, the next one by size; kfree() merges a chunk with
+  *  its free neighbours right away. The last chunk of an arena is an
+  *  empty used sentinel which is never merged.
+  *
+  *  Allocations of KHEAP_LARGE bytes and more go to pmem directly.
+  *
+  *  The heap starts with a KHEAP_INITIAL_SIZE arena and grows by
+  *  KHEAP_GROW_SIZE arenas from pmem when no bin fits a request;
+  *  an added arena is given back to pmem as soon as it is entirely free.
+  *
+  *  With KHEAP_DEBUG every chunk header carries a checksum which is
+  *  validated on kfree()/krealloc() and by kheap_check().
+ ***/
+
 #define KHEAP_INITIAL_SIZE  (256 * PAGE_SIZE)
+#define KHEAP_GROW_SIZE     (64 * PAGE_SIZE)
+
+#define KHEAP_ALIGN_LOG2    4
+#define KHEAP_ALIGN         (1 << KHEAP_ALIGN_LOG2)
+
+#define KHEAP_SL_LOG2       4
+#define KHEAP_SL_COUNT      (1 << KHEAP_SL_LOG2)
+#define KHEAP_FL_SHIFT      (KHEAP_SL_LOG2 + KHEAP_ALIGN_LOG2)
+#define KHEAP_FL_COUNT      (32 - KHEAP_FL_SHIFT + 1)
+#define KHEAP_SMALL         (1 << KHEAP_FL_SHIFT)
+
+#define KHEAP_LARGE         (8 * PAGE_SIZE)
+
+#define KHEAP_MAGIC         0x4b484541      /* ASCII "KHEA" */
 
 #if (0)
 #   define mem_logf(msg, ...) logmsgf(msg, __VA_ARGS__)
-#else 
+#else
 #   define mem_logf(msg, ...)
 #endif
 
-struct firstfit_allocator *theHeap;
+typedef struct kheap_chunk  kchunk_t;
+
+struct kheap_chunk {
+    kchunk_t *prev_phys;    /* null for the first chunk in an arena */
+    size_t size;            /* of the chunk data | KCHUNK_* flags */
+    uint checksum;          /* KHEAP_DEBUG: of the header */
+    uint caller;            /* MEM_PROFILING: allocation site */
+
+    /* free chunks only: */
+    kchunk_t *next_free, *prev_free;
+};
+
+/* header size keeps chunk data KHEAP_ALIGN-aligned */
+#define KCHUNK_HDR      \
+    ((offsetof(kchunk_t, next_free) + KHEAP_ALIGN - 1) & ~(KHEAP_ALIGN - 1))
+#define KCHUNK_MIN      KHEAP_ALIGN
+
+#define KCHUNK_USED     0x1
+#define KCHUNK_LARGE    0x2
+#define KCHUNK_FLAGS    (KHEAP_ALIGN - 1)
+
+struct kheap_arena {
+    struct kheap_arena *next, *prev;
+    size_t size;                /* in bytes, including this header */
+    uint flags;
+};
+
+#define KARENA_KEEP     0x1     /* never released to pmem */
+
+#define KARENA_HDR      \
+    ((sizeof(struct kheap_arena) + KHEAP_ALIGN - 1) & ~(KHEAP_ALIGN - 1))
+
+struct kheap {
+    uint32_t fl_bitmap;
+    uint32_t sl_bitmap[KHEAP_FL_COUNT];
+    kchunk_t *bins[KHEAP_FL_COUNT][KHEAP_SL_COUNT];
+
+    struct kheap_arena *arenas;
+
+    /* some statistics */
+    size_t n_malloc;
+    size_t n_free;
+    size_t used_bytes;
+    size_t n_large;
+    size_t large_pages;
+    size_t heap_size;
+    size_t n_grow;
+    size_t n_shrink;
+};
+
+static struct kheap theHeap;
+
+
+static inline size_t kheap_aligned(size_t size) {
+    return (size + KHEAP_ALIGN - 1) & ~(KHEAP_ALIGN - 1);
+}
+
+/* index of the highest set bit */
+static inline uint fls(uint32_t x) {
+    return 31 - __builtin_clz(x);
+}
+
+/* index of the lowest set bit */
+static inline uint ffs32(uint32_t x) {
+    return __builtin_ctz(x);
+}
+
+
+/***
+  *     Chunks
+ ***/
+
+static inline size_t kchunk_size(kchunk_t *c) {
+    return c->size & ~KCHUNK_FLAGS;
+}
+
+static inline bool kchunk_used(kchunk_t *c) {
+    return c->size & KCHUNK_USED;
+}
+
+static inline void *kchunk_data(kchunk_t *c) {
+    return (char *)c + KCHUNK_HDR;
+}
+
+static inline kchunk_t *kchunk_by_data(void *p) {
+    return (kchunk_t *)((char *)p - KCHUNK_HDR);
+}
+
+static inline kchunk_t *kchunk_next(kchunk_t *c) {
+    return (kchunk_t *)((char *)kchunk_data(c) + kchunk_size(c));
+}
+
+static inline uint kchunk_checksum(kchunk_t *c) {
+    return (ptr_t)c ^ c->size ^ (ptr_t)c->prev_phys ^ KHEAP_MAGIC;
+}
+
+/* sets chunk header fields, the only place where they are changed */
+static inline void kchunk_set(kchunk_t *c, kchunk_t *prev_phys, size_t size) {
+    c->prev_phys = prev_phys;
+    c->size = size;
+#if KHEAP_DEBUG
+    c->checksum = kchunk_checksum(c);
+#endif
+}
+
+static inline bool kchunk_valid(kchunk_t *c) {
+#if KHEAP_DEBUG
+    return c->checksum == kchunk_checksum(c);
+#else
+    (void)c;
+    return true;
+#endif
+}
+
+
+/***
+  *     Bins
+ ***/
+
+static inline void kheap_mapping(size_t size, uint *fl, uint *sl) {
+    if (size < KHEAP_SMALL) {
+        *fl = 0;
+        *sl = size / (KHEAP_SMALL / KHEAP_SL_COUNT);
+    } else {
+        uint f = fls(size);
+        *sl = (size >> (f - KHEAP_SL_LOG2)) ^ KHEAP_SL_COUNT;
+        *fl = f - (KHEAP_FL_SHIFT - 1);
+    }
+}
+
+/* a bin where every chunk fits `size` */
+static inline void kheap_mapping_search(size_t size, uint *fl, uint *sl) {
+    if (size >= KHEAP_SMALL)
+        size += (1 << (fls(size) - KHEAP_SL_LOG2)) - 1;
+    kheap_mapping(size, fl, sl);
+}
+
+static void kheap_bin_insert(kchunk_t *c) {
+    uint fl, sl;
+    kheap_mapping(kchunk_size(c), &fl, &sl);
+
+    kchunk_t *head = theHeap.bins[fl][sl];
+    c->prev_free = null;
+    c->next_free = head;
+    if (head) head->prev_free = c;
+    theHeap.bins[fl][sl] = c;
+
+    theHeap.fl_bitmap |= (1u << fl);
+    theHeap.sl_bitmap[fl] |= (1u << sl);
+}
+
+static void kheap_bin_remove(kchunk_t *c) {
+    uint fl, sl;
+    kheap_mapping(kchunk_size(c), &fl, &sl);
+
+    if (c->prev_free)
+        c->prev_free->next_free = c->next_free;
+    else
+        theHeap.bins[fl][sl] = c->next_free;
+    if (c->next_free)
+        c->next_free->prev_free = c->prev_free;
+
+    if (!theHeap.bins[fl][sl]) {
+        theHeap.sl_bitmap[fl] &= ~(1u << sl);
+        if (!theHeap.sl_bitmap[fl])
+            theHeap.fl_bitmap &= ~(1u << fl);
+    }
+}
+
+/* returns a free chunk of at least `size` bytes or null */
+static kchunk_t *kheap_bin_find(size_t size) {
+    uint fl, sl;
+    kheap_mapping_search(size, &fl, &sl);
+    if (fl >= KHEAP_FL_COUNT)
+        return null;
+
+    uint32_t slmap = theHeap.sl_bitmap[fl] & (~0u << sl);
+    if (!slmap) {
+        uint32_t flmap = (fl + 1 < 32 ? theHeap.fl_bitmap & (~0u << (fl + 1)) : 0);
+        if (!flmap)
+            return null;
+        fl = ffs32(flmap);
+        slmap = theHeap.sl_bitmap[fl];
+    }
+    sl = ffs32(slmap);
+    return theHeap.bins[fl][sl];
+}
+
+
+/* makes a free chunk from `size` bytes of `c` tail, if they are enough for a chunk */
+static void kchunk_trim(kchunk_t *c, size_t size) {
+    size_t csize = kchunk_size(c);
+    if (csize < size + KCHUNK_HDR + KCHUNK_MIN)
+        return;
+
+    kchunk_t *next = kchunk_next(c);
+    kchunk_t *rest = (kchunk_t *)((char *)kchunk_data(c) + size);
+    size_t rest_size = csize - size - KCHUNK_HDR;
+
+    kchunk_set(c, c->prev_phys, size | (c->size & KCHUNK_FLAGS));
+
+    if (!kchunk_used(next)) {
+        /* merge the tail with the free next chunk */
+        kheap_bin_remove(next);
+        rest_size += KCHUNK_HDR + kchunk_size(next);
+        next = kchunk_next(next);
+    }
+
+    kchunk_set(rest, c, rest_size);
+    kchunk_set(next, rest, next->size);
+    kheap_bin_insert(rest);
+}
+
+
+/***
+  *     Arenas
+ ***/
+
+static void kheap_add_arena(void *mem, size_t size, uint flags) {
+    struct kheap_arena *arena = mem;
+    arena->size = size;
+    arena->flags = flags;
+    arena->prev = null;
+    arena->next = theHeap.arenas;
+    if (arena->next) arena->next->prev = arena;
+    theHeap.arenas = arena;
+    theHeap.heap_size += size;
+
+    kchunk_t *first = (kchunk_t *)((char *)arena + KARENA_HDR);
+    size_t first_size = (size - KARENA_HDR - 2 * KCHUNK_HDR) & ~KCHUNK_FLAGS;
+
+    kchunk_set(first, null, first_size);
+    kchunk_set(kchunk_next(first), first, 0 | KCHUNK_USED);
+    kheap_bin_insert(first);
+}
+
+static bool kheap_grow(void) {
+    void *mem = pmem_alloc(KHEAP_GROW_SIZE / PAGE_SIZE);
+    if (!mem) return false;
+
+    kheap_add_arena(mem, KHEAP_GROW_SIZE, 0);
+    ++theHeap.n_grow;
+    mem_logf("kheap_grow: arena *%x\n", (uint)mem);
+    return true;
+}
+
+/* releases the arena if `c` is its only (free, not binned) chunk */
+static bool kheap_release_arena(kchunk_t *c) {
+    if (c->prev_phys || kchunk_size(kchunk_next(c)))
+        return false;
+
+    struct kheap_arena *arena = (struct kheap_arena *)((char *)c - KARENA_HDR);
+    if (arena->flags & KARENA_KEEP)
+        return false;
+
+    if (arena->prev)
+        arena->prev->next = arena->next;
+    else
+        theHeap.arenas = arena->next;
+    if (arena->next)
+        arena->next->prev = arena->prev;
+
+    theHeap.heap_size -= arena->size;
+    ++theHeap.n_shrink;
+    mem_logf("kheap: releasing arena *%x\n", (uint)arena);
+    pmem_free(arena, arena->size / PAGE_SIZE);
+    return true;
+}
+
+
+/***
+  *     Large objects
+ ***/
+
+static void *kheap_large_alloc(size_t size) {
+    size_t npages = (size + KCHUNK_HDR + PAGE_SIZE - 1) / PAGE_SIZE;
+    kchunk_t *c = pmem_alloc(npages);
+    if (!c) return null;
+
+    size_t csize = (npages * PAGE_SIZE - KCHUNK_HDR) & ~KCHUNK_FLAGS;
+    kchunk_set(c, null, csize | KCHUNK_USED | KCHUNK_LARGE);
+    ++theHeap.n_large;
+    theHeap.large_pages += npages;
+    return kchunk_data(c);
+}
+
+static void kheap_large_free(kchunk_t *c) {
+    size_t npages = (kchunk_size(c) + KCHUNK_HDR + PAGE_SIZE - 1) / PAGE_SIZE;
+    --theHeap.n_large;
+    theHeap.large_pages -= npages;
+    pmem_free(c, npages);
+}
+
+
+/***
+  *     Interface
+ ***/
 
 void kheap_setup(void) {
-    void *start_heap_addr = pmem_alloc(KHEAP_INITIAL_SIZE / PAGE_SIZE + 1);
+    void *start_heap_addr = pmem_alloc(KHEAP_INITIAL_SIZE / PAGE_SIZE);
     if (0 == start_heap_addr) {
         k_printf("theHeap allocation failed\n");
         return;
     }
 
-    theHeap = firstfit_new(start_heap_addr, KHEAP_INITIAL_SIZE);
+    memset(&theHeap, 0, sizeof(theHeap));
+    kheap_add_arena(start_heap_addr, KHEAP_INITIAL_SIZE, KARENA_KEEP);
     k_printf("theHeap at *%x (until *%x)\n",
-             (ptr_t)theHeap, (ptr_t)theHeap + KHEAP_INITIAL_SIZE);
+             (ptr_t)start_heap_addr, (ptr_t)start_heap_addr + KHEAP_INITIAL_SIZE);
 }
 
-void *kmalloc(size_t size) {
-    void * ptr = firstfit_malloc(theHeap, size);
+static void *kheap_malloc(size_t size) {
+    void *ptr = null;
+    if (size == 0)
+        goto exit;
+
+    if (size >= KHEAP_LARGE) {
+        ptr = kheap_large_alloc(size);
+        goto exit;
+    }
+
+    size = kheap_aligned(size);
+
+    kchunk_t *c = kheap_bin_find(size);
+    if (!c && kheap_grow())
+        c = kheap_bin_find(size);
+    if (!c) goto exit;
+
+    kheap_bin_remove(c);
+    kchunk_set(c, c->prev_phys, c->size | KCHUNK_USED);
+    kchunk_trim(c, size);
+
+    theHeap.used_bytes += kchunk_size(c);
+    ptr = kchunk_data(c);
+
+exit:
+    if (ptr) ++theHeap.n_malloc;
     mem_logf("kmalloc(0x%x) -> *0x%x\n", size, ptr);
     return ptr;
 }
 
-int kfree(void *p) {
+static int kheap_free(void *p) {
+    const char *funcname = "kfree";
     mem_logf("kfree(*0x%x)\n", p);
-    firstfit_free(theHeap, p);
+    if (!p) return 0;
+
+    kchunk_t *c = kchunk_by_data(p);
+    return_err_if(!kchunk_valid(c) || !kchunk_used(c), EINVAL,
+            "%s(*%x): heap corruption or double free\n", funcname, (uint)p);
+
+    ++theHeap.n_free;
+    if (c->size & KCHUNK_LARGE) {
+        kheap_large_free(c);
+        return 0;
+    }
+
+    theHeap.used_bytes -= kchunk_size(c);
+
+    kchunk_t *next = kchunk_next(c);
+    kchunk_t *prev = c->prev_phys;
+    size_t size = kchunk_size(c);
+
+    if (!kchunk_used(next)) {
+        kheap_bin_remove(next);
+        size += KCHUNK_HDR + kchunk_size(next);
+        next = kchunk_next(next);
+    }
+    if (prev && !kchunk_used(prev)) {
+        kheap_bin_remove(prev);
+        size += KCHUNK_HDR + kchunk_size(prev);
+        c = prev;
+    }
+
+    kchunk_set(c, c->prev_phys, size);
+    kchunk_set(next, c, next->size);
+    if (!kheap_release_arena(c))
+        kheap_bin_insert(c);
     return 0;
 }
 
+static void *kheap_realloc(void *p, size_t size) {
+    const char *funcname = "krealloc";
+    if (!p) return kheap_malloc(size);
+
+    kchunk_t *c = kchunk_by_data(p);
+    return_err_if(!kchunk_valid(c) || !kchunk_used(c), null,
+            "%s(*%x): heap corruption\n", funcname, (uint)p);
+
+    size_t csize = kchunk_size(c);
+    size_t need = kheap_aligned(size ? size : 1);
+
+    if (c->size & KCHUNK_LARGE) {
+        if (need <= csize)
+            return p;
+    } else if (need <= csize) {
+        /* shrink */
+        theHeap.used_bytes -= csize;
+        kchunk_trim(c, need);
+        theHeap.used_bytes += kchunk_size(c);
+        return p;
+    } else if (need < KHEAP_LARGE) {
+        /* grow into the free next chunk */
+        kchunk_t *next = kchunk_next(c);
+        if (!kchunk_used(next) && (csize + KCHUNK_HDR + kchunk_size(next) >= need)) {
+            kheap_bin_remove(next);
+            kchunk_t *nextnext = kchunk_next(next);
+            kchunk_set(c, c->prev_phys, (csize + KCHUNK_HDR + kchunk_size(next)) | KCHUNK_USED);
+            kchunk_set(nextnext, c, nextnext->size);
+            kchunk_trim(c, need);
+
+            theHeap.used_bytes += kchunk_size(c) - csize;
+            return p;
+        }
+    }
+
+    /* relocate */
+    void *newp = kheap_malloc(size);
+    if (!newp) return null;
+    memcpy(newp, p, (csize < size ? csize : size));
+    kheap_free(p);
+    return newp;
+}
+
+#if MEM_PROFILING
+
+void *kmalloc(size_t size) {
+    uint64_t ts0, ts1;
+    i386_rdtsc(&ts0);
+    void *p = kheap_malloc(size);
+    i386_rdtsc(&ts1);
+
+    if (p) {
+        kchunk_t *c = kchunk_by_data(p);
+        c->caller = (ptr_t)__builtin_return_address(0);
+        memprof_alloc(MEMPROF_KMALLOC, c->caller, kchunk_size(c), ts1 - ts0);
+    }
+    return p;
+}
+
+int kfree(void *p) {
+    uint64_t ts0, ts1;
+    kchunk_t *c = kchunk_by_data(p);
+    ptr_t caller = 0;
+    size_t size = 0;
+    if (p && kchunk_valid(c) && kchunk_used(c)) {
+        caller = c->caller;
+        size = kchunk_size(c);
+    }
+
+    i386_rdtsc(&ts0);
+    int ret = kheap_free(p);
+    i386_rdtsc(&ts1);
+
+    if (p && !ret)
+        memprof_free(MEMPROF_KMALLOC, caller, size, ts1 - ts0);
+    return ret;
+}
+
 void *krealloc(void *p, size_t size) {
-    return firstfit_realloc(theHeap, p, size);
+    uint64_t ts0, ts1;
+    kchunk_t *c = kchunk_by_data(p);
+    ptr_t caller = 0;
+    size_t oldsize = 0;
+    if (p && kchunk_valid(c) && kchunk_used(c)) {
+        caller = c->caller;
+        oldsize = kchunk_size(c);
+    }
+
+    i386_rdtsc(&ts0);
+    void *newp = kheap_realloc(p, size);
+    i386_rdtsc(&ts1);
+    if (!newp) return newp;
+
+    if (p)
+        memprof_free(MEMPROF_KMALLOC, caller, oldsize, 0);
+    c = kchunk_by_data(newp);
+    c->caller = (ptr_t)__builtin_return_address(0);
+    memprof_alloc(MEMPROF_KMALLOC, c->caller, kchunk_size(c), ts1 - ts0);
+    return newp;
 }
 
+#else
+
+void *kmalloc(size_t size) {
+    return kheap_malloc(size);
+}
+
+int kfree(void *p) {
+    return kheap_free(p);
+}
+
+void *krealloc(void *p, size_t size) {
+    return kheap_realloc(p, size);
+}
+
+#endif // MEM_PROFILING
+
 void kheap_info(void) {
-    heap_info(theHeap);
+    size_t free_bytes = 0;
+    size_t largest_free = 0;
+    size_t n_chunks = 0;
+    size_t n_arenas = 0;
+
+    struct kheap_arena *arena;
+    for (arena = theHeap.arenas; arena; arena = arena->next) {
+        ++n_arenas;
+
+        kchunk_t *c = (kchunk_t *)((char *)arena + KARENA_HDR);
+        for (; kchunk_size(c); c = kchunk_next(c)) {
+            ++n_chunks;
+            if (kchunk_used(c)) continue;
+
+            free_bytes += kchunk_size(c);
+            if (largest_free < kchunk_size(c))
+                largest_free = kchunk_size(c);
+        }
+    }
+
+    logmsgif("heap: %d arenas, 0x%x bytes, %d chunks", n_arenas, theHeap.heap_size, n_chunks);
+    logmsgif("heap: grown %d times, shrunk %d times", theHeap.n_grow, theHeap.n_shrink);
+    logmsgif("%d mallocs, %d frees", theHeap.n_malloc, theHeap.n_free);
+    logmsgif("heap.used_space = 0x%x", theHeap.used_bytes);
+    logmsgif("heap.free_space = 0x%x", free_bytes);
+    logmsgif("heap.meta_space = 0x%x", n_chunks * KCHUNK_HDR);
+    logmsgif("heap.largest_free = 0x%x", largest_free);
+    logmsgif("heap.large: %d objects, %d pages", theHeap.n_large, theHeap.large_pages);
 }
 
 void * kheap_check(void) {
-    return firstfit_corruption(theHeap);
+    struct kheap_arena *arena;
+    for (arena = theHeap.arenas; arena; arena = arena->next) {
+        kchunk_t *prev = null;
+        kchunk_t *c = (kchunk_t *)((char *)arena + KARENA_HDR);
+        char *arena_end = (char *)arena + arena->size;
+
+        while (true) {
+            if ((char *)c + KCHUNK_HDR > arena_end)
+                return prev;
+            if (!kchunk_valid(c) || (c->prev_phys != prev))
+                return c;
+            if (!kchunk_size(c))
+                break;      /* the sentinel */
+            if (prev && !kchunk_used(prev) && !kchunk_used(c))
+                return c;   /* must have been merged */
+
+            prev = c;
+            c = kchunk_next(c);
+        }
+    }
+    return null;
 }
@@ -0,0 +1,104 @@
+/*
+ *      Temporary mappings
+ *
+ *  The kmap window is one page table, shared by all page directories like
+ *  the kernel stacks window. Free slots are linked in a list; a slot is
+ *  mapped with a global entry, kunmap() invalidates it on the way out.
+ */
+#include <string.h>
+#include <sys/errno.h>
+
+#include <conf.h>
+#include <cosec/log.h>
+
+#include <arch/i386.h>
+#include <mem/pmem.h>
+#include <mem/paging.h>
+#include <mem/kmap.h>
+
+#define KMAP_NONE       ((uint16_t)-1)
+
+static struct {
+    pte_t *pagetable;
+
+    uint16_t next[KMAP_SLOTS];      /* in the free list */
+    uint16_t free;
+
+    count_t n_used, n_max;
+    count_t n_maps, n_failed;
+} kmaps;
+
+
+static inline uint kmap_lock(void) {
+    uint efl = x86_eflags();
+    intrs_disable();
+    return efl;
+}
+
+static inline void kmap_unlock(uint efl) {
+    if (efl & EFLAGS_IF)
+        intrs_enable();
+}
+
+
+/***
+  *     Interface
+ ***/
+
+void * kmap(pfn_t pfn) {
+    if (pfn < page_pfn(paging_directmap_end()))
+        return __va((ptr_t)pfn_paddr(pfn));
+
+    uint efl = kmap_lock();
+    index_t slot = kmaps.free;
+    if (slot == KMAP_NONE) {
+        ++kmaps.n_failed;
+        kmap_unlock(efl);
+        logmsgef("kmap(#%x): no free slots", (uint)pfn);
+        return null;
+    }
+    kmaps.free = kmaps.next[slot];
+    if (++kmaps.n_used > kmaps.n_max)
+        kmaps.n_max = kmaps.n_used;
+    ++kmaps.n_maps;
+    kmap_unlock(efl);
+
+    kmaps.pagetable[slot] = pfn_paddr(pfn) | PG_PRESENT | PG_RW | PG_GLOBL | paging_nx();
+    return (void *)(KERN_KMAP_START + slot * PAGE_SIZE);
+}
+
+void kunmap(void *vaddr) {
+    ptr_t addr = (ptr_t)vaddr & PG31_12_MASK;
+    if (!((KERN_KMAP_START <= addr) && (addr < KERN_KMAP_END)))
+        return;     /* the direct map */
+
+    index_t slot = (addr - KERN_KMAP_START) / PAGE_SIZE;
+    kmaps.pagetable[slot] = 0;
+    i386_invlpg(addr);
+
+    uint efl = kmap_lock();
+    kmaps.next[slot] = kmaps.free;
+    kmaps.free = slot;
+    --kmaps.n_used;
+    kmap_unlock(efl);
+}
+
+void kmap_info(void) {
+    logmsgif("kmap: %d/%d slots in use (at most %d), %d mappings, %d failed",
+             kmaps.n_used, KMAP_SLOTS, kmaps.n_max, kmaps.n_maps, kmaps.n_failed);
+}
+
+void kmap_setup(void) {
+    kmaps.pagetable = pmem_alloc_zeroed(1);
+    if (!kmaps.pagetable)
+        panic("kmap_setup: no page table");
+
+    /* page directories copy this entry from thePageDirectory */
+    thePageDirectory[pde_index(KERN_KMAP_START)] =
+            (ptr_t)kmaps.pagetable | PG_PRESENT | PG_RW;
+
+    index_t i;
+    for (i = 0; i < KMAP_SLOTS; ++i)
+        kmaps.next[i] = (i + 1 < KMAP_SLOTS ? i + 1 : KMAP_NONE);
+    kmaps.free = 0;
+}
@@ -0,0 +1,198 @@
+/*
+ *      Kernel stacks
+ *
+ *  The stacks window is split into KSTACK_SLOT_SIZE slots, only the upper
+ *  KSTACK_SIZE of a slot is ever mapped. The window has its own page tables
+ *  which are shared by all page directories, so a stack is mapped once.
+ *  A slot is either fresh (never used), in use, pooled (mapped and free)
+ *  or unused (unmapped and free); the pool has at most KSTACK_POOL_MAX stacks.
+ */
+#include <string.h>
+#include <sys/errno.h>
+
+#include <conf.h>
+#include <cosec/log.h>
+
+#include <arch/i386.h>
+#include <mem/pmem.h>
+#include <mem/paging.h>
+#include <mem/kstack.h>
+
+#define KSTACK_SLOTS        ((KERN_KSTACKS_END - KERN_KSTACKS_START) / KSTACK_SLOT_SIZE)
+#define KSTACK_POOL_MAX     32
+
+#define KSTACK_NONE         ((uint16_t)-1)
+
+enum kstack_state {
+    KS_FRESH = 0,
+    KS_USED,
+    KS_POOLED,
+    KS_UNUSED,
+};
+
+static struct {
+    pte_t *pagetables;      /* of the whole window */
+
+    uint8_t  state[KSTACK_SLOTS];
+    uint16_t next[KSTACK_SLOTS];    /* in the pooled/unused lists */
+
+    uint16_t pooled;
+    uint16_t unused;
+    index_t  n_fresh;       /* slots below it have been used */
+
+    count_t n_used, n_pooled;
+    count_t n_reused;
+} kstacks;
+
+
+static inline ptr_t kstack_slot_addr(index_t slot) {
+    return KERN_KSTACKS_START + slot * KSTACK_SLOT_SIZE + (KSTACK_SLOT_SIZE - KSTACK_SIZE);
+}
+
+static inline pte_t * kstack_pte(ptr_t vaddr) {
+    return kstacks.pagetables + ((vaddr - KERN_KSTACKS_START) >> PTE_SHIFT);
+}
+
+static inline uint kstack_lock(void) {
+    uint efl = x86_eflags();
+    intrs_disable();
+    return efl;
+}
+
+static inline void kstack_unlock(uint efl) {
+    if (efl & EFLAGS_IF)
+        intrs_enable();
+}
+
+static void kstack_unmap(index_t slot) {
+    ptr_t addr = kstack_slot_addr(slot);
+    index_t i;
+    for (i = 0; i < KSTACK_PAGES; ++i, addr += PAGE_SIZE) {
+        pte_t *pte = kstack_pte(addr);
+        if (!(*pte & PG_PRESENT))
+            continue;
+
+        pmem_free((void *)(ptr_t)(*pte & PG31_12_MASK), 1);
+        *pte = 0;
+        i386_invlpg(addr);
+    }
+}
+
+static err_t kstack_map(index_t slot) {
+    ptr_t addr = kstack_slot_addr(slot);
+    index_t i;
+    for (i = 0; i < KSTACK_PAGES; ++i, addr += PAGE_SIZE) {
+        void *page = pmem_alloc(1);
+        if (!page) {
+            kstack_unmap(slot);
+            return ENOMEM;
+        }
+        *kstack_pte(addr) = (ptr_t)page | PG_PRESENT | PG_RW | PG_GLOBL | paging_nx();
+    }
+    return 0;
+}
+
+
+/***
+  *     Interface
+ ***/
+
+void * kstack_alloc(void) {
+    index_t slot;
+    uint efl = kstack_lock();
+
+    if (kstacks.pooled != KSTACK_NONE) {
+        slot = kstacks.pooled;
+        kstacks.pooled = kstacks.next[slot];
+        --kstacks.n_pooled;
+        ++kstacks.n_reused;
+    } else {
+        if (kstacks.unused != KSTACK_NONE) {
+            slot = kstacks.unused;
+            kstacks.unused = kstacks.next[slot];
+        } else if (kstacks.n_fresh < KSTACK_SLOTS) {
+            slot = kstacks.n_fresh++;
+        } else {
+            kstack_unlock(efl);
+            logmsgef("kstack_alloc: no free slots");
+            return null;
+        }
+
+        if (kstack_map(slot)) {
+            kstacks.state[slot] = KS_UNUSED;
+            kstacks.next[slot] = kstacks.unused;
+            kstacks.unused = slot;
+            kstack_unlock(efl);
+            return null;
+        }
+    }
+
+    kstacks.state[slot] = KS_USED;
+    ++kstacks.n_used;
+    kstack_unlock(efl);
+    return (void *)kstack_slot_addr(slot);
+}
+
+void kstack_free(void *stack) {
+    const char *funcname = __FUNCTION__;
+    ptr_t addr = (ptr_t)stack;
+    index_t slot = (addr - KERN_KSTACKS_START) / KSTACK_SLOT_SIZE;
+    returnv_err_if(!((KERN_KSTACKS_START <= addr) && (addr < KERN_KSTACKS_END))
+                   || (addr != kstack_slot_addr(slot)),
+                   "%s(*%x): not a kernel stack", funcname, addr);
+
+    uint efl = kstack_lock();
+    if (kstacks.state[slot] != KS_USED) {
+        kstack_unlock(efl);
+        logmsgef("%s(*%x): the stack is free", funcname, addr);
+        return;
+    }
+    --kstacks.n_used;
+
+    if (kstacks.n_pooled < KSTACK_POOL_MAX) {
+        kstacks.state[slot] = KS_POOLED;
+        kstacks.next[slot] = kstacks.pooled;
+        kstacks.pooled = slot;
+        ++kstacks.n_pooled;
+    } else {
+        kstack_unmap(slot);
+        kstacks.state[slot] = KS_UNUSED;
+        kstacks.next[slot] = kstacks.unused;
+        kstacks.unused = slot;
+    }
+    kstack_unlock(efl);
+}
+
+void * kstack_guard_hit(ptr_t addr) {
+    if (!((KERN_KSTACKS_START <= addr) && (addr < KERN_KSTACKS_END)))
+        return null;
+
+    index_t slot = (addr - KERN_KSTACKS_START) / KSTACK_SLOT_SIZE;
+    ptr_t stack = kstack_slot_addr(slot);
+    if ((addr >= stack) || (kstacks.state[slot] != KS_USED))
+        return null;
+    return (void *)stack;
+}
+
+void kstack_info(void) {
+    logmsgif("kstack: %d in use, %d pooled, %d reused, %d/%d slots touched",
+             kstacks.n_used, kstacks.n_pooled, kstacks.n_reused,
+             kstacks.n_fresh, KSTACK_SLOTS);
+}
+
+void kstack_setup(void) {
+    const size_t n_tables = pde_index(KERN_KSTACKS_END) - pde_index(KERN_KSTACKS_START);
+
+    kstacks.pagetables = pmem_alloc_zeroed(n_tables);
+    if (!kstacks.pagetables)
+        panic("kstack_setup: no page tables");
+
+    /* page directories copy these entries from thePageDirectory */
+    index_t i;
+    for (i = 0; i < n_tables; ++i) {
+        ptr_t pagetable = (ptr_t)(kstacks.pagetables + i * PTE_PER_ENTRY);
+        thePageDirectory[pde_index(KERN_KSTACKS_START) + i] = pagetable | PG_PRESENT | PG_RW;
+    }
+
+    kstacks.pooled = kstacks.unused = KSTACK_NONE;
+}
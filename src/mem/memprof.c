@@ -0,0 +1,199 @@
+/*
+ *      Allocation profiler
+ *
+ *  Statistics are kept per call site in a fixed open addressing table
+ *  (the allocators must not allocate to profile themselves); sites which
+ *  do not fit the table are accounted to a single "other" entry.
+ *  Callers are resolved to kernel functions via the multiboot ELF symbols.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <conf.h>
+#include <cosec/log.h>
+
+#include <arch/i386.h>
+#include <arch/mboot.h>
+#include <misc/elf.h>
+#include <mem/memprof.h>
+
+#define MEMPROF_SITES       256
+#define MEMPROF_HIST        32      /* log2 size classes */
+
+struct memprof_site {
+    ptr_t caller;               /* 0 if the entry is empty */
+    enum memprof_kind kind;
+    count_t n_alloc;
+    count_t n_free;
+    size_t total_bytes;
+    size_t live_bytes;
+    uint64_t cycles;            /* spent in allocations */
+};
+
+struct memprof_stat {
+    count_t n_alloc;
+    count_t n_free;
+    size_t live_bytes;
+    uint64_t alloc_cycles;
+    uint64_t free_cycles;
+    uint64_t max_cycles;
+    count_t hist[MEMPROF_HIST];
+};
+
+static struct memprof_site memprof_sites[MEMPROF_SITES];
+static struct memprof_site memprof_other;
+static struct memprof_stat memprof_stats[MEMPROF_KINDS];
+
+static const char *memprof_kind_name[MEMPROF_KINDS] = {
+    [MEMPROF_KMALLOC] = "kmalloc",
+    [MEMPROF_PMEM] = "pmem",
+};
+
+
+static struct memprof_site *memprof_site(enum memprof_kind kind, ptr_t caller) {
+    index_t i = ((caller * 2654435761u) ^ kind) % MEMPROF_SITES;
+    size_t probe;
+    for (probe = 0; probe < MEMPROF_SITES; ++probe) {
+        struct memprof_site *site = memprof_sites + i;
+        if ((site->caller == caller) && (site->kind == kind))
+            return site;
+        if (!site->caller) {
+            site->caller = caller;
+            site->kind = kind;
+            return site;
+        }
+        i = (i + 1) % MEMPROF_SITES;
+    }
+    return &memprof_other;
+}
+
+static inline uint memprof_avg(uint64_t cycles, count_t n) {
+    if (!n) return 0;
+    i386_div64(&cycles, n);
+    return (uint)cycles;
+}
+
+static inline uint memprof_hist_index(size_t size) {
+    uint i = 0;
+    while ((i + 1 < MEMPROF_HIST) && ((size_t)1 << (i + 1)) <= size)
+        ++i;
+    return i;
+}
+
+void memprof_alloc(enum memprof_kind kind, ptr_t caller, size_t size, uint64_t cycles) {
+    struct memprof_stat *stat = memprof_stats + kind;
+    ++stat->n_alloc;
+    stat->live_bytes += size;
+    stat->alloc_cycles += cycles;
+    if (stat->max_cycles < cycles)
+        stat->max_cycles = cycles;
+    ++stat->hist[memprof_hist_index(size)];
+
+    struct memprof_site *site = memprof_site(kind, caller);
+    ++site->n_alloc;
+    site->total_bytes += size;
+    site->live_bytes += size;
+    site->cycles += cycles;
+}
+
+void memprof_free(enum memprof_kind kind, ptr_t caller, size_t size, uint64_t cycles) {
+    struct memprof_stat *stat = memprof_stats + kind;
+    ++stat->n_free;
+    stat->live_bytes -= size;
+    stat->free_cycles += cycles;
+
+    if (!caller) return;
+
+    struct memprof_site *site = memprof_site(kind, caller);
+    ++site->n_free;
+    site->live_bytes -= size;
+}
+
+void memprof_reset(void) {
+    memset(memprof_sites, 0, sizeof(memprof_sites));
+    memset(&memprof_other, 0, sizeof(memprof_other));
+    memset(memprof_stats, 0, sizeof(memprof_stats));
+}
+
+
+static const char *memprof_symbol(ptr_t addr, ptr_t *offset) {
+    static Elf32_Sym *symtab = null;
+    static size_t n_syms = 0;
+    static const char *strtab = null;
+
+    if (!symtab) {
+        elf_section_header_table_t *mboot_syms = mboot_kernel_shdr();
+        if (!mboot_syms) return null;
+
+        Elf32_Shdr *shdrs = (Elf32_Shdr *)mboot_syms->addr;
+        Elf32_Shdr *symsect = elf_section_by_name(shdrs, mboot_syms->num, ".symtab");
+        Elf32_Shdr *strsect = elf_section_by_name(shdrs, mboot_syms->num, ".strtab");
+        if (!(symsect && strsect)) return null;
+
+        symtab = (Elf32_Sym *)symsect->sh_addr;
+        n_syms = symsect->sh_size / sizeof(Elf32_Sym);
+        strtab = (const char *)strsect->sh_addr;
+    }
+    return elf_symbol_by_addr(symtab, n_syms, strtab, addr, offset);
+}
+
+static void memprof_print_site(struct memprof_site *site) {
+    ptr_t offset = 0;
+    const char *sym = (site->caller ? memprof_symbol(site->caller, &offset) : "<other>");
+    uint avg = memprof_avg(site->cycles, site->n_alloc);
+
+    if (sym)
+        logmsgif("%s\t%s+0x%x\tlive=0x%x total=0x%x n=%d/%d cycles/op=%d",
+                 memprof_kind_name[site->kind], sym, offset,
+                 site->live_bytes, site->total_bytes, site->n_alloc, site->n_free, avg);
+    else
+        logmsgif("%s\t*%x\tlive=0x%x total=0x%x n=%d/%d cycles/op=%d",
+                 memprof_kind_name[site->kind], site->caller,
+                 site->live_bytes, site->total_bytes, site->n_alloc, site->n_free, avg);
+}
+
+void memprof_report(size_t top_n) {
+#if !MEM_PROFILING
+    logmsgif("memprof: build with MEM_PROFILING in conf.h");
+#endif
+    int kind;
+    for (kind = 0; kind < MEMPROF_KINDS; ++kind) {
+        struct memprof_stat *stat = memprof_stats + kind;
+        logmsgif("%s: %d allocs, %d frees, live=0x%x, cycles/alloc=%d, cycles/free=%d, max=%d",
+                 memprof_kind_name[kind], stat->n_alloc, stat->n_free, stat->live_bytes,
+                 memprof_avg(stat->alloc_cycles, stat->n_alloc),
+                 memprof_avg(stat->free_cycles, stat->n_free),
+                 (uint)stat->max_cycles);
+
+        int i;
+        for (i = 0; i < MEMPROF_HIST; ++i)
+            if (stat->hist[i])
+                logmsgf("  [%x..%x): %d\n", 1 << i, 2 << i, stat->hist[i]);
+    }
+
+    /* top_n selection by live bytes, then by total bytes */
+    bool shown[MEMPROF_SITES] = { false };
+    size_t n;
+    for (n = 0; n < top_n; ++n) {
+        index_t i, top = MEMPROF_SITES;
+        for (i = 0; i < MEMPROF_SITES; ++i) {
+            struct memprof_site *site = memprof_sites + i;
+            if (!site->caller || shown[i]) continue;
+            if (top == MEMPROF_SITES) { top = i; continue; }
+
+            struct memprof_site *best = memprof_sites + top;
+            if ((site->live_bytes > best->live_bytes)
+                || ((site->live_bytes == best->live_bytes)
+                    && (site->total_bytes > best->total_bytes)))
+                top = i;
+        }
+        if (top == MEMPROF_SITES) break;
+
+        shown[top] = true;
+        memprof_print_site(memprof_sites + top);
+    }
+
+    if (memprof_other.n_alloc)
+        memprof_print_site(&memprof_other);
+}
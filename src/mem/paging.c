@@ -1,36 +1,313 @@
+/*
+ *      Page tables
+ *
+ *  The kernel maps physical memory 1:1 with large (2M) global pages, so
+ *  pmem pointers are valid in every address space and kernel mappings
+ *  never need TLB shootdowns. Page directories share these entries,
+ *  the user part is mapped with 4K pages; page tables are allocated
+ *  from pmem on demand.
+ *  The direct map is sized from the multiboot memory map, up to
+ *  KERN_DIRECTMAP_END; memory above it is high memory.
+ *  Paging is PAE: entries are 64-bit and carry the execute-disable bit,
+ *  only the kernel text is executable in the direct map.
+ */
 #include <stdint.h>
 #include <string.h>
+#include <sys/errno.h>
 
 #include <mem/paging.h>
+#include <mem/pmem.h>
+#include <mem/vmem.h>
+#include <mem/kstack.h>
 #include <arch/i386.h>
+#include <arch/mboot.h>
+#include <process.h>
 
 #define __DEBUG
 #include <cosec/log.h>
 
+#define CPUID_PSE       (1 << 3)
+#define CPUID_PAE       (1 << 6)
+#define CPUID_PGE       (1 << 13)
+
+#define CPUID_EXT_MAX   0x80000000
+#define CPUID_EXT       0x80000001
+#define CPUID_EXT_NX    (1 << 20)
+
+#define MSR_EFER        0xC0000080
+#define EFER_NXE        (1 << 11)
+
+/* pages of a process page directory: the PDPT and 3 page directories */
+#define PAGEDIR_PAGES   N_PDPTE
+
+extern char _start, _etext, _end;
+
 pde_t thePageDirectory[N_PDE] __attribute__((aligned (PAGE_SIZE)));
+static pdpte_t thePDPT[N_PDPTE] __attribute__((aligned (32)));
 
-void pg_fault(void) {
-    logmsgf("\n#PF\n");
+static pde_t *current_pagedir = thePageDirectory;
+
+static struct {
+    uint pde_global;        /* PG_GLOBL if supported */
+    pte_t nx;               /* PG_NX if supported */
+    ptr_t directmap_end;    /* the end of the direct map, <= KERN_DIRECTMAP_END */
+    count_t n_pagedirs;
+    count_t n_pagetables;
+} paging;
 
+
+void pg_fault(void) {
     ptr_t fault_addr;
     asm volatile ("movl %%cr2, %0   \n" : "=r"(fault_addr) );
 
     err_t fault_error = intr_err_code();
+
+    /* not-present pages of valid areas are allocated lazily */
+    process *proc = current_proc();
+    if (proc && !vmspace_fault(&proc->ps_vm, fault_addr, fault_error))
+        return;
+
+    logmsgf("\n#PF\n");
     ptr_t context = intr_context_esp();
 
     uint* op_addr = (uint *)(context + CONTEXT_SIZE + sizeof(uint));
 
+    void *stack = kstack_guard_hit(fault_addr);
+    if (stack)
+        logmsgef("Kernel stack overflow: *%x is below the stack [%x : %x)",
+                 fault_addr, (ptr_t)stack, (ptr_t)stack + KSTACK_SIZE);
+
+    if (fault_error & PGF_INSTR)
+        logmsgef("Instruction fetch from a non-executable page");
+    if (fault_error & PGF_RSVD)
+        logmsgef("Reserved bits are set in a paging entry");
+
     logmsgef("Fault 0x%x from %x:%x accessing *%x\n",
              fault_error, op_addr[1], op_addr[0], fault_addr);
 
     cpu_hang();
 }
 
+
+/***
+  *     Address spaces
+ ***/
+
+static inline bool is_user_addr(ptr_t vaddr) {
+    return (USER_START <= vaddr) && (vaddr < USER_END);
+}
+
+pte_t paging_nx(void) {
+    return paging.nx;
+}
+
+ptr_t paging_directmap_end(void) {
+    return paging.directmap_end;
+}
+
+/* the direct map page directory is shared, see pagedir_new() */
+static inline pde_t * pagedir_pde(pde_t *pagedir, ptr_t vaddr) {
+    if (vaddr < KERN_DIRECTMAP_END)
+        pagedir = thePageDirectory;
+    return pagedir + pde_index(vaddr);
+}
+
+pde_t * pagedir_new(void) {
+    pde_t *pagedir = pmem_alloc(PAGEDIR_PAGES);
+    if (!pagedir) return null;
+
+    const index_t first = pde_index(KERN_DIRECTMAP_END);
+    memcpy(pagedir + first, thePageDirectory + first, (N_PDE - first) * sizeof(pde_t));
+    memset(pagedir + pde_index(USER_START), 0,
+           (pde_index(USER_END) - pde_index(USER_START)) * sizeof(pde_t));
+
+    /* the page of the direct map page directory holds the PDPT */
+    pdpte_t *pdpt = (pdpte_t *)pagedir;
+    memset(pdpt, 0, PAGE_SIZE);
+    pdpt[0] = (ptr_t)__pa(thePageDirectory) | PG_PRESENT;
+
+    index_t i;
+    for (i = 1; i < N_PDPTE; ++i)
+        pdpt[i] = (ptr_t)__pa(pagedir + i * PTE_PER_ENTRY) | PG_PRESENT;
+
+    ++paging.n_pagedirs;
+    return pagedir;
+}
+
+void pagedir_free(pde_t *pagedir) {
+    const char *funcname = __FUNCTION__;
+    returnv_err_if(pagedir == thePageDirectory, "%s: the kernel page directory", funcname);
+    returnv_err_if(pagedir == current_pagedir, "%s: the page directory is in use", funcname);
+
+    index_t i;
+    for (i = pde_index(USER_START); i < pde_index(USER_END); ++i) {
+        pde_t pde = pagedir[i];
+        if (!(pde & PG_PRESENT) || (pde & PG_GRAN))
+            continue;
+
+        pmem_free((void *)(ptr_t)(pde & PG31_12_MASK), 1);
+        --paging.n_pagetables;
+    }
+
+    pmem_free(pagedir, PAGEDIR_PAGES);
+    --paging.n_pagedirs;
+}
+
+pte_t * pagedir_pte(pde_t *pagedir, ptr_t vaddr, bool alloc) {
+    pde_t *pde = pagedir_pde(pagedir, vaddr);
+    if (*pde & PG_GRAN)
+        return null;
+
+    if (!(*pde & PG_PRESENT)) {
+        if (!alloc) return null;
+
+        pte_t *pagetable = pmem_alloc_zeroed(1);
+        if (!pagetable) return null;
+
+        ++paging.n_pagetables;
+
+        /* access rights are checked per page */
+        *pde = (ptr_t)pagetable | PG_PRESENT | PG_RW | PG_USR_READ;
+    }
+
+    pte_t *pagetable = (pte_t *)(ptr_t)(*pde & PG31_12_MASK);
+    return pagetable + pte_index(vaddr);
+}
+
+err_t pagedir_map(pde_t *pagedir, ptr_t vaddr, pfn_t pfn, pte_t flags) {
+    if (!is_user_addr(vaddr))
+        return EINVAL;
+
+    pte_t *pte = pagedir_pte(pagedir, vaddr, true);
+    if (!pte) return ENOMEM;
+
+    bool was_present = *pte & PG_PRESENT;
+    *pte = pfn_paddr(pfn) | (flags & PG_FLAGS_MASK) | PG_PRESENT;
+
+    if (was_present && (pagedir == current_pagedir))
+        i386_invlpg(vaddr);
+    return 0;
+}
+
+pfn_t pagedir_unmap(pde_t *pagedir, ptr_t vaddr) {
+    if (!is_user_addr(vaddr))
+        return 0;
+
+    pte_t *pte = pagedir_pte(pagedir, vaddr, false);
+    if (!(pte && (*pte & PG_PRESENT)))
+        return 0;
+
+    pfn_t pfn = pte_pfn(*pte);
+    *pte = 0;
+
+    if (pagedir == current_pagedir)
+        i386_invlpg(vaddr);
+    return pfn;
+}
+
+void pagedir_switch(pde_t *pagedir) {
+    if (pagedir == current_pagedir)
+        return;
+
+    current_pagedir = pagedir;
+    i386_switch_pagedir((void *)pagedir_cr3(pagedir));
+}
+
+pde_t * pagedir_current(void) {
+    return current_pagedir;
+}
+
+ptr_t pagedir_cr3(pde_t *pagedir) {
+    if (pagedir == thePageDirectory)
+        return (ptr_t)__pa(thePDPT);
+    return (ptr_t)__pa(pagedir);
+}
+
+
+/***
+  *     Setup
+ ***/
+
+/* the end of usable memory below KERN_DIRECTMAP_END, in large pages */
+static ptr_t paging_memory_end(void) {
+    struct memory_map *mapping = (struct memory_map *)mboot_mmap_addr();
+    size_t mmap_len = mboot_mmap_length();
+    uint64_t mem_end = 0;
+
+    size_t i;
+    for (i = 0; i < mmap_len; ++i) {
+        struct memory_map *m = mapping + i;
+        if (m->type != 1) continue;     /* the BIOS areas below 4G are not memory */
+
+        uint64_t base = ((uint64_t)m->base_addr_high << 32) + m->base_addr_low;
+        uint64_t end = base + ((uint64_t)m->length_high << 32) + m->length_low;
+        if (mem_end < end)
+            mem_end = end;
+    }
+
+    /* the kernel itself must be mapped even without a memory map */
+    if (mem_end < (ptr_t)&_end)
+        mem_end = (ptr_t)&_end;
+    if (mem_end > KERN_DIRECTMAP_END)
+        mem_end = KERN_DIRECTMAP_END;
+    return (ptr_t)(mem_end + LARGE_PAGE_SIZE - 1) & PG31_21_MASK;
+}
+
 void paging_setup(void) {
-    void * phy_pagedir = __pa(&thePageDirectory);
-    // prepare thePageDirectory
-    memcpy(thePageDirectory, (void *)INITIAL_PGDIR, N_PDE * sizeof(pde_t));
-    // switch
-    k_printf("switching page directory to *0x%x\n", phy_pagedir);
-    i386_switch_pagedir(phy_pagedir);
+    uint32_t cpu_info[3];
+    i386_cpuid_info(cpu_info, 1);
+    uint features = cpu_info[1];    /* %edx */
+
+    if (!(features & CPUID_PAE))
+        panic("paging_setup: no PAE support");
+
+    uint cr4_flags = CR4_PAE;
+    if (features & CPUID_PGE) {
+        paging.pde_global = PG_GLOBL;
+        cr4_flags |= CR4_PGE;
+    }
+
+    if (i386_cpuid_info(cpu_info, CPUID_EXT_MAX) >= CPUID_EXT) {
+        i386_cpuid_info(cpu_info, CPUID_EXT);
+        if (cpu_info[1] & CPUID_EXT_NX) {
+            uint32_t lo, hi;
+            i386_rdmsr(MSR_EFER, lo, hi);
+            i386_wrmsr(MSR_EFER, lo | EFER_NXE, hi);
+            paging.nx = PG_NX;
+        }
+    }
+
+    memset(thePageDirectory, 0, sizeof(thePageDirectory));
+
+    /* physical memory, only the kernel text is executable */
+    paging.directmap_end = paging_memory_end();
+    ptr_t text_start = (ptr_t)&_start & PG31_21_MASK;
+    ptr_t text_end = (ptr_t)&_etext;
+    index_t i;
+    for (i = 0; i < pde_index(paging.directmap_end); ++i) {
+        ptr_t addr = i << PDE_SHIFT;
+        pde_t nx = ((text_start <= addr) && (addr < text_end)) ? 0 : paging.nx;
+        thePageDirectory[i] = addr | PG_PRESENT | PG_RW | PG_GRAN | paging.pde_global | nx;
+    }
+
+    /* device memory */
+    for (i = pde_index(KERN_MMIO_START); i < N_PDE; ++i)
+        thePageDirectory[i] = (i << PDE_SHIFT) | paging.nx
+                | PG_PRESENT | PG_RW | PG_GRAN | PG_PCD | PG_PWT | paging.pde_global;
+
+    for (i = 0; i < N_PDPTE; ++i)
+        thePDPT[i] = (ptr_t)__pa(thePageDirectory + i * PTE_PER_ENTRY) | PG_PRESENT;
+
+    i386_enable_paging(__pa(thePDPT), cr4_flags);
+    k_printf("paging: PAE, %d Mb mapped by 2M pages%s%s\n", paging.directmap_end >> 20,
+             (paging.pde_global ? ", global" : ""), (paging.nx ? ", NX" : ""));
+}
+
+void paging_info(void) {
+    logmsgif("paging: kernel page directory at *%x, current at *%x (cr3=%x)%s",
+             (ptr_t)thePageDirectory, (ptr_t)current_pagedir,
+             pagedir_cr3(current_pagedir), (paging.nx ? ", NX" : ""));
+    logmsgif("paging: direct map [0 : %x)", paging.directmap_end);
+    logmsgif("paging: user space [%x : %x), %d page directories, %d page tables",
+             USER_START, USER_END, paging.n_pagedirs, paging.n_pagetables);
 }
@@ -0,0 +1,244 @@
+/*
+ *      Page cache
+ *
+ *  Cached pages are hashed by (owner, inode, index) and linked in a ring
+ *  swept by the CLOCK hand: a page used since the last sweep gets a second
+ *  chance, a page in use is skipped. New pages are inserted behind the hand
+ *  unreferenced, so pages read once leave before the ones read again.
+ *  Page data are PF_CACHE pageframes taken with pmem_cache_alloc(), high
+ *  memory first; a page is mapped with kmap() while it is in use. The cache
+ *  grows with high memory, which nothing else needs as much.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+
+#include <conf.h>
+#include <cosec/log.h>
+
+#include <mem/pmem.h>
+#include <mem/kmap.h>
+#include <mem/slab.h>
+#include <mem/pcache.h>
+
+#define PCACHE_BUCKETS      256
+#define PCACHE_MAX_PAGES    2048    /* 8M, and a half of high memory */
+
+struct pcache_page {
+    void *      pc_owner;
+    inode_t     pc_ino;
+    off_t       pc_index;
+    pfn_t       pc_frame;
+    char *      pc_data;                    /* mapped while in use */
+
+    struct pcache_page *pc_hnext;           /* in the hash chain */
+    struct pcache_page *pc_next, *pc_prev;  /* in the CLOCK ring */
+
+    count_t     pc_users;
+    bool        pc_referenced;
+    bool        pc_stale;                   /* forgotten while in use */
+};
+
+static struct {
+    pcache_page_t *buckets[PCACHE_BUCKETS];
+    pcache_page_t *hand;
+    size_t n_pages;
+    size_t max_pages;
+
+    count_t hits, misses, evictions;
+} pcache;
+
+static kmem_cache_t *pcache_page_cache = null;
+
+
+static inline index_t pcache_hash(void *owner, inode_t ino, off_t index) {
+    uint h = ((ptr_t)owner * 2654435761u) ^ (ino * 40503u) ^ (uint)index;
+    return (h ^ (h >> 16)) % PCACHE_BUCKETS;
+}
+
+/* the link pointing to the page or the null link at the end of its chain */
+static pcache_page_t **pcache_slot(void *owner, inode_t ino, off_t index) {
+    pcache_page_t **slot = pcache.buckets + pcache_hash(owner, ino, index);
+    while (*slot) {
+        pcache_page_t *pg = *slot;
+        if ((pg->pc_owner == owner) && (pg->pc_ino == ino) && (pg->pc_index == index))
+            break;
+        slot = &pg->pc_hnext;
+    }
+    return slot;
+}
+
+static void pcache_ring_insert(pcache_page_t *pg) {
+    pcache_page_t *hand = pcache.hand;
+    if (!hand) {
+        pg->pc_next = pg->pc_prev = pg;
+        pcache.hand = pg;
+    } else {
+        pg->pc_next = hand;
+        pg->pc_prev = hand->pc_prev;
+        hand->pc_prev->pc_next = pg;
+        hand->pc_prev = pg;
+    }
+    ++pcache.n_pages;
+}
+
+static void pcache_ring_remove(pcache_page_t *pg) {
+    if (pg->pc_next == pg) {
+        pcache.hand = null;
+    } else {
+        pg->pc_prev->pc_next = pg->pc_next;
+        pg->pc_next->pc_prev = pg->pc_prev;
+        if (pcache.hand == pg)
+            pcache.hand = pg->pc_next;
+    }
+    --pcache.n_pages;
+}
+
+/* the page must be out of the hash and not in use */
+static void pcache_release(pcache_page_t *pg) {
+    pcache_ring_remove(pg);
+    pmem_cache_free(pg->pc_frame);
+    kmem_cache_free(pcache_page_cache, pg);
+}
+
+/* unhashes the page at `slot`, releases it now or by the last pcache_put() */
+static void pcache_drop(pcache_page_t **slot) {
+    pcache_page_t *pg = *slot;
+    *slot = pg->pc_hnext;
+    pg->pc_hnext = null;
+
+    if (pg->pc_users)
+        pg->pc_stale = true;
+    else
+        pcache_release(pg);
+}
+
+
+/***
+  *     Interface
+ ***/
+
+pcache_page_t * pcache_get(void *owner, inode_t ino, off_t index, pcache_fill_f fill) {
+    pcache_page_t *pg = *pcache_slot(owner, ino, index);
+    if (pg) {
+        ++pcache.hits;
+        pg->pc_referenced = true;
+    } else {
+        ++pcache.misses;
+        if (pcache.n_pages >= pcache.max_pages)
+            pcache_shrink(1);
+
+        pg = kmem_cache_alloc(pcache_page_cache);
+        if (!pg) return null;
+
+        pg->pc_frame = pmem_cache_alloc();
+        if (!pg->pc_frame && pcache_shrink(1))
+            pg->pc_frame = pmem_cache_alloc();
+        if (!pg->pc_frame) {
+            kmem_cache_free(pcache_page_cache, pg);
+            return null;
+        }
+
+        pg->pc_data = kmap(pg->pc_frame);
+        if (!pg->pc_data || fill(owner, ino, index, pg->pc_data)) {
+            kunmap(pg->pc_data);
+            pmem_cache_free(pg->pc_frame);
+            kmem_cache_free(pcache_page_cache, pg);
+            return null;
+        }
+
+        pmem_cache_use(pg->pc_frame, true);
+        pg->pc_owner = owner;
+        pg->pc_ino = ino;
+        pg->pc_index = index;
+        pg->pc_users = 0;
+        pg->pc_referenced = false;
+        pg->pc_stale = false;
+
+        pcache_page_t **bucket = pcache.buckets + pcache_hash(owner, ino, index);
+        pg->pc_hnext = *bucket;
+        *bucket = pg;
+        pcache_ring_insert(pg);
+    }
+
+    if (!pg->pc_data) {
+        pg->pc_data = kmap(pg->pc_frame);
+        if (!pg->pc_data) return null;
+        pmem_cache_use(pg->pc_frame, true);
+    }
+    ++pg->pc_users;
+    return pg;
+}
+
+void pcache_put(pcache_page_t *pg) {
+    if (--pg->pc_users)
+        return;
+
+    kunmap(pg->pc_data);
+    pg->pc_data = null;
+    pmem_cache_use(pg->pc_frame, false);
+    if (pg->pc_stale)
+        pcache_release(pg);
+}
+
+char * pcache_data(pcache_page_t *pg) {
+    return pg->pc_data;
+}
+
+void pcache_forget(void *owner, inode_t ino, off_t index) {
+    pcache_page_t **slot = pcache_slot(owner, ino, index);
+    if (*slot)
+        pcache_drop(slot);
+}
+
+void pcache_forget_inode(void *owner, inode_t ino) {
+    index_t i;
+    for (i = 0; i < PCACHE_BUCKETS; ++i) {
+        pcache_page_t **slot = pcache.buckets + i;
+        while (*slot) {
+            pcache_page_t *pg = *slot;
+            if ((pg->pc_owner == owner) && (pg->pc_ino == ino))
+                pcache_drop(slot);
+            else
+                slot = &pg->pc_hnext;
+        }
+    }
+}
+
+size_t pcache_shrink(size_t n_pages) {
+    size_t evicted = 0;
+    size_t scan = 2 * pcache.n_pages;   /* enough for every second chance */
+
+    while ((evicted < n_pages) && pcache.hand && scan--) {
+        pcache_page_t *pg = pcache.hand;
+        pcache.hand = pg->pc_next;
+
+        if (pg->pc_users)
+            continue;
+        if (pg->pc_referenced) {
+            pg->pc_referenced = false;
+            continue;
+        }
+
+        pcache_drop(pcache_slot(pg->pc_owner, pg->pc_ino, pg->pc_index));
+        ++evicted;
+    }
+
+    pcache.evictions += evicted;
+    return evicted;
+}
+
+void pcache_info(void) {
+    logmsgif("pcache: %d/%d pages, %d hits, %d misses, %d evictions",
+             pcache.n_pages, pcache.max_pages,
+             pcache.hits, pcache.misses, pcache.evictions);
+}
+
+void pcache_setup(void) {
+    pcache_page_cache = kmem_cache_create("pcache_page", sizeof(pcache_page_t), null);
+    if (!pcache_page_cache)
+        panic("pcache_setup: no pcache_page cache");
+
+    pcache.max_pages = PCACHE_MAX_PAGES + pmem_highmem_frames() / 2;
+    pmem_register_shrinker("pcache", pcache_shrink);
+}
@@ -5,11 +5,19 @@
  *   This is reflected in the_pageframe_map, which resides right after
  * the kernel code: it is array of page_frame structures with
  * length n_pages;
+ *   The map covers high memory too, see the zones below.
  */
 #include <mem/pmem.h>
 
 #include <mem/kheap.h>
+#include <mem/memprof.h>
 #include <mem/paging.h>
+#include <mem/kmap.h>
+#include <mem/vmem.h>
+#include <mem/pcache.h>
+#include <mem/slab.h>
+#include <mem/kstack.h>
+#include <mem/dma.h>
 
 #include <arch/i386.h>
 #include <arch/mboot.h>
@@ -52,100 +60,86 @@ static inline index_t page_aligned_back(ptr_t addr) {
 #define PF_USED         1
 #define PF_CACHE        2
 #define PF_RESERVED     3
-// flags:3 : is this cache used right now
+#define PF_TYPE_MASK    0x3
+// flags:3 : is this cache used right now (pinned by a page cache user)
 #define CACHE_IN_USE    0x4
-
+// flags:4 : this free pageframe heads a buddy block
+#define PF_BUDDY        0x8
+// flags:5 : this used pageframe may be moved by its owner, see pmem_migrate()
+#define PF_MOVABLE      0x10
+// flags:8..15 : order of the buddy block if PF_BUDDY
+#define PF_ORDER_SHIFT  8
+#define PF_ORDER_MASK   0xff00
+
+/* 12 bytes per pageframe: 3 Mb of map for 4 Gb of memory */
 typedef struct pageframe {
-   uint flags;                      //
-   struct pageframe *next, *prev;   // in the pageframe group (reserved/free/cache/used)
-   void *owner;                     // virtual memory manager/cache manager
-   index_t vm_offset;               // index in vma
+   uint16_t flags;                  //
+   uint16_t count;                  // references to the pageframe besides the first one
+   index_t next, prev;              // in the pageframe group (free area of some order/cache)
+#if MEM_PROFILING
+   ptr_t site;                      // the allocation site, 0 if not profiled
+#endif
 } pageframe_t;
 
+/* end of list mark for pageframe indices */
+#define PF_NONE     ((index_t)-1)
+
 
 /***
   *     Page lists
  ***/
 
 typedef struct pagelist {
-    pageframe_t *head;
+    index_t head;
     size_t count;
     uint flag;
 } pagelist_t;
 
+// the global pageframe table:
+pageframe_t *the_pageframe_map = null;
+size_t      pfmap_len = 0;      // in pageframe_t
 
-#define PF_LIST_INSERT(list, frame) do {\
-    (list)->head->prev->next = (frame); \
-    (frame)->next = (list)->head;       \
-    (frame)->prev = (list)->head->prev; \
-    (list)->head->prev = (frame);   \
-    (list)->count++;                \
-    } while (0)
+#define PF(index)   (the_pageframe_map + (index))
 
-inline static void pf_list_insert(pagelist_t *list, pageframe_t *pf) {
-    list->head->prev->next = pf;
-    pf->next = list->head;
-    pf->prev = list->head->prev;
+inline static void pf_list_insert(pagelist_t *list, index_t pfi) {
+    pageframe_t *pf = PF(pfi);
     pf->flags = list->flag;
-    list->head->prev = pf;
     list->count++;
+    if (list->head == PF_NONE) {
+        list->head = pfi;
+        pf->next = pf->prev = pfi;
+        return;
+    }
+    pageframe_t *head = PF(list->head);
+    PF(head->prev)->next = pfi;
+    pf->next = list->head;
+    pf->prev = head->prev;
+    head->prev = pfi;
 }
 
-#define PF_LIST_REMOVE(list, node) do { \
-    if ((list)->head == (node))         \
-        if ((node)->next != (node)) {   \
-            (node)->next->prev = (node)->prev;  \
-            (node)->prev->next = (node)->next;  \
-            (list)->head = (node)->next;        \
-        } else panic("Removing the last node"); \
-    else {  \
-        (node)->prev->next = (node)->next;    \
-        (node)->next->prev = (node)->prev;    \
-    }; \
-    (list)->count--; } while (0)
-
-inline static void pf_list_remove(pagelist_t *list, pageframe_t *node) {
-    if (list->head == node)
-        if (node->next != node) {
-            node->next->prev = node->prev;
-            node->prev->next = node->next;
-            list->head = node->next;
-        }
-        else panic("Removing the last node");
-    else {
-        node->prev->next = node->next;
-        node->next->prev = node->prev;
-    };
+/* removing the last node leaves the list empty */
+inline static void pf_list_remove(pagelist_t *list, index_t pfi) {
+    pageframe_t *node = PF(pfi);
+    if (list->head == pfi)
+        list->head = (node->next != pfi) ? node->next : PF_NONE;
+    PF(node->next)->prev = node->prev;
+    PF(node->prev)->next = node->next;
+    node->next = node->prev = PF_NONE;
     list->count--;
 }
 
-#define PF_LIST_INIT(list, node) \
-    do {   \
-     (list)->head = (node); \
-     (list)->count = 1;     \
-     (node)->next = (node); \
-     (node)->prev = (node); \
-    } while (0)
-
-inline static void pf_list_init(pagelist_t *list, pageframe_t *node, uint flag) {
-     list->head = node;
+inline static void pf_list_init(pagelist_t *list, index_t pfi, uint flag) {
+     pageframe_t *node = PF(pfi);
+     list->head = pfi;
      list->count = 1;
      list->flag = flag;
-     node->next = node;
-     node->prev = node;
+     node->next = pfi;
+     node->prev = pfi;
      node->flags = flag;
 }
 
 
-
-// the global pageframe table:
-pageframe_t *the_pageframe_map = null;
-size_t      pfmap_len = 0;      // in pageframe_t
-
-pagelist_t free_pageframes;
-pagelist_t used_pageframes;
 pagelist_t cache_pageframes;
-pagelist_t reserved_pageframes;
 
 
 inline static index_t pageframe_index(pageframe_t *pf) {
@@ -156,98 +150,380 @@ void * pageframe_addr(pageframe_t *pf) {
     return (void *)(PAGE_SIZE * pageframe_index(pf));
 }
 
+
+/***
+  *     Buddy allocator
+  *
+  *  Free pageframes are kept in blocks of 2^order pages aligned by their
+  *  size, free_area[order] lists the heads of such blocks. Only the head of
+  *  a free block is marked PF_BUDDY and knows the block order, the rest of
+  *  the block pageframes are just PF_FREE.
+  *  Allocation takes the smallest sufficient block and splits it, freeing
+  *  merges a block with its buddy (the other half of the enclosing block)
+  *  while the buddy is a free block of the same order.
+ ***/
+
+#define PMEM_MAX_ORDER  11      /* the largest block is 2^10 pages (4 Mb) */
+
+/* free pageframes watermarks of the normal zone, see pmem_reclaim() */
+#define PMEM_WMARK_MIN      64      /* reclaim right away */
+#define PMEM_WMARK_LOW      256     /* reclaim when idle */
+#define PMEM_WMARK_HIGH     512     /* reclaim up to */
+
+/***
+  *     Zones
+  *
+  *  The normal zone is the direct map: pmem_alloc() pointers and everything
+  *  the kernel addresses directly come from it. The high zone is the rest of
+  *  memory, its pageframes are handed out by number and reached through
+  *  kmap(). Each zone has its own free areas; the boundary is aligned to
+  *  the largest block, so buddies never cross it.
+ ***/
+
+struct pmem_zone {
+    const char *name;
+    index_t start, end;
+    pagelist_t free_area[PMEM_MAX_ORDER];
+    size_t n_free;
+};
+
+static struct pmem_zone normal_zone = { .name = "normal" };
+static struct pmem_zone high_zone = { .name = "high" };
+
+size_t n_used_pageframes = 0;
+
+static inline struct pmem_zone * pf_zone(index_t pfi) {
+    return (pfi < normal_zone.end ? &normal_zone : &high_zone);
+}
+
+static inline bool pf_is_buddy(index_t pfi, uint order) {
+    return (PF(pfi)->flags & (PF_TYPE_MASK | PF_BUDDY | PF_ORDER_MASK))
+            == (PF_FREE | PF_BUDDY | (order << PF_ORDER_SHIFT));
+}
+
+static void buddy_free_range(index_t start, index_t end);
+static inline void pf_mark_range(index_t start, index_t end, uint flags);
+
+/* smallest order such that (1 << order) >= count */
+static inline uint pages_order(size_t count) {
+    uint order = 0;
+    while ((1u << order) < count) ++order;
+    return order;
+}
+
+static void buddy_push(index_t pfi, uint order) {
+    struct pmem_zone *zone = pf_zone(pfi);
+    pf_list_insert(zone->free_area + order, pfi);
+    PF(pfi)->flags = PF_FREE | PF_BUDDY | (order << PF_ORDER_SHIFT);
+    zone->n_free += (1 << order);
+}
+
+static void buddy_remove(index_t pfi, uint order) {
+    struct pmem_zone *zone = pf_zone(pfi);
+    pf_list_remove(zone->free_area + order, pfi);
+    PF(pfi)->flags = PF_FREE;
+    zone->n_free -= (1 << order);
+}
+
+/* takes a block of `pages_count` pageframes from the zone, PF_NONE if there is none */
+static index_t buddy_alloc(struct pmem_zone *zone, size_t pages_count) {
+    uint order = pages_order(pages_count);
+    uint o = order;
+    while ((o < PMEM_MAX_ORDER) && (zone->free_area[o].count == 0))
+        ++o;
+    if (o >= PMEM_MAX_ORDER)
+        return PF_NONE;
+
+    index_t pfi = zone->free_area[o].head;
+    buddy_remove(pfi, o);
+
+    /* split the block down to the requested order */
+    while (o > order) {
+        --o;
+        buddy_push(pfi + (1 << o), o);
+    }
+
+    pf_mark_range(pfi, pfi + pages_count, PF_USED);
+    n_used_pageframes += pages_count;
+#if MEM_PROFILING
+    index_t i;
+    for (i = pfi; i < pfi + pages_count; ++i)
+        PF(i)->site = 0;
+#endif
+
+    /* return the tail of a block if pages_count is not a power of 2 */
+    buddy_free_range(pfi + pages_count, pfi + (1 << order));
+    return pfi;
+}
+
+/* frees a block, merging it with its buddies */
+static void buddy_free_block(index_t pfi, uint order) {
+    while (order + 1 < PMEM_MAX_ORDER) {
+        index_t buddy = pfi ^ (1 << order);
+        if (buddy + (1 << order) > pfmap_len)
+            break;
+
+        if (!pf_is_buddy(buddy, order))
+            break;
+
+        buddy_remove(buddy, order);
+        pfi &= ~(1 << order);
+        ++order;
+    }
+    buddy_push(pfi, order);
+}
+
+/* frees [start, end) as a sequence of the largest possible aligned blocks */
+static void buddy_free_range(index_t start, index_t end) {
+    while (start < end) {
+        uint order = 0;
+        while ((order + 1 < PMEM_MAX_ORDER)
+               && !(start & ((2u << order) - 1))
+               && (start + (2u << order) <= end))
+            ++order;
+
+        buddy_free_block(start, order);
+        start += (1 << order);
+    }
+}
+
+static inline void pf_mark_range(index_t start, index_t end, uint flags) {
+    index_t i;
+    for (i = start; i < end; ++i)
+        PF(i)->flags = flags;
+}
+
+/* takes free pageframes [start, end) out of free blocks, marks them `flags` */
+static err_t buddy_take_range(index_t start, index_t end, uint flags) {
+    index_t i = start;
+    while (i < end) {
+        /* find the free block containing the i-th pageframe */
+        uint order;
+        index_t head = i;
+        for (order = 0; order < PMEM_MAX_ORDER; ++order) {
+            head = i & ~((1 << order) - 1);
+            if (pf_is_buddy(head, order))
+                break;
+        }
+        if (order == PMEM_MAX_ORDER)
+            return EINVAL;
+
+        index_t block_end = head + (1 << order);
+        index_t take_end = (block_end < end ? block_end : end);
+
+        buddy_remove(head, order);
+        pf_mark_range(i, take_end, flags);
+
+        /* return the rest of the block */
+        buddy_free_range(head, i);
+        buddy_free_range(take_end, block_end);
+
+        i = take_end;
+    }
+    return 0;
+}
+
 static void mark_used(void *p1, void *p2) {
     index_t pft1 = page_aligned_back((ptr_t)p1);
     index_t pft2 = page_aligned((ptr_t)p2);
-    index_t i;
-    for (i = pft1; i < pft2; ++i) {
-        pageframe_t *pf = the_pageframe_map + i;
-        if (pf->flags != PF_FREE) {
-            logmsgef("pmem_init: trying to mark page #%x as used, its flags are %d\n",
-                    i, pf->flags);
-            return;
-        }
 
-        pf_list_remove(&free_pageframes, pf);
-        pf_list_insert(&used_pageframes, pf);
+    if (buddy_take_range(pft1, pft2, PF_USED)) {
+        logmsgef("pmem_init: trying to mark pages [%x : %x) as used, some of them are not free\n",
+                pft1, pft2);
+        return;
     }
+    n_used_pageframes += pft2 - pft1;
 }
 
-void pmem_setup(void) {
-    index_t i;
+
+/***
+  *     Setup
+ ***/
+
+/* usable memory ranges from the multiboot memory map, in pageframes */
+#define PMEM_MAX_RANGES     32
+
+struct pmem_range {
+    index_t start, end;
+};
+
+static struct pmem_range usable_mem[PMEM_MAX_RANGES];
+static size_t n_usable_mem = 0;
+
+/* usable memory out of the pageframe map */
+static uint64_t pmem_unmanaged = 0;
+
+/* rdtsc cycles spent in pmem_setup() */
+static uint64_t pmem_setup_cycles = 0;
+
+#if PAGING
+# define PMEM_LOWMEM_END    ((uint64_t)paging_directmap_end())
+# define PMEM_LIMIT         (1ull << 36)    /* PAE physical addresses */
+#else
+# define PMEM_LOWMEM_END    0x100000000ull
+# define PMEM_LIMIT         0x100000000ull
+#endif
+
+/* the pageframe map takes at most this part of the normal zone */
+#define PMEM_MAP_SHARE      8
+
+/* collects sorted and merged usable memory ranges below PMEM_LIMIT */
+static void pmem_read_mmap(void) {
     struct memory_map *mapping = (struct memory_map *)mboot_mmap_addr();
     size_t mmap_len = mboot_mmap_length();
-    ptr_t pfmap = (ptr_t)&_end;
+    size_t i, j;
 
-    /// determine pfmap_len
     for (i = 0; i < mmap_len; ++i) {
         struct memory_map *m = mapping + i;
-        index_t map_end = page_aligned(m->base_addr_low + m->length_low);
-        if ((m->type == 1) && (map_end > pfmap_len))  pfmap_len = map_end;
+        if (m->type != 1) continue;
+
+        uint64_t base = ((uint64_t)m->base_addr_high << 32) + m->base_addr_low;
+        uint64_t end = base + ((uint64_t)m->length_high << 32) + m->length_low;
+        if (end > PMEM_LIMIT) {
+            pmem_unmanaged += end - (base > PMEM_LIMIT ? base : PMEM_LIMIT);
+            end = PMEM_LIMIT;
+        }
+        if (base >= end) continue;
+
+        struct pmem_range r;
+        r.start = (index_t)((base + PAGE_SIZE - 1) >> PAGE_SHIFT);
+        r.end = (index_t)(end >> PAGE_SHIFT);
+        if (r.start >= r.end) continue;
+
+        if (n_usable_mem == PMEM_MAX_RANGES) {
+            logmsgef("pmem_setup: too many memory ranges, ignoring [%x : %x)\n",
+                     r.start, r.end);
+            continue;
+        }
+
+        /* insertion sort by start */
+        j = n_usable_mem++;
+        while (j && usable_mem[j - 1].start > r.start) {
+            usable_mem[j] = usable_mem[j - 1];
+            --j;
+        }
+        usable_mem[j] = r;
+    }
+
+    /* merge overlapping ranges */
+    for (i = 0, j = 0; i < n_usable_mem; ++i) {
+        if (j && (usable_mem[i].start <= usable_mem[j - 1].end)) {
+            if (usable_mem[j - 1].end < usable_mem[i].end)
+                usable_mem[j - 1].end = usable_mem[i].end;
+        } else
+            usable_mem[j++] = usable_mem[i];
+    }
+    n_usable_mem = j;
+}
+
+/* leaves usable memory above pageframe `limit` out of the map */
+static void pmem_trim_mmap(index_t limit) {
+    while (n_usable_mem) {
+        struct pmem_range *r = usable_mem + n_usable_mem - 1;
+        if (r->end <= limit)
+            break;
+
+        index_t start = (r->start > limit ? r->start : limit);
+        pmem_unmanaged += pfn_paddr(r->end - start);
+        r->end = start;
+        if (r->start == r->end)
+            --n_usable_mem;
+    }
+}
+
+/* finds a place for the pageframe map in the normal zone after the kernel and modules */
+static ptr_t pmem_place_pfmap(ptr_t after, size_t size) {
+    size_t i;
+    for (i = 0; i < n_usable_mem; ++i) {
+        if (usable_mem[i].start >= normal_zone.end)
+            break;
+        index_t last = (usable_mem[i].end < normal_zone.end ? usable_mem[i].end : normal_zone.end);
+        ptr_t start = PAGE_SIZE * usable_mem[i].start;
+        ptr_t end = PAGE_SIZE * last;
+        if (start < after)
+            start = PAGE_SIZE * page_aligned(after);
+        if ((start < end) && (size <= end - start))
+            return start;
     }
+    return 0;
+}
+
+void pmem_setup(void) {
+    index_t i;
+    uint64_t ts_start, ts_end;
+
+    i386_rdtsc(&ts_start);
+
+    pmem_read_mmap();
+    if (n_usable_mem == 0)
+        panic("pmem_setup: no usable memory");
+
+    /* the map lives in the normal zone, it cannot take too much of it */
+    index_t lowmem_end = (index_t)(PMEM_LOWMEM_END >> PAGE_SHIFT);
+    index_t max_len = (lowmem_end / PMEM_MAP_SHARE) * (PAGE_SIZE / sizeof(pageframe_t));
+    pmem_trim_mmap(max_len);
+
+    pfmap_len = usable_mem[n_usable_mem - 1].end;
+    normal_zone.start = 0;
+    normal_zone.end = (pfmap_len < lowmem_end ? pfmap_len : lowmem_end);
+    high_zone.start = normal_zone.end;
+    high_zone.end = pfmap_len;
 
     /// allocate the pageframe map
     // skip all multiboot modules
+    ptr_t kern_end = (ptr_t)&_end;
     module_t *mods = null;
     size_t n_mods = 0;
     mboot_modules_info(&n_mods, &mods);
     for (i = 0; i < n_mods; ++i) {
         ptr_t mod_end = (ptr_t)__va(mods[i].mod_end);
-        if (pfmap < mod_end)
-            pfmap = mod_end;
+        if (kern_end < mod_end)
+            kern_end = mod_end;
     }
 
-    pfmap = PAGE_SIZE * page_aligned(pfmap);
-    ptr_t pfmap_end = pfmap + sizeof(pageframe_t) * pfmap_len;
-    mem_logf("thePFMap[%x] at *%x (until *%x)\n", pfmap_len, pfmap, pfmap_end);
+    size_t pfmap_size = sizeof(pageframe_t) * pfmap_len;
+    ptr_t pfmap = pmem_place_pfmap(kern_end, pfmap_size);
+    if (!pfmap)
+        panic("pmem_setup: no memory for the pageframe table");
+    mem_logf("thePFMap[%x] at *%x (until *%x)\n", pfmap_len, pfmap, pfmap + pfmap_size);
 
-    // allocate virtual 4M pages
-    if (pfmap_end > (ptr_t)__va(0x800000)) {
-        panic("TODO: allocate memory for pageframe table more than 8Mb long\n");
-    }
     the_pageframe_map = (pageframe_t *)pfmap;
-    memset(the_pageframe_map, 0, pfmap_len * sizeof(pageframe_t));
-
-    // consider all memory reserved first
-    pf_list_init(&reserved_pageframes, &(the_pageframe_map[0]), PF_RESERVED);
-
-    for (i = 1; i < pfmap_len; ++i) {
-        pageframe_t *pf = the_pageframe_map + i;
-        pf_list_insert(&reserved_pageframes, pf);
-    }
-
-    // free the free regions
-    size_t mbm;
-    for (mbm = 0; mbm < mmap_len; ++mbm)
-        if (mapping[mbm].type == 1) {
-            index_t start = page_aligned(mapping[mbm].base_addr_low);
-            index_t end = page_aligned(mapping[mbm].base_addr_low + mapping[mbm].length_low);
-            mem_logf("marking free [%x : %x)\n", start, end);
-            for (i = start; i < end; ++i) {
-                pageframe_t *pf = the_pageframe_map + i;
-                pf_list_remove(&reserved_pageframes, pf);
-                if (free_pageframes.head)
-                    pf_list_insert(&free_pageframes, pf);
-                else pf_list_init(&free_pageframes, pf, PF_FREE);
-            }
-        } // */
+
+    /* pageframes are PF_FREE, holes between usable ranges are reserved */
+    memset(the_pageframe_map, 0, pfmap_size);
+    index_t hole = 0;
+    for (i = 0; i < n_usable_mem; ++i) {
+        pf_mark_range(hole, usable_mem[i].start, PF_RESERVED);
+        hole = usable_mem[i].end;
+    }
+
+    for (i = 0; i < PMEM_MAX_ORDER; ++i) {
+        normal_zone.free_area[i].head = high_zone.free_area[i].head = PF_NONE;
+        normal_zone.free_area[i].count = high_zone.free_area[i].count = 0;
+        normal_zone.free_area[i].flag = high_zone.free_area[i].flag = PF_FREE;
+    }
+
+    // free the usable ranges
+    for (i = 0; i < n_usable_mem; ++i) {
+        index_t start = usable_mem[i].start;
+        index_t end = usable_mem[i].end;
+
+        mem_logf("marking free [%x : %x)\n", start, end);
+        buddy_free_range(start, end);
+    }
 
     // mark the first page as reserved
     mem_logf("marking reserved page %d\n", 0);
-    pageframe_t *pf = the_pageframe_map + 0;
-    pf_list_remove(&free_pageframes, pf);
-    pf_list_insert(&reserved_pageframes, pf);
+    if (PF(0)->flags != PF_RESERVED)
+        buddy_take_range(0, 1, PF_RESERVED);
 
-    // mark the last free pageframe as cache
-    pageframe_t * cpf = free_pageframes.head->prev;
-    pf_list_init(&cache_pageframes, cpf, PF_CACHE);
-    pf_list_remove(&free_pageframes, cpf);
-    mem_logf("marking cache %x\n", pageframe_index(cpf));
+    // page cache frames are taken later
+    cache_pageframes.head = PF_NONE;
+    cache_pageframes.count = 0;
+    cache_pageframes.flag = PF_CACHE;
 
     // mark kernel code&data space as used
-    pf = the_pageframe_map + (page_aligned_back((ptr_t)&_start));
-    pf_list_init(&used_pageframes, pf, PF_USED);
-    mark_used(pageframe_addr(++pf), &_end);
+    mark_used(&_start, &_end);
 
     // mark the multiboot modules memory as used
     for (i = 0; i < n_mods; ++i) {
@@ -257,8 +533,16 @@ void pmem_setup(void) {
     // mark the pageframe table memory as used
     mark_used(the_pageframe_map, the_pageframe_map + pfmap_len);
 
-    mem_logf("free: %x, reserved: %x, cache: %x\n",
-            free_pageframes.count, reserved_pageframes.count, cache_pageframes.count);
+    mem_logf("free: %x, used: %x, cache: %x\n",
+            normal_zone.n_free + high_zone.n_free, n_used_pageframes, cache_pageframes.count);
+    if (high_zone.end > high_zone.start)
+        k_printf("pmem: %d Mb of high memory\n",
+                 (uint)(pfn_paddr(high_zone.end - high_zone.start) >> 20));
+    if (pmem_unmanaged)
+        k_printf("pmem: %d Mb of memory are not managed\n", (uint)(pmem_unmanaged >> 20));
+
+    i386_rdtsc(&ts_end);
+    pmem_setup_cycles = ts_end - ts_start;
 }
 
 index_t pmem_check_avail(void *startptr, void *endptr) {
@@ -268,54 +552,226 @@ index_t pmem_check_avail(void *startptr, void *endptr) {
 
     for (i = start_page; i < end_page; ++i) {
         logmsgdf("pmem_check_avail: page 0x%x\n", i);
-        if (the_pageframe_map[i].flags != PF_FREE) {
-            return start_page + i;
+        /* free block heads also carry PF_BUDDY and their order */
+        if ((PF(i)->flags & PF_TYPE_MASK) != PF_FREE) {
+            return i;
         }
     }
     return 0;
 }
 
-void * pmem_alloc(size_t pages_count) {
-    if (free_pageframes.count == 0)
-        return 0;
+/***
+  *     Page cache frames
+  *
+  *  Pages of the page cache (mem/pcache.h) are PF_CACHE pageframes
+  *  on the cache_pageframes list instead of used ones. They are taken
+  *  from high memory first, the cache only reaches them through kmap().
+ ***/
 
-    /* TODO: the algorithm is stupid and unreliable, rewrite to buddy allocator */
-    pageframe_t *startp = free_pageframes.head;
-    pageframe_t *currentp = startp;
+static err_t pmem_free_pages(index_t start_page, size_t pages_count);
+static err_t pmem_free_profiled(index_t start_page, size_t pages_count);
+static void * pmem_alloc_pages(size_t pages_count);
+static index_t pmem_alloc_high(void);
+static bool pmem_compact_order(uint order);
+static size_t pmem_reclaim(size_t target);
+static bool pmem_oom(void);
+
+static pageframe_t *pmem_cache_page(pfn_t pfn) {
+    if (pfn >= pfmap_len)
+        return null;
+    if ((PF(pfn)->flags & PF_TYPE_MASK) != PF_CACHE)
+        return null;
+    return PF(pfn);
+}
 
-    while (true) {
-        bool available = true;
-        size_t i;
-        for (i = 0; i < pages_count; ++i) {
-            currentp = startp + i;
+pfn_t pmem_cache_alloc(void) {
+    index_t pfi = pmem_alloc_high();
+    if (pfi == PF_NONE) return 0;
 
-            if (pageframe_index(currentp) >= pfmap_len)
-                return 0;
+    --n_used_pageframes;
+    pf_list_insert(&cache_pageframes, pfi);
+    return pfi;
+}
 
-            if (currentp->flags != PF_FREE) {
-                available = false;
-                break;
-            }
-        }
+err_t pmem_cache_free(pfn_t pfn) {
+    pageframe_t *pf = pmem_cache_page(pfn);
+    return_err_if(!pf, EINVAL, "pmem_cache_free(#%x): not a cache page", (uint)pfn);
+    return_err_if(pf->flags & CACHE_IN_USE, EBUSY,
+                  "pmem_cache_free(#%x): the page is in use", (uint)pfn);
+
+    pf_list_remove(&cache_pageframes, pageframe_index(pf));
+    pf->flags = PF_USED;
+    ++n_used_pageframes;
+    return pmem_free_pages(pfn, 1);
+}
+
+void pmem_cache_use(pfn_t pfn, bool in_use) {
+    pageframe_t *pf = pmem_cache_page(pfn);
+    returnv_err_if(!pf, "pmem_cache_use(#%x): not a cache page", (uint)pfn);
+
+    if (in_use)
+        pf->flags |= CACHE_IN_USE;
+    else
+        pf->flags &= ~CACHE_IN_USE;
+}
+
+
+/***
+  *     Pre-zeroed pages
+  *
+  *  Idle loops fill a small pool of zeroed pages (see cpu_idle()), so
+  *  pmem_alloc_zeroed(1) does not have to clear a page on the hot path.
+  *  The pool is given back before an allocation fails.
+ ***/
+
+#define ZERO_POOL_SIZE      64
+#define ZERO_POOL_BATCH     8       /* pages zeroed per idle call */
+#define ZERO_POOL_RESERVE   PMEM_WMARK_HIGH /* free pages left to other users */
+
+static struct {
+    void *pages[ZERO_POOL_SIZE];
+    size_t count;
+    count_t hits, misses;
+} zero_pool;
+
+/* the pool is also used by the page fault handler */
+static inline uint zero_pool_lock(void) {
+    uint efl = x86_eflags();
+    intrs_disable();
+    return efl;
+}
+
+static inline void zero_pool_unlock(uint efl) {
+    if (efl & EFLAGS_IF)
+        intrs_enable();
+}
+
+static void * zero_pool_take(void) {
+    void *page = null;
+    uint efl = zero_pool_lock();
+    if (zero_pool.count)
+        page = zero_pool.pages[--zero_pool.count];
+    zero_pool_unlock(efl);
+    return page;
+}
 
-        if (available) {
-            /* mark those pages used and return */
-            for (i = 0; i < pages_count; ++i) {
-                pf_list_remove(&free_pageframes, startp + i);
-                pf_list_insert(&used_pageframes, startp + i);
-            }
-            return pageframe_addr(startp);
+/* the pool shrinker */
+static size_t zero_pool_release(size_t n_pages) {
+    size_t n = 0;
+    uint efl = zero_pool_lock();
+    while (zero_pool.count && (n < n_pages)) {
+        pmem_free_pages(page_pfn(zero_pool.pages[--zero_pool.count]), 1);
+        ++n;
+    }
+    zero_pool_unlock(efl);
+    return n;
+}
+
+static void * pmem_alloc_zeroed_pages(size_t pages_count) {
+    if (pages_count == 1) {
+        void *page = zero_pool_take();
+        if (page) {
+            ++zero_pool.hits;
+            return page;
         }
+        ++zero_pool.misses;
+    }
 
-        // find next free pageframe
-        startp = startp + i;
-        while (startp->flags != PF_FREE) {
-            startp++;
+    void *p = pmem_alloc_pages(pages_count);
+    if (p)
+        memset(p, 0, pages_count * PAGE_SIZE);
+    return p;
+}
+
+void pmem_idle(void) {
+    if (normal_zone.n_free < PMEM_WMARK_LOW)
+        pmem_reclaim(PMEM_WMARK_HIGH);
+
+    int i;
+    for (i = 0; i < ZERO_POOL_BATCH; ++i) {
+        if (zero_pool.count >= ZERO_POOL_SIZE)
+            return;
+
+        void *page = null;
+        uint efl = zero_pool_lock();
+        if (normal_zone.n_free > ZERO_POOL_RESERVE)
+            page = pmem_alloc_pages(1);
+        zero_pool_unlock(efl);
+        if (!page)
+            return;
+
+        memset(page, 0, PAGE_SIZE);
+
+        efl = zero_pool_lock();
+        zero_pool.pages[zero_pool.count++] = page;
+        zero_pool_unlock(efl);
+    }
+}
 
-            if (pageframe_index(startp) >= pfmap_len)
-                return 0;
+
+static void * pmem_alloc_pages(size_t pages_count) {
+    if (pages_count == 0)
+        return 0;
+
+    uint order = pages_order(pages_count);
+    bool compacted = false;
+    index_t pfi;
+    while ((pfi = buddy_alloc(&normal_zone, pages_count)) == PF_NONE) {
+        /* an evacuated block is free as a whole, compact once */
+        if ((pages_count > 1) && !compacted) {
+            compacted = true;
+            if (pmem_compact_order(order))
+                continue;
         }
+
+        /* frees may land in the high zone: retry only on progress here */
+        size_t n_free = normal_zone.n_free;
+        pmem_reclaim(n_free + (1 << order));
+        if ((order == 0) && (normal_zone.n_free == n_free)
+            && (normal_zone.n_free + high_zone.n_free < PMEM_WMARK_MIN))
+            pmem_oom();
+        if (normal_zone.n_free <= n_free)
+            return 0;
+    }
+
+    if (normal_zone.n_free < PMEM_WMARK_MIN)
+        pmem_reclaim(PMEM_WMARK_LOW);
+
+    return pageframe_addr(PF(pfi));
+}
+
+/* a pageframe from the high zone or, if it is empty, from the normal one */
+static index_t pmem_alloc_high(void) {
+    index_t pfi = buddy_alloc(&high_zone, 1);
+    if (pfi != PF_NONE)
+        return pfi;
+
+    void *page = pmem_alloc_pages(1);
+    return (page ? (index_t)page_pfn(page) : PF_NONE);
+}
+
+static index_t pmem_alloc_high_zeroed(void) {
+    if (high_zone.n_free == 0) {
+        void *page = pmem_alloc_zeroed_pages(1);
+        return (page ? (index_t)page_pfn(page) : PF_NONE);
+    }
+
+    index_t pfi = pmem_alloc_high();
+    if (pfi == PF_NONE)
+        return PF_NONE;
+
+    void *page = kmap(pfi);
+    if (!page) {
+        pmem_free_pages(pfi, 1);
+        return PF_NONE;
     }
+    memset(page, 0, PAGE_SIZE);
+    kunmap(page);
+    return pfi;
+}
+
+size_t pmem_highmem_frames(void) {
+    return high_zone.end - high_zone.start;
 }
 
 err_t pmem_reserve(void *p1, void *p2) {
@@ -323,25 +779,468 @@ err_t pmem_reserve(void *p1, void *p2) {
     index_t pages_count = page_aligned((ptr_t)p2) - start_page;
 
     /* check if all those pages are free */
-    if (free_pageframes.count < pages_count)
+    if (normal_zone.n_free < pages_count)
         return ENOMEM;
-    if (pfmap_len < (start_page + pages_count))
+    if (normal_zone.end < (start_page + pages_count))
         return ENOMEM;
 
     if (pmem_check_avail(p1, p2))
         return ENOMEM;
 
-    mark_used(p1, p2);
+    if (buddy_take_range(start_page, start_page + pages_count, PF_USED))
+        return ENOMEM;
+    n_used_pageframes += pages_count;
+#if MEM_PROFILING
+    index_t i;
+    for (i = start_page; i < start_page + pages_count; ++i)
+        PF(i)->site = 0;
+#endif
+    return 0;
+}
+
+static err_t pmem_free_pages(index_t start_page, size_t pages_count) {
+    const char *funcname = "pmem_free";
+    index_t end_page = start_page + pages_count;
+    index_t i;
+
+    return_err_if(end_page > pfmap_len, EINVAL,
+            "%s(#%x[%d]): out of memory range\n", funcname, start_page, pages_count);
+
+    for (i = start_page; i < end_page; ++i) {
+        return_err_if((PF(i)->flags & PF_TYPE_MASK) != PF_USED, EINVAL,
+                "%s(#%x[%d]): page #%x is not used\n", funcname, start_page, pages_count, i);
+        return_err_if(PF(i)->count, EBUSY,
+                "%s(#%x[%d]): page #%x is shared\n", funcname, start_page, pages_count, i);
+    }
+
+    pf_mark_range(start_page, end_page, PF_FREE);
+    n_used_pageframes -= pages_count;
+    buddy_free_range(start_page, end_page);
+    return 0;
+}
+
+/***
+  *     Shared pageframes
+ ***/
+
+static pageframe_t *pmem_used_page(pfn_t pfn) {
+    if (pfn >= pfmap_len)
+        return null;
+    if ((PF(pfn)->flags & PF_TYPE_MASK) != PF_USED)
+        return null;
+    return PF(pfn);
+}
+
+void pmem_page_ref(pfn_t pfn) {
+    pageframe_t *pf = pmem_used_page(pfn);
+    returnv_err_if(!pf, "pmem_page_ref(#%x): the page is not used", (uint)pfn);
+    ++pf->count;
+}
+
+err_t pmem_page_unref(pfn_t pfn) {
+    pageframe_t *pf = pmem_used_page(pfn);
+    return_err_if(!pf, EINVAL, "pmem_page_unref(#%x): the page is not used", (uint)pfn);
+
+    if (pf->count) {
+        --pf->count;
+        return 0;
+    }
+    return pmem_free_profiled(pfn, 1);
+}
+
+count_t pmem_page_refs(pfn_t pfn) {
+    pageframe_t *pf = pmem_used_page(pfn);
+    return (pf ? pf->count + 1 : 0);
+}
+
+
+/***
+  *     Reclaim
+  *
+  *  Shrinkers are called in the order of registration, cheap ones
+  *  (the zeroed pool, empty slabs) should be registered first.
+ ***/
+
+#define PMEM_MAX_SHRINKERS  8
+
+static struct {
+    struct {
+        const char *name;
+        pmem_shrink_f shrink;
+        count_t n_freed;
+    } shrinkers[PMEM_MAX_SHRINKERS];
+    size_t n_shrinkers;
+
+    pmem_oom_f oom;
+    bool active;            /* shrinkers allocate too */
+
+    count_t n_runs, n_ooms;
+} reclaim;
+
+/* runs shrinkers until there are `target` free pageframes, returns the number of freed */
+static size_t pmem_reclaim(size_t target) {
+    if (reclaim.active)
+        return 0;
+    reclaim.active = true;
+    ++reclaim.n_runs;
+
+    size_t freed = 0;
+    size_t i;
+    for (i = 0; (i < reclaim.n_shrinkers) && (normal_zone.n_free < target); ++i) {
+        size_t n = reclaim.shrinkers[i].shrink(target - normal_zone.n_free);
+        reclaim.shrinkers[i].n_freed += n;
+        freed += n;
+    }
+
+    reclaim.active = false;
+    return freed;
+}
 
+static bool pmem_oom(void) {
+    if (!reclaim.oom || reclaim.active)
+        return false;
+
+    logmsgef("pmem: out of memory, %d pageframes free", normal_zone.n_free);
+    reclaim.active = true;
+    ++reclaim.n_ooms;
+    bool freed = reclaim.oom();
+    reclaim.active = false;
+    return freed;
+}
+
+err_t pmem_register_shrinker(const char *name, pmem_shrink_f shrink) {
+    return_err_if(reclaim.n_shrinkers == PMEM_MAX_SHRINKERS, ENOMEM,
+                  "pmem_register_shrinker(%s): too many shrinkers", name);
+
+    reclaim.shrinkers[reclaim.n_shrinkers].name = name;
+    reclaim.shrinkers[reclaim.n_shrinkers].shrink = shrink;
+    reclaim.shrinkers[reclaim.n_shrinkers].n_freed = 0;
+    ++reclaim.n_shrinkers;
     return 0;
 }
 
-err_t pmem_free(index_t start_page, size_t pages_count) {
-    const char *funcname = __FUNCTION__;
-    logmsgf("%s(*%x[%d]) : TODO\n", funcname, (uint)start_page, pages_count);
+void pmem_set_oom_handler(pmem_oom_f oom) {
+    reclaim.oom = oom;
+}
+
+
+/***
+  *     Compaction
+  *
+  *  When there is no free block of some order, compaction picks the aligned
+  *  block of this order with the fewest used pageframes, all of them movable,
+  *  takes its free pageframes out of the buddy lists and asks the movers
+  *  to move their pages out of it with pmem_migrate(). The block is freed
+  *  as a whole if it has been evacuated.
+  *  Only the normal zone needs contiguous blocks, moved pageframes go to
+  *  the high zone if there is room.
+ ***/
+
+#define PMEM_MAX_MOVERS     4
+
+static struct {
+    pmem_mover_f movers[PMEM_MAX_MOVERS];
+    size_t n_movers;
+
+    index_t start, end;     /* the block being evacuated */
+
+    count_t n_runs, n_failed;
+    count_t n_moved;
+} compaction;
+
+static inline bool pf_is_movable(index_t pfi) {
+    pageframe_t *pf = PF(pfi);
+    return ((pf->flags & (PF_TYPE_MASK | PF_MOVABLE)) == (PF_USED | PF_MOVABLE))
+            && !pf->count;
+}
+
+static inline bool pf_is_free(index_t pfi) {
+    return (PF(pfi)->flags & PF_TYPE_MASK) == PF_FREE;
+}
+
+/* the number of pageframes to move out of a block, -1 if some cannot be moved */
+static int compaction_cost(index_t start, size_t n_pages) {
+    int cost = 0;
+    index_t i;
+    for (i = start; i < start + n_pages; ++i) {
+        if (pf_is_free(i))
+            continue;
+        if (!pf_is_movable(i))
+            return -1;
+        ++cost;
+    }
+    return cost;
+}
+
+/* returns PF_RESERVED pageframes of [start, end) to the buddy lists */
+static void compaction_release(index_t start, index_t end) {
+    index_t i = start;
+    while (i < end) {
+        if (PF(i)->flags != PF_RESERVED) {
+            ++i;
+            continue;
+        }
+
+        index_t j = i;
+        while ((j < end) && (PF(j)->flags == PF_RESERVED))
+            ++j;
+
+        pf_mark_range(i, j, PF_FREE);
+        buddy_free_range(i, j);
+        i = j;
+    }
+}
+
+static bool pmem_compact_order(uint order) {
+    if (!compaction.n_movers || (order >= PMEM_MAX_ORDER))
+        return false;
+
+    const size_t n_pages = 1u << order;
+    if (normal_zone.n_free + high_zone.n_free < n_pages)
+        return false;   /* no place for the moved pageframes */
+
+    index_t best = PF_NONE;
+    int best_cost = 0;
+    index_t start;
+    for (start = normal_zone.start; start + n_pages <= normal_zone.end; start += n_pages) {
+        int cost = compaction_cost(start, n_pages);
+        if (cost < 0)
+            continue;
+        if ((best == PF_NONE) || (cost < best_cost)) {
+            best = start;
+            best_cost = cost;
+        }
+    }
+    if (best == PF_NONE)
+        return false;
+
+    ++compaction.n_runs;
+    count_t moved = compaction.n_moved;
+
+    /* the free pageframes of the block must not be allocated for migration */
+    index_t i = best;
+    while (i < best + n_pages) {
+        if (!pf_is_free(i)) {
+            ++i;
+            continue;
+        }
+        index_t j = i;
+        while ((j < best + n_pages) && pf_is_free(j))
+            ++j;
+
+        buddy_take_range(i, j, PF_RESERVED);
+        i = j;
+    }
+
+    compaction.start = best;
+    compaction.end = best + n_pages;
+    for (i = 0; i < compaction.n_movers; ++i)
+        compaction.movers[i](compaction.start, compaction.end);
+    compaction.start = compaction.end = 0;
+
+    bool evacuated = true;
+    for (i = best; i < best + n_pages; ++i)
+        if (PF(i)->flags != PF_RESERVED)
+            evacuated = false;
+
+    compaction_release(best, best + n_pages);
+    if (!evacuated)
+        ++compaction.n_failed;
+
+    mem_logf("pmem: compaction of [%x : %x) %s, %d pageframes moved\n",
+             best, best + n_pages, (evacuated ? "done" : "failed"),
+             compaction.n_moved - moved);
+    return evacuated;
+}
+
+err_t pmem_register_mover(pmem_mover_f mover) {
+    return_err_if(compaction.n_movers == PMEM_MAX_MOVERS, ENOMEM,
+                  "pmem_register_mover: too many movers");
+    compaction.movers[compaction.n_movers++] = mover;
     return 0;
 }
 
+void pmem_set_movable(pfn_t pfn, bool movable) {
+    pageframe_t *pf = pmem_used_page(pfn);
+    returnv_err_if(!pf, "pmem_set_movable(#%x): the page is not used", (uint)pfn);
+
+    if (movable)
+        pf->flags |= PF_MOVABLE;
+    else
+        pf->flags &= ~PF_MOVABLE;
+}
+
+pfn_t pmem_migrate(pfn_t pfn) {
+    if ((pfn < compaction.start) || (compaction.end <= pfn) || !pf_is_movable(pfn))
+        return 0;
+    index_t pfi = pfn;
+
+    index_t newpfi = pmem_alloc_high();
+    if (newpfi == PF_NONE)
+        return 0;
+
+    char *page = kmap(pfi);
+    char *newpage = kmap(newpfi);
+    if (!(page && newpage)) {
+        kunmap(page);
+        kunmap(newpage);
+        pmem_free_pages(newpfi, 1);
+        return 0;
+    }
+    memcpy(newpage, page, PAGE_SIZE);
+    kunmap(newpage);
+    kunmap(page);
+
+    PF(newpfi)->flags |= PF_MOVABLE;
+#if MEM_PROFILING
+    PF(newpfi)->site = PF(pfi)->site;
+#endif
+
+    /* the old pageframe is released with the whole block */
+    PF(pfi)->flags = PF_RESERVED;
+    --n_used_pageframes;
+    ++compaction.n_moved;
+    return newpfi;
+}
+
+size_t pmem_compact(size_t pages_count) {
+    count_t moved = compaction.n_moved;
+    pmem_compact_order(pages_order(pages_count));
+    return compaction.n_moved - moved;
+}
+
+
+/***
+  *     Profiled entry points
+  *
+  *  Only the interface is profiled, pages taken and given back inside
+  *  (the zeroed pool, the page cache, migration) are not. Every pageframe
+  *  keeps its allocation site, so it is charged back to that site when
+  *  freed, whoever frees it.
+ ***/
+
+#if MEM_PROFILING
+
+static void pmem_profile_alloc(index_t pfi, size_t pages_count, ptr_t site, uint64_t cycles) {
+    index_t i;
+    for (i = pfi; i < pfi + pages_count; ++i)
+        PF(i)->site = site;
+    memprof_alloc(MEMPROF_PMEM, site, PAGE_SIZE * pages_count, cycles);
+}
+
+static err_t pmem_free_profiled(index_t pfi, size_t pages_count) {
+    uint64_t ts0, ts1;
+    uint efl = x86_eflags();
+    intrs_disable();
+
+    i386_rdtsc(&ts0);
+    err_t ret = pmem_free_pages(pfi, pages_count);
+    i386_rdtsc(&ts1);
+
+    /* free pageframes keep their sites, charge them back by runs */
+    index_t end = pfi + pages_count;
+    uint64_t cycles = ts1 - ts0;
+    while (!ret && (pfi < end)) {
+        ptr_t site = PF(pfi)->site;
+        index_t run = pfi;
+        while ((pfi < end) && (PF(pfi)->site == site))
+            PF(pfi++)->site = 0;
+
+        /* pages which were not allocated through the interface */
+        if (!site) continue;
+
+        memprof_free(MEMPROF_PMEM, site, PAGE_SIZE * (pfi - run), cycles);
+        cycles = 0;
+    }
+
+    if (efl & EFLAGS_IF)
+        intrs_enable();
+    return ret;
+}
+
+void * pmem_alloc(size_t pages_count) {
+    uint64_t ts0, ts1;
+    i386_rdtsc(&ts0);
+    void *p = pmem_alloc_pages(pages_count);
+    i386_rdtsc(&ts1);
+
+    if (p)
+        pmem_profile_alloc(page_pfn(p), pages_count,
+                           (ptr_t)__builtin_return_address(0), ts1 - ts0);
+    return p;
+}
+
+void * pmem_alloc_zeroed(size_t pages_count) {
+    uint64_t ts0, ts1;
+    i386_rdtsc(&ts0);
+    void *p = pmem_alloc_zeroed_pages(pages_count);
+    i386_rdtsc(&ts1);
+
+    if (p)
+        pmem_profile_alloc(page_pfn(p), pages_count,
+                           (ptr_t)__builtin_return_address(0), ts1 - ts0);
+    return p;
+}
+
+pfn_t pmem_alloc_frame(void) {
+    uint64_t ts0, ts1;
+    i386_rdtsc(&ts0);
+    index_t pfi = pmem_alloc_high();
+    i386_rdtsc(&ts1);
+
+    if (pfi == PF_NONE)
+        return 0;
+    pmem_profile_alloc(pfi, 1, (ptr_t)__builtin_return_address(0), ts1 - ts0);
+    return pfi;
+}
+
+pfn_t pmem_alloc_frame_zeroed(void) {
+    uint64_t ts0, ts1;
+    i386_rdtsc(&ts0);
+    index_t pfi = pmem_alloc_high_zeroed();
+    i386_rdtsc(&ts1);
+
+    if (pfi == PF_NONE)
+        return 0;
+    pmem_profile_alloc(pfi, 1, (ptr_t)__builtin_return_address(0), ts1 - ts0);
+    return pfi;
+}
+
+#else
+
+void * pmem_alloc(size_t pages_count) {
+    return pmem_alloc_pages(pages_count);
+}
+
+void * pmem_alloc_zeroed(size_t pages_count) {
+    return pmem_alloc_zeroed_pages(pages_count);
+}
+
+pfn_t pmem_alloc_frame(void) {
+    index_t pfi = pmem_alloc_high();
+    return (pfi == PF_NONE ? 0 : pfi);
+}
+
+pfn_t pmem_alloc_frame_zeroed(void) {
+    index_t pfi = pmem_alloc_high_zeroed();
+    return (pfi == PF_NONE ? 0 : pfi);
+}
+
+static err_t pmem_free_profiled(index_t pfi, size_t pages_count) {
+    return pmem_free_pages(pfi, pages_count);
+}
+
+#endif // MEM_PROFILING
+
+err_t pmem_free(void *startptr, size_t pages_count) {
+    return pmem_free_profiled(page_aligned_back((ptr_t)startptr), pages_count);
+}
+
+err_t pmem_free_frame(pfn_t pfn) {
+    return_err_if(pfn >= pfmap_len, EINVAL, "pmem_free_frame(#%x): out of memory range", (uint)pfn);
+    return pmem_free_profiled(pfn, 1);
+}
+
 void pmem_info(void) {
     struct memory_map *mmmap = (struct memory_map *)mboot_mmap_addr();
     uint i;
@@ -357,6 +1256,30 @@ void pmem_info(void) {
             mmmap[i].size
         );
     }
+
+    k_printf("\nPageframes: free=%x, used=%x, cache=%x, total=%x\n",
+            normal_zone.n_free + high_zone.n_free, n_used_pageframes,
+            cache_pageframes.count, pfmap_len);
+    struct pmem_zone *zones[] = { &normal_zone, &high_zone };
+    size_t z;
+    for (z = 0; z < sizeof(zones)/sizeof(*zones); ++z) {
+        k_printf("Zone %s [%x : %x): free=%x, blocks by order:", zones[z]->name,
+                 zones[z]->start, zones[z]->end, zones[z]->n_free);
+        for (i = 0; i < PMEM_MAX_ORDER; ++i)
+            k_printf(" %d", zones[z]->free_area[i].count);
+        k_printf("\n");
+    }
+    k_printf("Zeroed pool: %d pages, %d hits, %d misses\n",
+            zero_pool.count, zero_pool.hits, zero_pool.misses);
+    k_printf("Compaction: %d runs, %d failed, %d pageframes moved\n",
+            compaction.n_runs, compaction.n_failed, compaction.n_moved);
+    k_printf("Reclaim: %d runs, %d out of memory;", reclaim.n_runs, reclaim.n_ooms);
+    for (i = 0; i < reclaim.n_shrinkers; ++i)
+        k_printf(" %s %d", reclaim.shrinkers[i].name, reclaim.shrinkers[i].n_freed);
+    k_printf("\n");
+    k_printf("Unmanaged: %d Mb above the pageframe map\n", (uint)(pmem_unmanaged >> 20));
+    k_printf("Map: %d bytes per pageframe, setup took %x %x cycles\n",
+            sizeof(pageframe_t), (uint)(pmem_setup_cycles >> 32), (uint)pmem_setup_cycles);
 }
 
 
@@ -432,14 +1355,17 @@ device * get_cmem_device(void) {
 }
 
 
-void vmem_setup(void) {
-}
-
 void memory_setup(void) {
 #if PAGING
     paging_setup();
 #endif
     pmem_setup();
+    pmem_register_shrinker("zeropool", zero_pool_release);
+    pmem_register_shrinker("slab", kmem_caches_shrink);
+    dma_setup();
+    kmap_setup();
+    kstack_setup();
     vmem_setup();
+    pcache_setup();
     kheap_setup();
 }
@@ -0,0 +1,229 @@
+/*
+ *      Slab object caches
+ *
+ *  A slab is a single pmem page: `struct slab` header, an array of
+ *  free list links (one byte per object) and the objects themselves.
+ *  Free list links are kept out of the objects, so constructed objects
+ *  stay intact between kmem_cache_free() and kmem_cache_alloc().
+ *
+ *  Slabs of a cache are on one of three lists: partial, full or empty.
+ *  An object's slab is found by aligning its address down to PAGE_SIZE.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <conf.h>
+
+#include <mem/pmem.h>
+#include <mem/slab.h>
+
+#include <cosec/log.h>
+#include <sys/errno.h>
+
+#define KMEM_MAX_CACHES     32
+#define KMEM_ALIGN          8
+#define KMEM_MAX_EMPTY      1       /* empty slabs kept by a cache */
+
+#define SLAB_END            0xff    /* end of slab free list */
+
+#if (0)
+#   define mem_logf(msg, ...) logmsgf(msg, __VA_ARGS__)
+#else
+#   define mem_logf(msg, ...)
+#endif
+
+struct slab {
+    struct slab *next, *prev;   /* in one of the cache lists */
+    kmem_cache_t *cache;
+    uint16_t inuse;             /* allocated objects */
+    uint8_t free;               /* index of the first free object */
+    uint8_t freelist[0];        /* index of the next free object */
+};
+
+struct kmem_cache {
+    const char *name;
+    size_t objsize;
+    size_t objs_per_slab;
+    size_t objoffset;           /* of the first object in a slab */
+    kmem_ctor_f ctor;
+
+    struct slab *partial;
+    struct slab *full;
+    struct slab *empty;
+
+    count_t n_slabs;
+    count_t n_empty;
+    count_t n_inuse;
+    count_t n_allocs;
+    count_t n_frees;
+};
+
+static kmem_cache_t kmem_caches[KMEM_MAX_CACHES];
+static size_t n_kmem_caches = 0;
+
+
+static inline size_t kmem_aligned(size_t size) {
+    return (size + KMEM_ALIGN - 1) & ~(KMEM_ALIGN - 1);
+}
+
+static inline void *slab_obj(kmem_cache_t *cache, struct slab *slab, size_t i) {
+    return (char *)slab + cache->objoffset + i * cache->objsize;
+}
+
+static void slab_list_insert(struct slab **list, struct slab *slab) {
+    slab->prev = null;
+    slab->next = *list;
+    if (*list) (*list)->prev = slab;
+    *list = slab;
+}
+
+static void slab_list_remove(struct slab **list, struct slab *slab) {
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        *list = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+    slab->next = slab->prev = null;
+}
+
+static struct slab * slab_new(kmem_cache_t *cache) {
+    struct slab *slab = pmem_alloc(1);
+    if (!slab) return null;
+
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free = 0;
+
+    size_t i;
+    for (i = 0; i < cache->objs_per_slab; ++i) {
+        slab->freelist[i] = (i + 1 < cache->objs_per_slab ? i + 1 : SLAB_END);
+        if (cache->ctor)
+            cache->ctor(slab_obj(cache, slab, i));
+    }
+
+    ++cache->n_slabs;
+    mem_logf("slab_new(%s) -> *%x\n", cache->name, (uint)slab);
+    return slab;
+}
+
+kmem_cache_t * kmem_cache_create(const char *name, size_t objsize, kmem_ctor_f ctor) {
+    const char *funcname = __FUNCTION__;
+    return_err_if(n_kmem_caches >= KMEM_MAX_CACHES, null,
+            "%s(%s): no free caches\n", funcname, name);
+
+    objsize = kmem_aligned(objsize ? objsize : 1);
+
+    /* the largest n such that the header, n links and n objects fit a page */
+    size_t n = (PAGE_SIZE - sizeof(struct slab)) / (objsize + 1);
+    if (n >= SLAB_END) n = SLAB_END - 1;
+    while (n && (kmem_aligned(sizeof(struct slab) + n) + n * objsize > PAGE_SIZE))
+        --n;
+    return_err_if(n < 2, null,
+            "%s(%s): object size %d is too large\n", funcname, name, objsize);
+
+    kmem_cache_t *cache = kmem_caches + n_kmem_caches++;
+    memset(cache, 0, sizeof(kmem_cache_t));
+    cache->name = name;
+    cache->objsize = objsize;
+    cache->objs_per_slab = n;
+    cache->objoffset = kmem_aligned(sizeof(struct slab) + n);
+    cache->ctor = ctor;
+    return cache;
+}
+
+void * kmem_cache_alloc(kmem_cache_t *cache) {
+    struct slab *slab = cache->partial;
+    if (!slab) {
+        slab = cache->empty;
+        if (slab) {
+            slab_list_remove(&cache->empty, slab);
+            --cache->n_empty;
+        } else {
+            slab = slab_new(cache);
+            if (!slab) return null;
+        }
+        slab_list_insert(&cache->partial, slab);
+    }
+
+    uint8_t i = slab->free;
+    slab->free = slab->freelist[i];
+    ++slab->inuse;
+
+    if (slab->free == SLAB_END) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_insert(&cache->full, slab);
+    }
+
+    ++cache->n_inuse;
+    ++cache->n_allocs;
+    return slab_obj(cache, slab, i);
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    const char *funcname = __FUNCTION__;
+    if (!obj) return;
+
+    struct slab *slab = (struct slab *)((ptr_t)obj & ~(PAGE_SIZE - 1));
+    returnv_err_if(slab->cache != cache,
+            "%s(%s, *%x): not an object of this cache\n", funcname, cache->name, (uint)obj);
+
+    size_t offset = (ptr_t)obj - (ptr_t)slab_obj(cache, slab, 0);
+    returnv_err_if(offset % cache->objsize,
+            "%s(%s, *%x): misaligned object\n", funcname, cache->name, (uint)obj);
+
+    uint8_t i = offset / cache->objsize;
+    bool was_full = (slab->free == SLAB_END);
+
+    slab->freelist[i] = slab->free;
+    slab->free = i;
+    --slab->inuse;
+    --cache->n_inuse;
+    ++cache->n_frees;
+
+    if (was_full) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_insert(&cache->partial, slab);
+    }
+
+    if (slab->inuse == 0) {
+        slab_list_remove(&cache->partial, slab);
+        if (cache->n_empty < KMEM_MAX_EMPTY) {
+            slab_list_insert(&cache->empty, slab);
+            ++cache->n_empty;
+        } else {
+            --cache->n_slabs;
+            pmem_free(slab, 1);
+        }
+    }
+}
+
+size_t kmem_caches_shrink(size_t n_pages) {
+    size_t freed = 0;
+    size_t i;
+    for (i = 0; (i < n_kmem_caches) && (freed < n_pages); ++i) {
+        kmem_cache_t *cache = kmem_caches + i;
+        while (cache->empty && (freed < n_pages)) {
+            struct slab *slab = cache->empty;
+            slab_list_remove(&cache->empty, slab);
+            --cache->n_empty;
+            --cache->n_slabs;
+            pmem_free(slab, 1);
+            ++freed;
+        }
+    }
+    return freed;
+}
+
+void kmem_caches_info(void) {
+    size_t i;
+    k_printf("cache\t\tsize\tslabs\tinuse/total\tallocs\tfrees\n");
+    for (i = 0; i < n_kmem_caches; ++i) {
+        kmem_cache_t *cache = kmem_caches + i;
+        k_printf("%s\t\t%d\t%d\t%d/%d\t%d\t%d\n",
+                 cache->name, cache->objsize, cache->n_slabs,
+                 cache->n_inuse, cache->n_slabs * cache->objs_per_slab,
+                 cache->n_allocs, cache->n_frees);
+    }
+}
@@ -0,0 +1,669 @@
+/*
+ *      Virtual memory areas
+ *
+ *  An address space keeps its areas in a red-black tree ordered by
+ *  vm_start; since areas do not overlap, the area containing an address
+ *  is the last one starting at or before it. Lookups check the last
+ *  found area first: faults tend to hit the same area repeatedly.
+ *
+ *  Pages of areas are allocated by the page fault handler when they are
+ *  touched first, zeroed or filled from the area data.
+ *
+ *  A forked address space shares the pages with its parent: writable pages
+ *  are mapped read-only in both and get copied on the first write fault,
+ *  the last owner of a page just makes it writable again.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+
+#include <conf.h>
+#include <cosec/log.h>
+
+#include <mem/pmem.h>
+#include <mem/kmap.h>
+#include <mem/slab.h>
+#include <mem/vmem.h>
+#include <arch/i386.h>
+#include <fs/vfs.h>
+#include <process.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define vm_area(node)   rb_entry((node), vm_area_t, vm_node)
+
+static kmem_cache_t *vm_area_cache = null;
+
+static inline bool vm_contains(vm_area_t *area, ptr_t addr) {
+    return (area->vm_start <= addr) && (addr < area->vm_end);
+}
+
+static inline vm_area_t *vm_next(vm_area_t *area) {
+    struct rb_node *node = rb_next(&area->vm_node);
+    return (node ? vm_area(node) : null);
+}
+
+static inline vm_area_t *vm_prev(vm_area_t *area) {
+    struct rb_node *node = rb_prev(&area->vm_node);
+    return (node ? vm_area(node) : null);
+}
+
+/* areas may become one if they are adjacent */
+static inline bool vm_mergeable(vm_area_t *area, vm_area_t *next) {
+    return (area->vm_end == next->vm_start) && (area->vm_flags == next->vm_flags)
+        && !area->vm_data && !next->vm_data && !area->vm_sb && !next->vm_sb;
+}
+
+/* the last area starting at or before `addr`, or null */
+static vm_area_t *vmspace_floor(vmspace_t *vs, ptr_t addr) {
+    struct rb_node *node = vs->vs_areas.rb_root;
+    vm_area_t *found = null;
+    while (node) {
+        vm_area_t *area = vm_area(node);
+        if (addr < area->vm_start) {
+            node = node->rb_left;
+        } else {
+            found = area;
+            node = node->rb_right;
+        }
+    }
+    return found;
+}
+
+static vm_area_t *vm_area_new(ptr_t start, ptr_t end, uint flags) {
+    vm_area_t *area = kmem_cache_alloc(vm_area_cache);
+    if (!area) return null;
+
+    area->vm_start = start;
+    area->vm_end = end;
+    area->vm_flags = flags;
+    area->vm_data = null;
+    area->vm_datalen = 0;
+    area->vm_sb = null;
+    area->vm_ino = 0;
+    area->vm_pgoff = 0;
+    return area;
+}
+
+static void vmspace_link(vmspace_t *vs, vm_area_t *area) {
+    struct rb_node **link = &vs->vs_areas.rb_root;
+    struct rb_node *parent = null;
+    while (*link) {
+        parent = *link;
+        if (area->vm_start < vm_area(parent)->vm_start)
+            link = &parent->rb_left;
+        else
+            link = &parent->rb_right;
+    }
+    rb_insert(&vs->vs_areas, &area->vm_node, parent, link);
+    ++vs->vs_count;
+}
+
+static void vmspace_unlink(vmspace_t *vs, vm_area_t *area) {
+    rb_erase(&vs->vs_areas, &area->vm_node);
+    --vs->vs_count;
+    if (vs->vs_cache == area)
+        vs->vs_cache = null;
+
+    kmem_cache_free(vm_area_cache, area);
+}
+
+/* `next` is absorbed by `area` */
+static void vmspace_merge(vmspace_t *vs, vm_area_t *area, vm_area_t *next) {
+    area->vm_end = next->vm_end;
+    vmspace_unlink(vs, next);
+}
+
+/* splits `area` at `addr`, returns the upper part */
+static vm_area_t *vmspace_split(vmspace_t *vs, vm_area_t *area, ptr_t addr) {
+    vm_area_t *upper = vm_area_new(addr, area->vm_end, area->vm_flags);
+    if (!upper) return null;
+
+    size_t lower_size = addr - area->vm_start;
+    if (area->vm_datalen > lower_size) {
+        upper->vm_data = area->vm_data + lower_size;
+        upper->vm_datalen = area->vm_datalen - lower_size;
+        area->vm_datalen = lower_size;
+    }
+    if (area->vm_sb) {
+        upper->vm_sb = area->vm_sb;
+        upper->vm_ino = area->vm_ino;
+        upper->vm_pgoff = area->vm_pgoff + lower_size / PAGE_SIZE;
+    }
+    area->vm_end = addr;
+    vmspace_link(vs, upper);
+    return upper;
+}
+
+
+/***
+  *     Page tables of areas
+ ***/
+
+static inline ptr_t next_pde_boundary(ptr_t addr) {
+    return (addr + LARGE_PAGE_SIZE) & PG31_21_MASK;
+}
+
+static inline pte_t vm_pg_flags(uint flags) {
+    pte_t pg_flags = 0;
+    if (flags & VM_RW) pg_flags |= PG_RW;
+    if (flags & VM_USR) pg_flags |= PG_USR_READ;
+    if (flags & VM_XD) pg_flags |= paging_nx();
+    return pg_flags;
+}
+
+/* a new pageframe for `page` of `area`: a copy of the area data or zeroes,
+ * in high memory if there is some */
+static pfn_t vm_fill_page(vm_area_t *area, ptr_t page) {
+    size_t offset = page - area->vm_start;
+    if (offset >= area->vm_datalen)
+        return pmem_alloc_frame_zeroed();
+
+    pfn_t frame = pmem_alloc_frame();
+    if (!frame) return 0;
+
+    char *data = kmap(frame);
+    if (!data) {
+        pmem_free_frame(frame);
+        return 0;
+    }
+
+    size_t n = area->vm_datalen - offset;
+    if (n > PAGE_SIZE) n = PAGE_SIZE;
+    memcpy(data, area->vm_data + offset, n);
+    memset(data + n, 0, PAGE_SIZE - n);
+    kunmap(data);
+    return frame;
+}
+
+static void vm_release_pages(vmspace_t *vs, ptr_t start, ptr_t end) {
+    ptr_t addr = start;
+    while (addr < end) {
+        if (!pagedir_pte(vs->vs_pagedir, addr, false)) {
+            addr = next_pde_boundary(addr);
+            continue;
+        }
+
+        pfn_t frame = pagedir_unmap(vs->vs_pagedir, addr);
+        if (frame)
+            pmem_page_unref(frame);
+        addr += PAGE_SIZE;
+    }
+}
+
+static void vm_protect_pages(vmspace_t *vs, ptr_t start, ptr_t end, uint flags) {
+    pte_t pg_flags = vm_pg_flags(flags);
+
+    bool current = (vs->vs_pagedir == pagedir_current());
+    ptr_t addr = start;
+    while (addr < end) {
+        pte_t *pte = pagedir_pte(vs->vs_pagedir, addr, false);
+        if (!pte) {
+            addr = next_pde_boundary(addr);
+            continue;
+        }
+
+        if (*pte & PG_PRESENT) {
+            pte_t rights = pg_flags;
+            /* a shared page stays read-only until copied */
+            if (pmem_page_refs(pte_pfn(*pte)) > 1)
+                rights &= ~PG_RW;
+
+            *pte = (*pte & ~(PG_RW | PG_USR_READ | PG_NX)) | rights;
+            if (current)
+                i386_invlpg(addr);
+        }
+        addr += PAGE_SIZE;
+    }
+}
+
+/* shares present pages of [start, end) with `dst`, read-only in both */
+static err_t vm_share_pages(vmspace_t *dst, vmspace_t *src, ptr_t start, ptr_t end) {
+    bool current = (src->vs_pagedir == pagedir_current());
+    ptr_t addr = start;
+    while (addr < end) {
+        pte_t *pte = pagedir_pte(src->vs_pagedir, addr, false);
+        if (!pte) {
+            addr = next_pde_boundary(addr);
+            continue;
+        }
+
+        if (*pte & PG_PRESENT) {
+            if (*pte & PG_RW) {
+                *pte &= ~PG_RW;
+                if (current)
+                    i386_invlpg(addr);
+            }
+
+            pfn_t frame = pte_pfn(*pte);
+            err_t ret = pagedir_map(dst->vs_pagedir, addr, frame, *pte & PG_FLAGS_MASK);
+            if (ret) return ret;
+            pmem_page_ref(frame);
+        }
+        addr += PAGE_SIZE;
+    }
+    return 0;
+}
+
+static err_t vm_copy_on_write(vmspace_t *vs, vm_area_t *area, ptr_t page);
+
+/* frames may be out of the direct map */
+static err_t vm_copy_frame(pfn_t dst, pfn_t src) {
+    char *to = kmap(dst);
+    if (!to) return ENOMEM;
+
+    char *from = kmap(src);
+    if (!from) {
+        kunmap(to);
+        return ENOMEM;
+    }
+
+    memcpy(to, from, PAGE_SIZE);
+    kunmap(from);
+    kunmap(to);
+    return 0;
+}
+
+/* maps a file page read-only, it is copied on the first write */
+static err_t vm_file_page(vmspace_t *vs, vm_area_t *area, ptr_t page, uint error) {
+    off_t index = area->vm_pgoff + (page - area->vm_start) / PAGE_SIZE;
+    pfn_t frame = 0;
+    err_t ret = vfs_inode_page(area->vm_sb, area->vm_ino, index, &frame);
+    if (ret) return ret;
+
+    pmem_page_ref(frame);
+    ret = pagedir_map(vs->vs_pagedir, page, frame, vm_pg_flags(area->vm_flags) & ~PG_RW);
+    if (ret) {
+        pmem_page_unref(frame);
+        return ret;
+    }
+
+    ++vs->vs_faults;
+    if (error & PGF_WRITE)
+        return vm_copy_on_write(vs, area, page);
+    return 0;
+}
+
+/* resolves a write to a present read-only page of a writable area */
+static err_t vm_copy_on_write(vmspace_t *vs, vm_area_t *area, ptr_t page) {
+    pte_t *pte = pagedir_pte(vs->vs_pagedir, page, false);
+    if (!(pte && (*pte & PG_PRESENT)))
+        return EFAULT;
+
+    pfn_t frame = pte_pfn(*pte);
+    if (pmem_page_refs(frame) > 1) {
+        pfn_t copy = pmem_alloc_frame();
+        if (!copy) return ENOMEM;
+
+        err_t ret = vm_copy_frame(copy, frame);
+        if (ret) {
+            pmem_free_frame(copy);
+            return ret;
+        }
+        pmem_page_unref(frame);
+        frame = copy;
+    }
+
+    ++vs->vs_cow;
+    return pagedir_map(vs->vs_pagedir, page, frame, vm_pg_flags(area->vm_flags));
+}
+
+
+/***
+  *     Interface
+ ***/
+
+void vmspace_init(vmspace_t *vs, pde_t *pagedir) {
+    memset(vs, 0, sizeof(vmspace_t));
+    vs->vs_pagedir = pagedir;
+}
+
+void vmspace_destroy(vmspace_t *vs) {
+    struct rb_node *node;
+    while ((node = rb_first(&vs->vs_areas))) {
+        vm_area_t *area = vm_area(node);
+        vm_release_pages(vs, area->vm_start, area->vm_end);
+        vmspace_unlink(vs, area);
+    }
+
+    if (vs->vs_pagedir != thePageDirectory)
+        pagedir_free(vs->vs_pagedir);
+    vs->vs_pagedir = null;
+}
+
+vm_area_t * vmspace_find(vmspace_t *vs, ptr_t addr) {
+    ++vs->vs_lookups;
+    if (vs->vs_cache && vm_contains(vs->vs_cache, addr)) {
+        ++vs->vs_hits;
+        return vs->vs_cache;
+    }
+
+    vm_area_t *area = vmspace_floor(vs, addr);
+    if (!(area && vm_contains(area, addr)))
+        return null;
+
+    vs->vs_cache = area;
+    return area;
+}
+
+/* `backing` provides the contents of the new area, if not null */
+static err_t vmspace_add(vmspace_t *vs, ptr_t start, ptr_t end, uint flags,
+                         const vm_area_t *backing) {
+    if ((start % PAGE_SIZE) || (end % PAGE_SIZE) || (start >= end))
+        return EINVAL;
+    if ((start < USER_START) || (end > USER_END))
+        return EINVAL;
+    if (backing && (backing->vm_datalen > end - start))
+        return EINVAL;
+
+    vm_area_t *prev = vmspace_floor(vs, end - 1);
+    if (prev && (prev->vm_end > start))
+        return EEXIST;
+
+    vm_area_t *next = (prev ? vm_next(prev) : (vs->vs_count ? vm_area(rb_first(&vs->vs_areas)) : null));
+
+    vm_area_t *area = vm_area_new(start, end, flags);
+    if (!area) return ENOMEM;
+    if (backing) {
+        area->vm_data = backing->vm_data;
+        area->vm_datalen = (backing->vm_data ? backing->vm_datalen : 0);
+        area->vm_sb = backing->vm_sb;
+        area->vm_ino = backing->vm_ino;
+        area->vm_pgoff = backing->vm_pgoff;
+    }
+
+    if (prev && vm_mergeable(prev, area)) {
+        kmem_cache_free(vm_area_cache, area);
+        area = prev;
+        area->vm_end = end;
+    } else
+        vmspace_link(vs, area);
+
+    if (next && vm_mergeable(area, next))
+        vmspace_merge(vs, area, next);
+    return 0;
+}
+
+err_t vmspace_map(vmspace_t *vs, ptr_t start, ptr_t end, uint flags) {
+    return vmspace_add(vs, start, end, flags, null);
+}
+
+err_t vmspace_map_file(vmspace_t *vs, ptr_t start, ptr_t end, uint flags,
+                       struct superblock *sb, size_t ino, off_t pgoff) {
+    vm_area_t backing = { .vm_sb = sb, .vm_ino = ino, .vm_pgoff = pgoff };
+    return vmspace_add(vs, start, end, flags, &backing);
+}
+
+ptr_t vmspace_free_range(vmspace_t *vs, ptr_t hint, size_t size) {
+    ptr_t start = (hint < USER_START ? USER_START : hint & PG31_12_MASK);
+
+    vm_area_t *area = vmspace_floor(vs, start);
+    if (area && (area->vm_end > start))
+        start = area->vm_end;
+    area = (area ? vm_next(area) : (vs->vs_count ? vm_area(rb_first(&vs->vs_areas)) : null));
+
+    while (area && (area->vm_start - start < size)) {
+        start = area->vm_end;
+        area = vm_next(area);
+    }
+
+    if ((USER_END < start) || (USER_END - start < size))
+        return 0;
+    return start;
+}
+
+err_t vmspace_map_data(vmspace_t *vs, ptr_t start, ptr_t end, uint flags,
+                       const void *data, size_t datalen) {
+    vm_area_t backing = { .vm_data = data, .vm_datalen = datalen };
+    return vmspace_add(vs, start, end, flags, &backing);
+}
+
+err_t vmspace_unmap(vmspace_t *vs, ptr_t start, ptr_t end) {
+    if ((start % PAGE_SIZE) || (end % PAGE_SIZE) || (start >= end))
+        return EINVAL;
+
+    vm_area_t *area = vmspace_floor(vs, start);
+    if (!(area && (area->vm_end > start)))
+        area = (area ? vm_next(area) : (vs->vs_count ? vm_area(rb_first(&vs->vs_areas)) : null));
+
+    while (area && (area->vm_start < end)) {
+        if (area->vm_start < start) {
+            area = vmspace_split(vs, area, start);
+            if (!area) return ENOMEM;
+        }
+        if (end < area->vm_end) {
+            if (!vmspace_split(vs, area, end))
+                return ENOMEM;
+        }
+
+        vm_area_t *next = vm_next(area);
+        vm_release_pages(vs, area->vm_start, area->vm_end);
+        vmspace_unlink(vs, area);
+        area = next;
+    }
+    return 0;
+}
+
+err_t vmspace_protect(vmspace_t *vs, ptr_t start, ptr_t end, uint flags) {
+    if ((start % PAGE_SIZE) || (end % PAGE_SIZE) || (start >= end))
+        return EINVAL;
+
+    /* the range must be covered without holes */
+    vm_area_t *area = vmspace_find(vs, start);
+    if (!area) return ENOMEM;
+
+    vm_area_t *a = area;
+    while (a->vm_end < end) {
+        vm_area_t *next = vm_next(a);
+        if (!(next && (next->vm_start == a->vm_end)))
+            return ENOMEM;
+        a = next;
+    }
+
+    if (area->vm_start < start) {
+        area = vmspace_split(vs, area, start);
+        if (!area) return ENOMEM;
+    }
+
+    vm_area_t *first = area;
+    while (area) {
+        if (end < area->vm_end) {
+            if (!vmspace_split(vs, area, end))
+                return ENOMEM;
+        }
+
+        area->vm_flags = flags;
+        vm_protect_pages(vs, area->vm_start, area->vm_end, flags);
+        if (area->vm_end == end)
+            break;
+        area = vm_next(area);
+    }
+    vm_area_t *last = area;
+
+    /* merge the changed range with itself and its neighbours */
+    vm_area_t *prev = vm_prev(first);
+    if (prev && vm_mergeable(prev, first)) {
+        if (last == first) last = prev;
+        vmspace_merge(vs, prev, first);
+        first = prev;
+    }
+    while (first != last) {
+        vm_area_t *next = vm_next(first);
+        if (vm_mergeable(first, next)) {
+            if (next == last) last = first;
+            vmspace_merge(vs, first, next);
+        } else
+            first = next;
+    }
+    vm_area_t *next = vm_next(last);
+    if (next && vm_mergeable(last, next))
+        vmspace_merge(vs, last, next);
+    return 0;
+}
+
+err_t vmspace_fork(vmspace_t *dst, vmspace_t *src) {
+    struct rb_node *node;
+    for (node = rb_first(&src->vs_areas); node; node = rb_next(node)) {
+        vm_area_t *area = vm_area(node);
+
+        vm_area_t *copy = vm_area_new(area->vm_start, area->vm_end, area->vm_flags);
+        if (!copy) return ENOMEM;
+        copy->vm_data = area->vm_data;
+        copy->vm_datalen = area->vm_datalen;
+        copy->vm_sb = area->vm_sb;
+        copy->vm_ino = area->vm_ino;
+        copy->vm_pgoff = area->vm_pgoff;
+        vmspace_link(dst, copy);
+
+        err_t ret = vm_share_pages(dst, src, area->vm_start, area->vm_end);
+        if (ret) return ret;
+    }
+    return 0;
+}
+
+err_t vmspace_fault(vmspace_t *vs, ptr_t addr, uint error) {
+    vm_area_t *area = vmspace_find(vs, addr);
+    if (!area)
+        return EFAULT;
+
+    if ((error & PGF_WRITE) && !(area->vm_flags & VM_RW))
+        return EACCES;
+    if ((error & PGF_USER) && !(area->vm_flags & VM_USR))
+        return EACCES;
+
+    ptr_t page = addr & PG31_12_MASK;
+    if (error & PGF_PROT) {
+        if (!(error & PGF_WRITE))
+            return EACCES;
+        return vm_copy_on_write(vs, area, page);
+    }
+
+    if (area->vm_sb)
+        return vm_file_page(vs, area, page, error);
+
+    pfn_t frame = vm_fill_page(area, page);
+    if (!frame)
+        return ENOMEM;
+
+    err_t ret = pagedir_map(vs->vs_pagedir, page, frame, vm_pg_flags(area->vm_flags));
+    if (ret) {
+        pmem_free_frame(frame);
+        return ret;
+    }
+
+    ++vs->vs_faults;
+    return 0;
+}
+
+size_t vmspace_resident(vmspace_t *vs) {
+    size_t n_pages = 0;
+    struct rb_node *node;
+    for (node = rb_first(&vs->vs_areas); node; node = rb_next(node)) {
+        vm_area_t *area = vm_area(node);
+        ptr_t addr;
+        for (addr = area->vm_start; addr < area->vm_end; addr += PAGE_SIZE) {
+            pte_t *pte = pagedir_pte(vs->vs_pagedir, addr, false);
+            if (pte && (*pte & PG_PRESENT))
+                ++n_pages;
+        }
+    }
+    return n_pages;
+}
+
+void vmspace_info(vmspace_t *vs) {
+    logmsgif("vmspace: pagedir *%x, %d areas, %d/%d lookups cached, %d faults, %d copied on write",
+             (ptr_t)vs->vs_pagedir, vs->vs_count, vs->vs_hits, vs->vs_lookups,
+             vs->vs_faults, vs->vs_cow);
+
+    struct rb_node *node;
+    for (node = rb_first(&vs->vs_areas); node; node = rb_next(node)) {
+        vm_area_t *area = vm_area(node);
+        logmsgif("  [%x : %x) %s%s%s%s%s", area->vm_start, area->vm_end,
+                 (area->vm_flags & VM_RW ? "rw" : "r-"),
+                 (area->vm_flags & VM_XD ? "-" : "x"),
+                 (area->vm_flags & VM_SHARED ? "s" : "p"),
+                 (area->vm_flags & VM_USR ? " user" : ""),
+                 (area->vm_data ? " data" : (area->vm_sb ? " file" : "")));
+    }
+}
+
+
+/***
+  *     Syscalls
+ ***/
+
+int sys_mmap(struct mmap_arg_struct *args) {
+    const char *funcname = __FUNCTION__;
+    process *proc = current_proc();
+    vmspace_t *vs = &proc->ps_vm;
+    err_t ret;
+
+    size_t len = (args->len + PAGE_SIZE - 1) & PG31_12_MASK;
+    return_dbg_if(!len || (len < args->len), -EINVAL, "%s: len=0x%x\n", funcname, args->len);
+    return_dbg_if(args->offset % PAGE_SIZE, -EINVAL,
+                  "%s: offset=0x%x\n", funcname, args->offset);
+
+    int kind = args->flags & (MAP_SHARED | MAP_PRIVATE);
+    return_dbg_if((kind != MAP_SHARED) && (kind != MAP_PRIVATE), -EINVAL,
+                  "%s: flags=0x%x\n", funcname, args->flags);
+
+    uint flags = VM_USR;
+    if (args->prot & PROT_WRITE) flags |= VM_RW;
+    if (!(args->prot & PROT_EXEC)) flags |= VM_XD;
+    if (kind == MAP_SHARED) flags |= VM_SHARED;
+
+    /* pages are copied on write after fork(), nothing would be shared */
+    return_dbg_if((kind == MAP_SHARED) && (args->flags & MAP_ANONYMOUS), -EINVAL,
+                  "%s: shared anonymous mappings are not supported\n", funcname);
+
+    filedescr *filedes = null;
+    if (!(args->flags & MAP_ANONYMOUS)) {
+        /* only private mappings of files may be written */
+        return_dbg_if((kind == MAP_SHARED) && (flags & VM_RW), -EACCES,
+                      "%s: shared writable mappings are not supported\n", funcname);
+
+        filedes = get_filedescr_for_pid(proc->ps_pid, args->fd);
+        if (!(filedes && filedes->fd_ino))
+            return -EBADF;
+        if (filedes->fd_flags & O_WRONLY)
+            return -EACCES;
+    }
+
+    ptr_t start = (ptr_t)args->addr;
+    if (args->flags & MAP_FIXED) {
+        return_dbg_if(start % PAGE_SIZE, -EINVAL, "%s: addr=*%x\n", funcname, start);
+        return_dbg_if((start < USER_START) || (USER_END < start + len) || (start + len < start),
+                      -EINVAL, "%s: [%x : %x) is not in user space\n",
+                      funcname, start, start + len);
+
+        /* the old mappings go only when the arguments are known to be good */
+        ret = vmspace_unmap(vs, start, start + len);
+        if (ret) return -ret;
+    } else {
+        start = vmspace_free_range(vs, start, len);
+        if (!start) return -ENOMEM;
+    }
+
+    if (!filedes)
+        ret = vmspace_map(vs, start, start + len, flags);
+    else
+        ret = vmspace_map_file(vs, start, start + len, flags,
+                               filedes->fd_sb, filedes->fd_ino, args->offset / PAGE_SIZE);
+    return (ret ? -ret : (int)start);
+}
+
+int sys_munmap(void *addr, size_t len) {
+    ptr_t start = (ptr_t)addr;
+    ptr_t end = start + ((len + PAGE_SIZE - 1) & PG31_12_MASK);
+    if ((start < USER_START) || (end > USER_END))
+        return -EINVAL;
+
+    return -vmspace_unmap(&current_proc()->ps_vm, start, end);
+}
+
+void vmem_setup(void) {
+    vm_area_cache = kmem_cache_create("vm_area", sizeof(vm_area_t), null);
+    if (!vm_area_cache)
+        panic("vmem_setup: no vm_area cache");
+}
@@ -0,0 +1,402 @@
+/*
+ *      Host benchmark for the kernel memory allocators
+ *
+ *  The allocator sources are compiled natively (see compat/ for the
+ *  kernel interfaces they need) and replay synthetic or recorded traces.
+ *  Every (allocator, trace) run happens in a child process, so runs do
+ *  not share heap state and a corrupted heap does not stop the others.
+ *
+ *  For every run the following is reported:
+ *      ns/op       mean latency of an allocator call
+ *      p99, max    99th percentile and worst-case latency
+ *      live        peak of requested bytes alive at once
+ *      footprint   peak of memory the allocator took from its backing store
+ *                  (sampled for libc, mallinfo2() is too slow for every op)
+ *      frag        1 - live/footprint, the overhead at peak usage
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <mem/kheap.h>
+#include <mem/ff_alloc.h>
+#include <mem/pmem.h>
+
+#include "allocbench.h"
+
+struct allocator {
+    const char *name;
+    bool (*setup)(void);
+    void *(*alloc)(size_t size);
+    void *(*resize)(void *p, size_t size);
+    void (*release)(void *p);
+    size_t (*footprint)(void);
+    uint footprint_period;      /* sample footprint every that many ops */
+};
+
+
+/***
+  *     Backing store: pages below 4G
+ ***/
+
+#define HOST_PAGE_SIZE  0x1000
+
+static size_t pmem_host_bytes = 0;
+
+static void *mmap_low(size_t size) {
+    void *p = mmap(null, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT | MAP_NORESERVE, -1, 0);
+    return (p == MAP_FAILED ? null : p);
+}
+
+void *pmem_alloc(size_t pages_count) {
+    void *p = mmap_low(pages_count * HOST_PAGE_SIZE);
+    if (p) pmem_host_bytes += pages_count * HOST_PAGE_SIZE;
+    return p;
+}
+
+err_t pmem_free(void *startptr, size_t pages_count) {
+    pmem_host_bytes -= pages_count * HOST_PAGE_SIZE;
+    return munmap(startptr, pages_count * HOST_PAGE_SIZE);
+}
+
+size_t pmem_host_footprint(void) {
+    return pmem_host_bytes;
+}
+
+
+/***
+  *     Allocators
+ ***/
+
+/* kheap: kmalloc/kfree from src/mem/kheap.c */
+
+static bool kheap_bench_setup(void) {
+    kheap_setup();
+    return pmem_host_footprint() > 0;
+}
+
+static void kheap_bench_free(void *p) {
+    kfree(p);
+}
+
+/* ff_alloc: the first-fit allocator from src/mem/ff_alloc.c */
+
+#define FF_ARENA_SIZE   (256u << 20)
+
+static struct firstfit_allocator *ff_heap;
+static char *ff_start;
+static size_t ff_top;       /* highest byte ever handed out */
+
+static bool ff_setup(void) {
+    ff_start = mmap_low(FF_ARENA_SIZE);
+    if (!ff_start) return false;
+    ff_heap = firstfit_new(ff_start, FF_ARENA_SIZE);
+    return ff_heap != null;
+}
+
+static inline void *ff_track(void *p, size_t size) {
+    size_t top = (size_t)((char *)p + size - ff_start);
+    if (p && (top > ff_top))
+        ff_top = top;
+    return p;
+}
+
+static void *ff_alloc(size_t size) {
+    return ff_track(firstfit_malloc(ff_heap, size), size);
+}
+
+static void *ff_resize(void *p, size_t size) {
+    return ff_track(firstfit_realloc(ff_heap, p, size), size);
+}
+
+static void ff_release(void *p) {
+    firstfit_free(ff_heap, p);
+}
+
+static size_t ff_footprint(void) {
+    return ff_top;
+}
+
+/* libc: the host malloc, as a reference */
+
+static size_t libc_baseline;    /* taken by traces and bookkeeping */
+
+static size_t libc_footprint(void) {
+    struct mallinfo2 mi = mallinfo2();
+    return mi.arena + mi.hblkhd - libc_baseline;
+}
+
+static bool libc_setup(void) {
+    libc_baseline = 0;
+    libc_baseline = libc_footprint();
+    return true;
+}
+
+static struct allocator allocators[] = {
+    { "kheap",  kheap_bench_setup, kmalloc,  krealloc,  kheap_bench_free, pmem_host_footprint, 1 },
+    { "ff",     ff_setup,          ff_alloc, ff_resize, ff_release,       ff_footprint,        1 },
+    { "libc",   libc_setup,        malloc,   realloc,   free,             libc_footprint,      256 },
+    { null },
+};
+
+
+/***
+  *     Replay
+ ***/
+
+struct bench_result {
+    size_t n_ops;
+    size_t n_failed;        /* allocations which returned null */
+    size_t n_corrupted;     /* objects with unexpected contents */
+    uint64_t total_ns;
+    uint32_t p99_ns;
+    uint32_t max_ns;
+    size_t peak_live;
+    size_t peak_footprint;
+};
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline uint8_t pattern(uint32_t id) {
+    return (uint8_t)(id * 0x9d + 1);
+}
+
+static bool check_object(const uint8_t *p, uint32_t id, size_t size) {
+    size_t i;
+    for (i = 0; i < size; ++i)
+        if (p[i] != pattern(id))
+            return false;
+    return true;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+struct replay_state {
+    void **objs;
+    uint32_t *sizes;
+    uint32_t *latency;
+};
+
+static void replay(struct allocator *a, struct trace *t,
+                   struct replay_state *st, struct bench_result *res) {
+    void **objs = st->objs;
+    uint32_t *sizes = st->sizes;
+    uint32_t *latency = st->latency;
+
+    memset(res, 0, sizeof(*res));
+    size_t live = 0;
+
+    size_t i;
+    for (i = 0; i < t->n_ops; ++i) {
+        struct trace_op *top = t->ops + i;
+        uint32_t id = top->id;
+        size_t oldsize = sizes[id];
+        uint64_t start, finish;
+
+        if (objs[id] && !check_object(objs[id], id, oldsize))
+            ++res->n_corrupted;
+
+        switch (top->op) {
+          case TRACE_ALLOC:
+          case TRACE_REALLOC: {
+            void *p;
+            start = now_ns();
+            if (top->op == TRACE_ALLOC)
+                p = a->alloc(top->size);
+            else
+                p = a->resize(objs[id], top->size);
+            finish = now_ns();
+
+            if (!p) {
+                ++res->n_failed;
+                break;
+            }
+            if (oldsize > top->size) oldsize = top->size;
+            memset((uint8_t *)p + oldsize, pattern(id), top->size - oldsize);
+
+            live = live + top->size - sizes[id];
+            objs[id] = p;
+            sizes[id] = top->size;
+            } break;
+          case TRACE_FREE:
+            start = now_ns();
+            a->release(objs[id]);
+            finish = now_ns();
+
+            live -= sizes[id];
+            objs[id] = null;
+            sizes[id] = 0;
+            break;
+          default:
+            continue;
+        }
+
+        uint64_t ns = finish - start;
+        latency[res->n_ops++] = (ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns);
+        res->total_ns += ns;
+        if (res->max_ns < ns) res->max_ns = ns;
+
+        if (res->peak_live < live)
+            res->peak_live = live;
+        if (res->n_ops % a->footprint_period == 0) {
+            size_t footprint = a->footprint();
+            if (res->peak_footprint < footprint)
+                res->peak_footprint = footprint;
+        }
+    }
+
+    if (res->n_ops) {
+        qsort(latency, res->n_ops, sizeof(uint32_t), cmp_u32);
+        res->p99_ns = latency[res->n_ops * 99 / 100];
+    }
+}
+
+static void print_result(struct allocator *a, struct trace *t, struct bench_result *res) {
+    double frag = 0;
+    if (res->peak_footprint)
+        frag = 100.0 * (1.0 - (double)res->peak_live / res->peak_footprint);
+
+    printf("%-6s %-10s %9zu ops %8.1f ns/op  p99 %6u ns  max %8u ns"
+           "  live %8zuK  footprint %8zuK  frag %5.1f%%",
+           a->name, t->name, res->n_ops, (double)res->total_ns / (res->n_ops ? res->n_ops : 1),
+           res->p99_ns, res->max_ns, res->peak_live >> 10, res->peak_footprint >> 10, frag);
+    if (res->n_failed)
+        printf("  FAILED %zu", res->n_failed);
+    if (res->n_corrupted)
+        printf("  CORRUPTED %zu", res->n_corrupted);
+    printf("\n");
+}
+
+static int run(struct allocator *a, struct trace *t) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        /* before setup, so that it is not counted in the footprint */
+        struct replay_state st;
+        st.objs = calloc(t->n_ids, sizeof(void *));
+        st.sizes = calloc(t->n_ids, sizeof(uint32_t));
+        st.latency = calloc(t->n_ops, sizeof(uint32_t));
+        if (!(st.objs && st.sizes && st.latency)) {
+            perror("replay");
+            exit(1);
+        }
+
+        if (!a->setup()) {
+            fprintf(stderr, "%s: setup failed\n", a->name);
+            exit(1);
+        }
+        struct bench_result res;
+        replay(a, t, &st, &res);
+        print_result(a, t, &res);
+        exit((res.n_failed || res.n_corrupted) ? 2 : 0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (WIFSIGNALED(status)) {
+        printf("%-6s %-10s crashed: %s\n", a->name, t->name, strsignal(WTERMSIG(status)));
+        return -1;
+    }
+    return (WEXITSTATUS(status) ? -1 : 0);
+}
+
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-a <allocator>[,...]] [<trace>...]\n"
+            "       %s -w <trace>\n"
+            "  <trace> is a synthetic trace name or a trace file ('-' for stdin),\n"
+            "  all synthetic traces are replayed by default.\n"
+            "  -w writes a trace in the file format to stdout.\n"
+            "allocators:", prog, prog);
+    struct allocator *a;
+    for (a = allocators; a->name; ++a)
+        fprintf(stderr, " %s", a->name);
+    fprintf(stderr, "\nsynthetic traces:\n");
+    trace_synthetic_list(stderr);
+    exit(1);
+}
+
+static bool allocator_selected(const char *selection, const char *name) {
+    if (!selection) return true;
+
+    size_t len = strlen(name);
+    const char *s = selection;
+    while ((s = strstr(s, name))) {
+        bool starts = (s == selection) || (s[-1] == ',');
+        bool ends = (s[len] == '\0') || (s[len] == ',');
+        if (starts && ends) return true;
+        s += len;
+    }
+    return false;
+}
+
+static struct trace *get_trace(const char *name) {
+    struct trace *t = trace_synthetic(name);
+    return (t ? t : trace_load(name));
+}
+
+int main(int argc, char **argv) {
+    const char *selection = null;
+    const char *to_write = null;
+    int opt;
+
+    /* a fixed threshold keeps large trace arrays out of the libc heap */
+    mallopt(M_MMAP_THRESHOLD, 128 * 1024);
+
+    while ((opt = getopt(argc, argv, "a:w:h")) != -1) {
+        switch (opt) {
+          case 'a': selection = optarg; break;
+          case 'w': to_write = optarg; break;
+          default: usage(argv[0]);
+        }
+    }
+
+    if (to_write) {
+        struct trace *t = get_trace(to_write);
+        if (!t) return 1;
+        trace_write(t, stdout);
+        trace_delete(t);
+        return 0;
+    }
+
+    static const char *default_traces[] = { "dirent", "lua", "mixed", null };
+    const char **names = (const char **)argv + optind;
+    if (optind == argc)
+        names = default_traces;
+
+    int ret = 0;
+    for (; *names; ++names) {
+        struct trace *t = get_trace(*names);
+        if (!t) {
+            ret = 1;
+            continue;
+        }
+
+        struct allocator *a;
+        for (a = allocators; a->name; ++a)
+            if (allocator_selected(selection, a->name))
+                if (run(a, t))
+                    ret = 1;
+
+        trace_delete(t);
+    }
+    return ret;
+}
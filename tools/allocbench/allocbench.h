@@ -0,0 +1,51 @@
+#ifndef __ALLOCBENCH_H__
+#define __ALLOCBENCH_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/***
+  *     A trace is a sequence of operations on numbered objects:
+  *
+  *         a <id> <size>       allocate `size` bytes as object `id`
+  *         r <id> <size>       resize object `id` (allocates if not live)
+  *         f <id>              free object `id`
+  *
+  *   Lines starting with '#' are comments. Ids are small integers,
+  *  an id may be reused after its object is freed.
+ ***/
+
+enum trace_opcode {
+    TRACE_ALLOC     = 'a',
+    TRACE_REALLOC   = 'r',
+    TRACE_FREE      = 'f',
+};
+
+struct trace_op {
+    uint8_t op;
+    uint32_t id;
+    uint32_t size;
+};
+
+struct trace {
+    const char *name;
+    struct trace_op *ops;
+    size_t n_ops;
+    size_t capacity;
+    uint32_t n_ids;         /* ids are below this */
+};
+
+struct trace * trace_new(const char *name);
+void trace_delete(struct trace *t);
+void trace_push(struct trace *t, enum trace_opcode op, uint32_t id, uint32_t size);
+
+/* generate a synthetic trace by name, null if there is no such */
+struct trace * trace_synthetic(const char *name);
+void trace_synthetic_list(FILE *f);
+
+/* null and a message on stderr if the file is not a valid trace */
+struct trace * trace_load(const char *filename);
+void trace_write(struct trace *t, FILE *f);
+
+#endif // __ALLOCBENCH_H__
@@ -0,0 +1,6 @@
+#ifndef __ALLOCBENCH_I386_H__
+#define __ALLOCBENCH_I386_H__
+
+/* nothing arch-specific is used by the allocators without MEM_PROFILING */
+
+#endif // __ALLOCBENCH_I386_H__
@@ -0,0 +1,10 @@
+#ifndef __ALLOCBENCH_CONF_H__
+#define __ALLOCBENCH_CONF_H__
+
+/* kernel configuration with the host-only overrides */
+#include_next <conf.h>
+
+#undef  MEM_PROFILING
+#define MEM_PROFILING   (0)
+
+#endif // __ALLOCBENCH_CONF_H__
@@ -0,0 +1,23 @@
+#ifndef __ALLOCBENCH_LOG_H__
+#define __ALLOCBENCH_LOG_H__
+
+/* kernel logging goes to stderr */
+#include <stdio.h>
+
+#define k_printf(...)       fprintf(stderr, __VA_ARGS__)
+#define logmsg(msg)         fputs(msg, stderr)
+#define logmsgf(...)        fprintf(stderr, __VA_ARGS__)
+#define logmsge(...)        (fprintf(stderr, __VA_ARGS__), fputc('\n', stderr))
+#define logmsgef(...)       logmsge(__VA_ARGS__)
+#define logmsgi(...)        (fprintf(stderr, __VA_ARGS__), fputc('\n', stderr))
+#define logmsgif(...)       logmsgi(__VA_ARGS__)
+#define logmsgdf(...)
+
+#define returnv_err_if(assertion, ...) \
+    if (assertion) { logmsgef(__VA_ARGS__); return; }
+#define return_err_if(assertion, retval, ...) \
+    if (assertion) { logmsgef(__VA_ARGS__); return (retval); }
+#define return_dbg_if(assertion, retval, ...) \
+    if (assertion) { return (retval); }
+
+#endif // __ALLOCBENCH_LOG_H__
@@ -0,0 +1,21 @@
+#ifndef __ALLOCBENCH_HOST_H__
+#define __ALLOCBENCH_HOST_H__
+
+/***
+  *     Kernel types for allocator sources built on the host,
+  *   force-included into every translation unit.
+ ***/
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef null
+# define null ((void *)0)
+#endif
+
+typedef unsigned int    uint;
+typedef uintptr_t       ptr_t;
+typedef size_t          index_t;
+typedef size_t          count_t;
+typedef int             err_t;
+
+#endif // __ALLOCBENCH_HOST_H__
@@ -0,0 +1,15 @@
+#ifndef __ALLOCBENCH_PMEM_H__
+#define __ALLOCBENCH_PMEM_H__
+
+/***
+  *     Page allocator for the host: pages are mmap()ed below 4G,
+  *   so allocators which keep addresses in `uint` keep working.
+ ***/
+
+void * pmem_alloc(size_t pages_count);
+err_t pmem_free(void *startptr, size_t pages_count);
+
+/* bytes currently taken from pmem_alloc() */
+size_t pmem_host_footprint(void);
+
+#endif // __ALLOCBENCH_PMEM_H__
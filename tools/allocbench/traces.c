@@ -0,0 +1,310 @@
+/*
+ *      Trace generation and parsing
+ *
+ *  Synthetic traces model the kernel's own allocation patterns; they
+ *  are deterministic, so runs of different allocators are comparable.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocbench.h"
+
+struct trace * trace_new(const char *name) {
+    struct trace *t = calloc(1, sizeof(struct trace));
+    if (!t) return null;
+    t->name = strdup(name);
+    return t;
+}
+
+void trace_delete(struct trace *t) {
+    free((void *)t->name);
+    free(t->ops);
+    free(t);
+}
+
+void trace_push(struct trace *t, enum trace_opcode op, uint32_t id, uint32_t size) {
+    if (t->n_ops == t->capacity) {
+        t->capacity = (t->capacity ? 2 * t->capacity : 4096);
+        t->ops = realloc(t->ops, t->capacity * sizeof(struct trace_op));
+        if (!t->ops) {
+            perror("trace_push");
+            exit(1);
+        }
+    }
+    struct trace_op *top = t->ops + t->n_ops++;
+    top->op = op;
+    top->id = id;
+    top->size = size;
+    if (id >= t->n_ids)
+        t->n_ids = id + 1;
+}
+
+
+/***
+  *     Synthetic traces
+ ***/
+
+static uint32_t rnd_state;
+
+static inline uint32_t rnd(void) {
+    /* xorshift32 */
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static inline uint32_t rnd_range(uint32_t lo, uint32_t hi) {
+    return lo + rnd() % (hi - lo + 1);
+}
+
+/* live object ids, with a stack of released ids for reuse */
+struct idpool {
+    uint32_t *live;
+    size_t n_live;
+    uint32_t *released;
+    size_t n_released;
+    uint32_t next_id;
+};
+
+static void idpool_init(struct idpool *pool, size_t max_live) {
+    pool->live = calloc(max_live, sizeof(uint32_t));
+    pool->released = calloc(max_live, sizeof(uint32_t));
+    pool->n_live = pool->n_released = 0;
+    pool->next_id = 0;
+}
+
+static void idpool_fini(struct idpool *pool) {
+    free(pool->live);
+    free(pool->released);
+}
+
+static uint32_t idpool_get(struct idpool *pool) {
+    uint32_t id = (pool->n_released ? pool->released[--pool->n_released] : pool->next_id++);
+    pool->live[pool->n_live++] = id;
+    return id;
+}
+
+/* releases the `i`th live id */
+static uint32_t idpool_put(struct idpool *pool, size_t i) {
+    uint32_t id = pool->live[i];
+    pool->live[i] = pool->live[--pool->n_live];
+    pool->released[pool->n_released++] = id;
+    return id;
+}
+
+static void trace_free_all(struct trace *t, struct idpool *pool) {
+    while (pool->n_live)
+        trace_push(t, TRACE_FREE, idpool_put(pool, pool->n_live - 1), 0);
+}
+
+/*
+ *  ramfs directories: many small dirents and names, created in bursts
+ *  and removed in random order
+ */
+static void trace_gen_dirent(struct trace *t) {
+    const size_t max_live = 1 << 20;
+    struct idpool pool;
+    idpool_init(&pool, max_live);
+
+    int round;
+    for (round = 0; round < 40; ++round) {
+        int i;
+        for (i = 0; i < 4000 && pool.n_live + 3 < max_live; ++i) {
+            trace_push(t, TRACE_ALLOC, idpool_get(&pool), rnd_range(24, 40));   /* dirent */
+            trace_push(t, TRACE_ALLOC, idpool_get(&pool), rnd_range(4, 64));    /* name */
+            if (rnd() % 4 == 0)
+                trace_push(t, TRACE_ALLOC, idpool_get(&pool), 64);              /* inode */
+        }
+        size_t n_remove = pool.n_live / 2;
+        while (n_remove--)
+            trace_push(t, TRACE_FREE, idpool_put(&pool, rnd() % pool.n_live), 0);
+    }
+    trace_free_all(t, &pool);
+    idpool_fini(&pool);
+}
+
+/*
+ *  Lua: short-lived strings, tables with arrays growing by realloc,
+ *  periodic collections which free most of the young objects
+ */
+static void trace_gen_lua(struct trace *t) {
+    const size_t max_live = 1 << 18;
+    const uint32_t max_array = 16 * 4096;
+    struct idpool pool;
+    idpool_init(&pool, max_live);
+    uint32_t *sizes = calloc(max_live, sizeof(uint32_t));
+    size_t young = 0;       /* live ids from this index on are young */
+
+    int step;
+    for (step = 0; step < 400000; ++step) {
+        uint32_t dice = rnd() % 10;
+        if (dice < 7 || pool.n_live == 0) {
+            /* a string */
+            uint32_t id = idpool_get(&pool);
+            sizes[id] = rnd_range(17, 17 + 80);
+            trace_push(t, TRACE_ALLOC, id, sizes[id]);
+        } else if (dice < 8) {
+            /* a table with its array part */
+            uint32_t id = idpool_get(&pool);
+            sizes[id] = 56;
+            trace_push(t, TRACE_ALLOC, id, sizes[id]);
+            id = idpool_get(&pool);
+            sizes[id] = 4 * 16;
+            trace_push(t, TRACE_ALLOC, id, sizes[id]);
+        } else {
+            /* grow (or shrink back) some live object */
+            uint32_t id = pool.live[rnd() % pool.n_live];
+            uint32_t size = sizes[id];
+            size = (size < max_array ? 2 * size : 64);
+            sizes[id] = size;
+            trace_push(t, TRACE_REALLOC, id, size);
+        }
+
+        if ((step % 4096 == 4095) || (pool.n_live + 2 >= max_live)) {
+            /* collect: most young objects die, some old ones too */
+            size_t i = pool.n_live;
+            while (i-- > 0) {
+                uint32_t chance = (i >= young ? 8 : 1);
+                if (rnd() % 10 < chance)
+                    trace_push(t, TRACE_FREE, idpool_put(&pool, i), 0);
+            }
+            young = pool.n_live;
+        }
+    }
+    trace_free_all(t, &pool);
+    free(sizes);
+    idpool_fini(&pool);
+}
+
+/*
+ *  random sizes with a long tail and reallocations,
+ *  including allocations large enough to bypass the kernel heap bins
+ */
+static void trace_gen_mixed(struct trace *t) {
+    const uint32_t n_slots = 3000;
+    uint32_t *sizes = calloc(n_slots, sizeof(uint32_t));
+    uint32_t id;
+
+    int step;
+    for (step = 0; step < 400000; ++step) {
+        id = rnd() % n_slots;
+        if (sizes[id]) {
+            if (rnd() % 4 == 0) {
+                sizes[id] = rnd_range(1, 600);
+                trace_push(t, TRACE_REALLOC, id, sizes[id]);
+            } else {
+                sizes[id] = 0;
+                trace_push(t, TRACE_FREE, id, 0);
+            }
+        } else {
+            if (rnd() % 50 == 0)
+                sizes[id] = 40000;
+            else
+                sizes[id] = rnd_range(1, (rnd() % 8 ? 1000 : 8000));
+            trace_push(t, TRACE_ALLOC, id, sizes[id]);
+        }
+    }
+    for (id = 0; id < n_slots; ++id)
+        if (sizes[id])
+            trace_push(t, TRACE_FREE, id, 0);
+    free(sizes);
+}
+
+static const struct {
+    const char *name;
+    void (*generate)(struct trace *);
+    const char *description;
+} synthetic_traces[] = {
+    { "dirent", trace_gen_dirent, "bursts of small ramfs dirent/name/inode allocations" },
+    { "lua",    trace_gen_lua,    "Lua-style string churn and table arrays grown by realloc" },
+    { "mixed",  trace_gen_mixed,  "random sizes up to 40K with reallocations" },
+    { null, null, null },
+};
+
+struct trace * trace_synthetic(const char *name) {
+    int i;
+    for (i = 0; synthetic_traces[i].name; ++i) {
+        if (strcmp(name, synthetic_traces[i].name))
+            continue;
+
+        struct trace *t = trace_new(name);
+        rnd_state = 2463534242u;
+        synthetic_traces[i].generate(t);
+        return t;
+    }
+    return null;
+}
+
+void trace_synthetic_list(FILE *f) {
+    int i;
+    for (i = 0; synthetic_traces[i].name; ++i)
+        fprintf(f, "  %-8s %s\n", synthetic_traces[i].name, synthetic_traces[i].description);
+}
+
+
+/***
+  *     Trace files
+ ***/
+
+struct trace * trace_load(const char *filename) {
+    FILE *f = (strcmp(filename, "-") ? fopen(filename, "r") : stdin);
+    if (!f) {
+        perror(filename);
+        return null;
+    }
+
+    struct trace *t = trace_new(filename);
+    bool *live = null;
+    size_t n_live_ids = 0;
+
+    char line[256];
+    size_t lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        ++lineno;
+        char op;
+        unsigned long id, size = 0;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+
+        int n = sscanf(line, " %c %lu %lu", &op, &id, &size);
+        bool ok = (n >= 2) && (id < UINT32_MAX) && (size < UINT32_MAX);
+        if (ok) {
+            if (id >= n_live_ids) {
+                size_t n_new = (id + 1) * 2;
+                live = realloc(live, n_new * sizeof(bool));
+                memset(live + n_live_ids, 0, (n_new - n_live_ids) * sizeof(bool));
+                n_live_ids = n_new;
+            }
+            switch (op) {
+              case TRACE_ALLOC:   ok = (n == 3) && size && !live[id]; live[id] = true; break;
+              case TRACE_REALLOC: ok = (n == 3) && size; live[id] = true; break;
+              case TRACE_FREE:    ok = live[id]; live[id] = false; break;
+              default:            ok = false;
+            }
+        }
+        if (!ok) {
+            fprintf(stderr, "%s:%zu: invalid operation: %s", filename, lineno, line);
+            trace_delete(t);
+            t = null;
+            break;
+        }
+        trace_push(t, op, id, size);
+    }
+
+    free(live);
+    if (f != stdin) fclose(f);
+    return t;
+}
+
+void trace_write(struct trace *t, FILE *f) {
+    fprintf(f, "# %s: %zu operations\n", t->name, t->n_ops);
+    size_t i;
+    for (i = 0; i < t->n_ops; ++i) {
+        struct trace_op *top = t->ops + i;
+        if (top->op == TRACE_FREE)
+            fprintf(f, "%c %u\n", top->op, top->id);
+        else
+            fprintf(f, "%c %u %u\n", top->op, top->id, top->size);
+    }
+}